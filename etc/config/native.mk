@@ -23,9 +23,9 @@ ifeq ($(PO_NATIVE_PLATFORM),linux) #--------------------------------------------
 
   CC_NATIVE:=gcc -c -MMD -O2 -Isrc -Isrc/main -Werror -Wimplicit -DPO_NATIVE=1 -I/usr/include/libdrm
   LD_NATIVE:=gcc
-  LDPOST_NATIVE:=-lm -lz -lasound -lX11 -lpthread -ldrm -lEGL -lgbm -lGLESv2
-  OPT_ENABLE_NATIVE:=genioc alsa x11 drmgx evdev
-  OPT_ENABLE_TOOL:=alsa ossmidi inotify
+  LDPOST_NATIVE:=-lm -lz -lasound -lX11 -lXext -lpthread -ldrm -lEGL -lgbm -lGLESv2
+  OPT_ENABLE_NATIVE:=genioc alsa x11 drmgx evdev upsample pcmsink pixcvt fbsink
+  OPT_ENABLE_TOOL:=alsa ossmidi inotify upsample pixcvt
   EXE_NATIVE:=out/native/pokorc
 
 else ifeq ($(PO_NATIVE_PLATFORM),linuxguiless) #----------------------------------
@@ -34,8 +34,8 @@ else ifeq ($(PO_NATIVE_PLATFORM),linuxguiless) #--------------------------------
   CC_NATIVE:=gcc -c -MMD -O2 -Isrc -Isrc/main -Werror -Wimplicit -DPO_NATIVE=1 -I/usr/include/libdrm
   LD_NATIVE:=gcc
   LDPOST_NATIVE:=-lm -lz -lasound -lpthread -ldrm -lEGL -lgbm -lGLESv2
-  OPT_ENABLE_NATIVE:=genioc alsa drmgx evdev
-  OPT_ENABLE_TOOL:=alsa ossmidi inotify
+  OPT_ENABLE_NATIVE:=genioc alsa drmgx evdev upsample pcmsink pixcvt fbsink
+  OPT_ENABLE_TOOL:=alsa ossmidi inotify upsample pixcvt
   EXE_NATIVE:=out/native/pokorc
 
 else ifeq ($(PO_NATIVE_PLATFORM),raspi) #-----------------------------------------
@@ -46,8 +46,8 @@ else ifeq ($(PO_NATIVE_PLATFORM),raspi) #---------------------------------------
   CC_NATIVE:=gcc -c -MMD -O2 -Isrc -Isrc/main -Werror -Wimplicit -DPO_NATIVE=1 -I/opt/vc/include
   LD_NATIVE:=gcc -L/opt/vc/lib
   LDPOST_NATIVE:=-lm -lz -lasound -lpthread -lbcm_host -lEGL -lGLESv2 -lGL
-  OPT_ENABLE_NATIVE:=genioc alsa evdev bcm
-  OPT_ENABLE_TOOL:=alsa ossmidi inotify
+  OPT_ENABLE_NATIVE:=genioc alsa evdev bcm upsample pcmsink pixcvt fbsink
+  OPT_ENABLE_TOOL:=alsa ossmidi inotify upsample pixcvt
   EXE_NATIVE:=out/native/pokorc
 
 else ifeq ($(PO_NATIVE_PLATFORM),macos) #------------------------------------------
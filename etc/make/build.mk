@@ -21,8 +21,14 @@ OFILES_TOOL_COMMON:=$(filter mid/native/tool/common/%,$(OFILES_NATIVE)) \
   $(filter-out $(addprefix mid/native/opt/,$(addsuffix /%,$(OPT_IGNORE_TOOL))), \
     $(patsubst src/%.c,mid/native/%.o,$(filter src/opt/%,$(CFILES))) \
   ) \
-  mid/native/main/synth.o
+  mid/native/main/synth.o mid/native/main/synth_mix.o
 OFILES_GAME:=$(filter mid/native/main/% mid/native/opt/% mid/native/data/embed/%,$(OFILES_NATIVE))
+# fbsink hashes and encodes frames with the tools' MD5 and PNG encoder.
+ifneq (,$(filter fbsink,$(OPT_ENABLE_NATIVE)))
+  OFILES_GAME+=$(addprefix mid/native/tool/common/, \
+    sr_md5.o png_encode.o png_image.o encoder.o serial_binary.o serial_string.o serial_token.o serial_xforms.o \
+  )
+endif
 ifneq ($(MAKECMDGOALS),clean)
   -include $(OFILES_NATIVE:.o=.d)
 endif
@@ -39,6 +45,11 @@ endef
 TOOLS:=$(filter-out common,$(notdir $(wildcard src/tool/*)))
 $(foreach T,$(TOOLS),$(eval $(call TOOL_RULES,$T)))
 
+# render and synthbench play the embedded songs with the embedded waves, same as the game.
+$(TOOL_render) $(TOOL_synthbench):mid/native/main/data.o $(filter mid/native/data/embed/%.mid.o mid/native/data/embed/%.wave.o,$(OFILES_NATIVE))
+# blitbench runs the game's own blitters.
+$(TOOL_blitbench):mid/native/main/image.o mid/native/main/image_blit.o
+
 # "include" data files get included verbatim, for the most part.
 INCLUDE_SRCFILES:=$(filter src/data/include/%,$(SRCFILES))
 INCLUDE_FILES_NATIVE:=$(patsubst src/data/include/%,out/native/data/%,$(INCLUDE_SRCFILES))
@@ -26,3 +26,19 @@ ifneq (,$(TA_MENU_BIN))
 endif
 
 scoreboard:$(TOOL_scoreboard);$(TOOL_scoreboard)
+
+# Latency calibration against our own output, with scripted taps. Fails unless it measures the offset we tapped at.
+calibrate-loopback:$(EXE_NATIVE) $(INCLUDE_FILES_NATIVE);etc/tool/calibrate-loopback.sh $(EXE_NATIVE) 40 $(RUNARGS)
+
+# The real game loop with no display, as fast as it goes, logging each frame's MD5 to out/framehash.txt. Diff those across commits.
+# Scripted A on the menu starts the first song, and audio advances exactly 1/60 s per update, so every run hashes the same.
+# Scratch HOME, so high scores and calibration neither leak in nor get written.
+framehash:$(EXE_NATIVE) $(INCLUDE_FILES_NATIVE);rm -rf out/framehash-home && mkdir -p out/framehash-home && HOME=$(abspath out/framehash-home) $(EXE_NATIVE) --video-driver=hash --video-out=out/framehash.txt --audio-driver=null --frame-rate=0 --frame-limit=600 --input-script=30=a,34=
+
+BENCH_LABEL?=$(shell git describe --always --dirty 2>/dev/null)
+# Results go to out/synthbench.json; keep them from different commits and compare.
+bench:$(TOOL_synthbench);$(TOOL_synthbench) --json --label="$(BENCH_LABEL)" >out/synthbench.json ; st=$$? ; cat out/synthbench.json ; exit $$st
+# Same for framebuffer conversion, out/pixbench.json.
+pixbench:$(TOOL_pixbench);$(TOOL_pixbench) --json --label="$(BENCH_LABEL)" >out/pixbench.json ; st=$$? ; cat out/pixbench.json ; exit $$st
+# And sprite blitting, out/blitbench.json.
+blitbench:$(TOOL_blitbench);$(TOOL_blitbench) --json --label="$(BENCH_LABEL)" >out/blitbench.json ; st=$$? ; cat out/blitbench.json ; exit $$st
@@ -0,0 +1,28 @@
+#!/bin/bash
+# Automated latency calibration against our own audio output, for test rigs.
+# Usage: etc/tool/calibrate-loopback.sh EXECUTABLE [OFFSET_MS [MORE_ARGS...]]
+# Runs calibration with scripted taps OFFSET_MS after each click, and fails unless it reports OFFSET_MS.
+# Uses a scratch HOME, so the real calibration is untouched, and no display.
+
+EXE="$1"
+MS="${2:-40}"
+shift; [ $# -gt 0 ] && shift
+TOLERANCE=2
+
+SCRATCH="$(mktemp -d)" || exit 1
+trap "rm -rf $SCRATCH" EXIT
+
+OUTPUT="$(HOME="$SCRATCH" "$EXE" --video-driver=null --audio-driver=null --calibrate-loopback="$MS" "$@" 2>&1)"
+RESULT="$(echo "$OUTPUT" | sed -n 's/^Calibrated: \([-+0-9]*\) ms.*/\1/p')"
+if [ -z "$RESULT" ] ; then
+  echo "$OUTPUT"
+  echo "calibrate-loopback: No calibration result."
+  exit 1
+fi
+DIFF=$(( RESULT - MS ))
+if [ $DIFF -lt -$TOLERANCE ] || [ $DIFF -gt $TOLERANCE ] ; then
+  echo "$OUTPUT"
+  echo "calibrate-loopback: Expected $MS ms, measured $RESULT ms."
+  exit 1
+fi
+echo "calibrate-loopback: Expected $MS ms, measured $RESULT ms. OK"
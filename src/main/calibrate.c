@@ -0,0 +1,150 @@
+#include "calibrate.h"
+#include "synth.h"
+#include "data.h"
+#include "highscore.h"
+#include <string.h>
+#include <stdio.h>
+
+#if PO_NATIVE
+
+/* Globals.
+ */
+
+#define CALIBRATE_INTERVAL_MS 500
+#define CALIBRATE_CLICKC       24 /* Metronome clicks in total. */
+#define CALIBRATE_WARMUPC       4 /* Taps on the first few clicks are ignored, while the player finds the beat. */
+#define CALIBRATE_MINC          8 /* Fewer good taps than this, and we don't trust the result. */
+#define CALIBRATE_LEADIN_MS  1000
+
+#define CALIBRATE_CLICK_WAVEID    0
+#define CALIBRATE_CLICK_NOTEID 0x48
+#define CALIBRATE_CLICK_TICKS     2
+
+static struct synth *synth=0;
+static struct synth_snapshot synthstate={0};
+static uint64_t startframe=0; // synth frame of click zero
+static int32_t intervalframes=0;
+static uint8_t postedc=0; // clicks posted to the synth
+static uint8_t tapped[CALIBRATE_CLICKC]; // nonzero if we have a tap for this click
+static int16_t errv[CALIBRATE_CLICKC]; // ms, sorted at finish
+static uint8_t errc=0;
+static uint8_t finished=0;
+static int16_t result=0;
+static int16_t spread=0;
+
+/* Begin.
+ */
+
+void calibrate_begin(struct synth *_synth) {
+  synth=_synth;
+  synth_post_song(synth,0,0,0);
+  synth_get_snapshot(&synthstate,synth);
+  intervalframes=(synth->rate*CALIBRATE_INTERVAL_MS)/1000;
+  startframe=synthstate.framec+audio_estimate_buffered_frame_count()+(synth->rate*CALIBRATE_LEADIN_MS)/1000;
+  postedc=0;
+  memset(tapped,0,sizeof(tapped));
+  errc=0;
+  finished=0;
+  result=0;
+  spread=0;
+}
+
+/* Finish: Take the median, and the median absolute deviation to report how consistent the player was.
+ * Outliers can't drag a median around, so one flubbed tap doesn't matter.
+ */
+
+static void calibrate_sort(int16_t *v,uint8_t c) {
+  uint8_t i=1;
+  for (;i<c;i++) {
+    int16_t n=v[i];
+    uint8_t j=i;
+    for (;j&&(v[j-1]>n);j--) v[j]=v[j-1];
+    v[j]=n;
+  }
+}
+
+static void calibrate_finish() {
+  finished=1;
+  if (errc<CALIBRATE_MINC) {
+    fprintf(stderr,"Calibration: only %d good taps, need %d. Keeping %+d ms.\n",errc,CALIBRATE_MINC,highscore_get_latency());
+    return;
+  }
+  calibrate_sort(errv,errc);
+  result=errv[errc>>1];
+  int16_t devv[CALIBRATE_CLICKC];
+  uint8_t i=0;
+  for (;i<errc;i++) devv[i]=(errv[i]<result)?(result-errv[i]):(errv[i]-result);
+  calibrate_sort(devv,errc);
+  spread=devv[errc>>1];
+  fprintf(stderr,"Calibrated: %+d ms from %d taps, spread %d ms.\n",result,errc,spread);
+  highscore_set_latency(result);
+}
+
+/* Input.
+ * Find the nearest click to the frame that was audible when the button went down.
+ */
+
+uint8_t calibrate_input(uint8_t input,uint8_t pvinput,int64_t time) {
+  #define PRESS(tag) ((input&BUTTON_##tag)&&!(pvinput&BUTTON_##tag))
+  if (finished) {
+    if (PRESS(A)||PRESS(B)) return 0;
+    return 1;
+  }
+  if (PRESS(B)) return 0;
+  if (!PRESS(A)) return 1;
+  #undef PRESS
+
+  uint64_t frame=time?audio_audible_frame_for_time(time):0;
+  if (!frame) frame=synthstate.framec-audio_estimate_buffered_frame_count();
+  int64_t rel=(int64_t)frame-(int64_t)startframe;
+  int64_t clickp=(rel+(intervalframes>>1))/intervalframes;
+  if ((rel<-(intervalframes>>1))||(clickp<CALIBRATE_WARMUPC)||(clickp>=postedc)) return 1;
+  if (tapped[clickp]) return 1;
+  int32_t err=rel-clickp*intervalframes;
+  tapped[clickp]=1;
+  errv[errc++]=(err*1000)/synth->rate;
+  return 1;
+}
+
+/* Update and render.
+ */
+
+void calibrate_update(struct image *fb) {
+  synth_get_snapshot(&synthstate,synth);
+
+  // Post clicks a little ahead of time; the synth starts each at its exact frame.
+  if (!finished) {
+    while (postedc<CALIBRATE_CLICKC) {
+      uint64_t clickframe=startframe+postedc*intervalframes;
+      if (clickframe>synthstate.framec+(intervalframes>>1)) break;
+      synth_post_note_fireforget(synth,CALIBRATE_CLICK_WAVEID,CALIBRATE_CLICK_NOTEID,CALIBRATE_CLICK_TICKS,clickframe);
+      postedc++;
+    }
+    uint64_t endframe=startframe+CALIBRATE_CLICKC*intervalframes;
+    if (synthstate.framec>endframe+audio_estimate_buffered_frame_count()) calibrate_finish();
+  }
+
+  image_clear(fb);
+  char tmp[32];
+  int tmpc;
+  image_blit_string(fb,1,0,"Calibrate",-1,0xff07,font);
+  if (!finished) {
+    image_blit_string(fb,1,18,"Tap A with",-1,0xffff,font);
+    image_blit_string(fb,1,27,"the clicks.",-1,0xffff,font);
+    tmpc=snprintf(tmp,sizeof(tmp),"%d/%d",errc,CALIBRATE_CLICKC-CALIBRATE_WARMUPC);
+    if ((tmpc>0)&&(tmpc<sizeof(tmp))) image_blit_string(fb,1,45,tmp,tmpc,0x1084,font);
+    image_blit_string(fb,1,54,"B: cancel",-1,0x1084,font);
+  } else if (errc<CALIBRATE_MINC) {
+    image_blit_string(fb,1,18,"Not enough",-1,0xffff,font);
+    image_blit_string(fb,1,27,"taps.",-1,0xffff,font);
+    image_blit_string(fb,1,54,"A: done",-1,0x1084,font);
+  } else {
+    tmpc=snprintf(tmp,sizeof(tmp),"Offset %+d ms",result);
+    if ((tmpc>0)&&(tmpc<sizeof(tmp))) image_blit_string(fb,1,18,tmp,tmpc,0xffff,font);
+    tmpc=snprintf(tmp,sizeof(tmp),"Spread %d ms",spread);
+    if ((tmpc>0)&&(tmpc<sizeof(tmp))) image_blit_string(fb,1,27,tmp,tmpc,0x1084,font);
+    image_blit_string(fb,1,54,"A: done",-1,0x1084,font);
+  }
+}
+
+#endif
@@ -0,0 +1,25 @@
+/* calibrate.h
+ * Latency calibration screen, reached from the menu.
+ * We play a metronome and the player taps along. The median of their timing errors is this
+ * cabinet's audio/input latency, which the game applies to note rendering and hit judging.
+ * Native only: Tiny has one fixed hardware setup and no input timestamps to measure with.
+ */
+
+#ifndef CALIBRATE_H
+#define CALIBRATE_H
+
+#include "platform.h"
+
+struct synth;
+
+#if PO_NATIVE
+
+void calibrate_begin(struct synth *synth);
+
+// 1 to proceed, 0 to return to the menu.
+uint8_t calibrate_input(uint8_t input,uint8_t pvinput,int64_t time);
+
+void calibrate_update(struct image *fb);
+
+#endif
+#endif
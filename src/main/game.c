@@ -18,6 +18,8 @@ struct score {
   uint16_t missc; // Unexpected notes struck.
   uint16_t overlookc; // Song notes that weren't struck.
   uint16_t hist[11]; // How many strokes at each quality level.
+  uint16_t errhist[GAME_ERRHIST_SIZE]; // Timing error of hits, see game_get_error_histogram().
+  int32_t errsum; // ms, sum of signed timing errors.
   uint16_t maxcombo; // Highest value of combolength.
   // Derived at finalize:
   uint16_t histmax;
@@ -59,12 +61,15 @@ static struct note {
 } notev[NOTEC]={0};
 
 static struct synth *synth=0;
+static struct synth_snapshot synthstate={0}; // refreshed each update; the synth itself belongs to the audio thread
 static struct fakesheet *fakesheet=0;
 static uint8_t input=0;
 static uint8_t complete=0;
 static uint8_t pending_complete=0;
 static uint32_t highscore=0;
 static uint16_t songid=0;
+static int16_t calibration_ms=0; // from highscore, this machine's audio/input latency
+static int32_t calibration_frames=0;
 
 /* Scoring.
  */
@@ -74,14 +79,20 @@ static uint16_t songid=0;
 #define DOUBLE_COMBO_LENGTH 15
 #define TRIPLE_COMBO_LENGTH 30
  
-static uint8_t score_hit(uint8_t col,uint8_t points) {
-  // Played a note acceptably close to an expected one. (points) in 0..10
-  //fprintf(stderr,"%s %d +%d\n",__func__,col,points);
+static uint8_t score_hit(uint8_t col,uint8_t points,int16_t error_ms) {
+  // Played a note acceptably close to an expected one. (points) in 0..10, (error_ms) negative if early.
+  //fprintf(stderr,"%s %d +%d %+dms\n",__func__,col,points,error_ms);
   
   if (points<=0) score.hist[0]++;
   else if (points>=10) score.hist[10]++;
   else score.hist[points]++;
   
+  int16_t bucket=GAME_ERRHIST_CENTER+(error_ms+((error_ms<0)?-GAME_ERRHIST_MS/2:GAME_ERRHIST_MS/2))/GAME_ERRHIST_MS;
+  if (bucket<0) bucket=0;
+  else if (bucket>=GAME_ERRHIST_SIZE) bucket=GAME_ERRHIST_SIZE-1;
+  score.errhist[bucket]++;
+  score.errsum+=error_ms;
+  
   score.combolength++;
   if (score.combolength>score.maxcombo) score.maxcombo=score.combolength;
   if (score.combolength>=TRIPLE_COMBO_LENGTH) points*=3;
@@ -148,6 +159,12 @@ static void finalize_score() {
   }
 }
 
+const uint16_t *game_get_error_histogram(uint16_t *hitc,int16_t *mean_ms) {
+  if (hitc) *hitc=score.hitc;
+  if (mean_ms) *mean_ms=score.hitc?(score.errsum/score.hitc):0;
+  return score.errhist;
+}
+
 static uint8_t calculate_score_quality() {
   if ((score.combolength>=TRIPLE_COMBO_LENGTH*2)&&!score.missc&&!score.overlookc) {
     return 4;
@@ -228,9 +245,10 @@ void game_begin(
   uint16_t songlen=hdr[4]|(hdr[5]<<8);
   uint16_t fakesheetlen=hdr[6]|(hdr[7]<<8);
   
-  synth->song=songinfo->song+hdrlen+addlhdrlen;
-  synth->songc=songlen;
-  synth->songhold=synth->rate;
+  if (synth_post_song(synth,songinfo->song+hdrlen+addlhdrlen,songlen,synth->rate)<0) {
+    fprintf(stderr,"%s: Rejecting malformed song.\n",songinfo->name);
+  }
+  synth_get_snapshot(&synthstate,synth);
   
   fakesheet->cb_event=cb_fakesheet_event;
   fakesheet->eventv=songinfo->song+hdrlen+addlhdrlen+songlen;
@@ -246,6 +264,8 @@ void game_begin(
   complete=0;
   pending_complete=0;
   songid=songinfo->songid;
+  calibration_ms=highscore_get_latency();
+  calibration_frames=((int32_t)calibration_ms*synth->rate)/1000;
   memset(&score,0,sizeof(score));
   
   struct toast *toast=toastv;
@@ -287,29 +307,29 @@ static void reposition_notes(int32_t now) {
 
 static void update_notes() {
 
-  if (!synth->song) {
+  if (!synthstate.playing) {
     drop_all_notes();
     return;
   }
   
   // Advance fakesheet to the song's time, plus our view window length. May create new notes.
-  uint32_t songtime=synth->songtime;
+  uint32_t songtime=synthstate.songtime;
   songtime-=audio_estimate_buffered_frame_count();
   if (songtime<lastsongtime) {
     fakesheet_reset(fakesheet);
     drop_all_notes();
   }
   lastsongtime=songtime;
-  if (synth->songhold) {
-    if (synth->songhold<peek_time_frames) {
-      fakesheet_advance(fakesheet,peek_time_frames-synth->songhold);
+  if (synthstate.songhold) {
+    if (synthstate.songhold<peek_time_frames) {
+      fakesheet_advance(fakesheet,peek_time_frames-synthstate.songhold);
     }
   } else {
     fakesheet_advance(fakesheet,songtime+peek_time_frames);
   }
   
-  if (synth->songhold<peek_time_frames) {
-    reposition_notes(songtime-synth->songhold);
+  if (synthstate.songhold<peek_time_frames) {
+    reposition_notes(songtime-synthstate.songhold-calibration_frames);
   }
 }
 
@@ -354,46 +374,68 @@ static void update_toasts() {
 
 /* User notes on and off.
  * Find the nearest unscored note in that column and score it, or register a botch.
+ * Judging is on song time, not screen position: We find the song frame that was audible when the button went down,
+ * and compare to each note's time. With no input timestamp, we use what's audible right now.
  */
  
-#define DISTANCE_LIMIT 10 /* pixels */
+#define JUDGE_PERFECT_MS  25 /* Full points within this. */
+#define JUDGE_WINDOW_MS  160 /* Zero points at this, and beyond it's a miss. About the old 10-pixel limit. */
+
+static int32_t song_position_at(int64_t time) {
+  int32_t position=synthstate.songtime-synthstate.songhold;
+  uint64_t frame=time?audio_audible_frame_for_time(time):0;
+  if (frame) return position+(int32_t)(frame-synthstate.framec);
+  return position-audio_estimate_buffered_frame_count();
+}
+
+static uint8_t judge_points(int16_t error_ms) {
+  if (error_ms<0) error_ms=-error_ms;
+  if (error_ms<=JUDGE_PERFECT_MS) return 10;
+  if (error_ms>=JUDGE_WINDOW_MS) return 0;
+  return 9-((error_ms-JUDGE_PERFECT_MS)*10)/(JUDGE_WINDOW_MS-JUDGE_PERFECT_MS);
+}
 
-static void play_note(uint8_t col) {
+static void play_note(uint8_t col,int64_t time) {
   if (col>=5) return;
+  uint64_t frame=audio_frame_for_time(time);
+  int32_t position=song_position_at(time);
   struct note *best=0;
   struct note *note=notev;
-  uint8_t bestdistance=DISTANCE_LIMIT;
+  int16_t besterror=0,bestdistance=JUDGE_WINDOW_MS;
   uint8_t i=NOTEC;
   for (;i-->0;note++) {
     if (note->scored) continue;
     if (note->col!=col) continue;
-    int8_t distance=note->y-52; // The "now" line is at y==52
-    if (distance<0) distance=-distance;
+    int32_t error=position-(int32_t)note->time;
+    if ((error<-synth->rate)||(error>synth->rate)) continue;
+    int16_t error_ms=(error*1000)/synth->rate-calibration_ms;
+    int16_t distance=(error_ms<0)?-error_ms:error_ms;
     if (distance>bestdistance) continue;
     best=note;
+    besterror=error_ms;
     bestdistance=distance;
   }
   
   if (best) {
-    int8_t score=DISTANCE_LIMIT-bestdistance;
     notes_by_input[col].waveid=best->waveid;
     notes_by_input[col].noteid=best->noteid;
-    synth_note_on(synth,best->waveid,best->noteid);
+    synth_post_note_on(synth,best->waveid,best->noteid,frame);
     best->scored=1;
-    uint8_t points=score_hit(col,score);
+    uint8_t points=score_hit(col,judge_points(besterror),besterror);
     add_score_toast(col,points);
   } else {
-    synth_note_fireforget(synth,0,0x30,0x10);
-    synth_note_fireforget(synth,0,0x36,0x10);
+    synth_post_note_fireforget(synth,0,0x30,0x10,frame);
+    synth_post_note_fireforget(synth,0,0x36,0x10,frame);
     score_miss(col);
     add_miss_toast(col);
   }
 }
 
-static void drop_note(uint8_t col) {
+static void drop_note(uint8_t col,int64_t time) {
   if (col>=5) return;
   if (notes_by_input[col].noteid) {
-    synth_note_off(synth,notes_by_input[col].waveid,notes_by_input[col].noteid);
+    uint64_t frame=audio_frame_for_time(time);
+    synth_post_note_off(synth,notes_by_input[col].waveid,notes_by_input[col].noteid,frame);
     notes_by_input[col].waveid=0;
     notes_by_input[col].noteid=0;
   }
@@ -402,11 +444,11 @@ static void drop_note(uint8_t col) {
 /* Receive input.
  */
  
-uint8_t game_input(uint8_t _input,uint8_t pvinput) {
+uint8_t game_input(uint8_t _input,uint8_t pvinput,int64_t time) {
   input=_input;
   #define BTN(tag,col) \
-    if ((input&BUTTON_##tag)&&!(pvinput&BUTTON_##tag)) play_note(col); \
-    else if (!(input&BUTTON_##tag)&&(pvinput&BUTTON_##tag)) drop_note(col);
+    if ((input&BUTTON_##tag)&&!(pvinput&BUTTON_##tag)) play_note(col,time); \
+    else if (!(input&BUTTON_##tag)&&(pvinput&BUTTON_##tag)) drop_note(col,time);
   if (pending_complete) {
   } else if (complete) {
     if ((input&BUTTON_A)&&!(pvinput&BUTTON_A)) return 0;
@@ -425,8 +467,9 @@ uint8_t game_input(uint8_t _input,uint8_t pvinput) {
  */
  
 void game_update() {
-  if (synth->song) {
-    beatc=(synth->songtime-audio_estimate_buffered_frame_count())/song_frames_per_beat;
+  synth_get_snapshot(&synthstate,synth);
+  if (synthstate.playing) {
+    beatc=(synthstate.songtime-audio_estimate_buffered_frame_count())/song_frames_per_beat;
     update_notes();
     update_toasts();
   } else if (complete) {
@@ -526,7 +569,7 @@ static void draw_final_report(struct image *fb) {
 void game_render(struct image *fb) {
   
   // Black out.
-  memset(fb->v,0,fb->w*fb->h*2);
+  image_clear(fb);
   
   // 5 track backgrounds.
   if (!complete) {
@@ -588,8 +631,9 @@ void game_render(struct image *fb) {
     .stride=fb->stride,
     .v=fb->v+12*fb->stride+69,
   };
-  uint32_t subtiming=synth->songtime%song_frames_per_beat;
-  dancer_update(&dancerdst,subtiming,synth->song?song_frames_per_beat:1,beatc,calculate_score_quality(),input?1:0);
+  uint32_t subtiming=synthstate.songtime%song_frames_per_beat;
+  dancer_update(&dancerdst,subtiming,synthstate.playing?song_frames_per_beat:1,beatc,calculate_score_quality(),input?1:0);
+  image_damage(fb,69,12,24,24); // dancer writes pixels directly, and its view has its own damage anyway
   
   // Combo quality indicator.
   image_blit_opaque(fb,69,37,&bits,10,40,24,24);
@@ -20,7 +20,17 @@ void game_begin(
 );
 
 // 1 to proceed, 0 to return to song select.
-uint8_t game_input(uint8_t input,uint8_t pvinput);
+// (time) is when it happened, in the platform's microseconds, or zero if unknown.
+uint8_t game_input(uint8_t input,uint8_t pvinput,int64_t time);
+
+/* Timing error of each hit in the current or last song, for tuning the judging windows.
+ * Bucket (i) counts errors nearest (i-GAME_ERRHIST_CENTER)*GAME_ERRHIST_MS, negative early and positive late.
+ * The end buckets also take everything beyond them.
+ */
+#define GAME_ERRHIST_MS 10
+#define GAME_ERRHIST_CENTER 16
+#define GAME_ERRHIST_SIZE (GAME_ERRHIST_CENTER*2+1)
+const uint16_t *game_get_error_histogram(uint16_t *hitc,int16_t *mean_ms);
 
 void game_update();
 void game_render(struct image *image);
@@ -31,9 +31,9 @@ static uint8_t highscore_count=0; // in records
  
 #if PO_NATIVE
   static char highscore_path_storage[1024];
-  static const char *highscore_path() {
+  static const char *highscore_path_for(const char *base) {
     const char *home=getenv("HOME");
-    int c=snprintf(highscore_path_storage,sizeof(highscore_path_storage),"%s/.config/aksomm/pocket-orchestra/highscore",home);
+    int c=snprintf(highscore_path_storage,sizeof(highscore_path_storage),"%s/.config/aksomm/pocket-orchestra/%s",home,base);
     if ((c<1)||(c>=sizeof(highscore_path_storage))) return 0;
     int slashp=c-1;
     while (slashp&&(highscore_path_storage[slashp]!='/')) slashp--;
@@ -42,6 +42,9 @@ static uint8_t highscore_count=0; // in records
     highscore_path_storage[slashp]='/';
     return highscore_path_storage;
   }
+  static const char *highscore_path() {
+    return highscore_path_for("highscore");
+  }
 #endif
 
 /* Read from disk.
@@ -124,6 +127,45 @@ void highscore_set(uint16_t songid,uint32_t score,uint8_t medal) {
   highscore_save();
 }
 
+/* Latency calibration.
+ * A decimal integer in its own file, so it's easy to inspect and edit by hand.
+ */
+ 
+#if PO_NATIVE
+  static int16_t highscore_latency=0;
+  static uint8_t highscore_latency_loaded=0;
+#endif
+ 
+int16_t highscore_get_latency() {
+  #if PO_NATIVE
+    if (!highscore_latency_loaded) {
+      highscore_latency_loaded=1;
+      const char *path=highscore_path_for("latency");
+      FILE *f=path?fopen(path,"r"):0;
+      if (f) {
+        int v=0;
+        if ((fscanf(f,"%d",&v)==1)&&(v>=-1000)&&(v<=1000)) highscore_latency=v;
+        fclose(f);
+      }
+    }
+    return highscore_latency;
+  #else
+    return 0;
+  #endif
+}
+
+void highscore_set_latency(int16_t ms) {
+  #if PO_NATIVE
+    highscore_latency=ms;
+    highscore_latency_loaded=1;
+    const char *path=highscore_path_for("latency");
+    FILE *f=path?fopen(path,"w"):0;
+    if (!f) return;
+    fprintf(f,"%d\n",ms);
+    fclose(f);
+  #endif
+}
+
 /* Send score to server.
  */
  
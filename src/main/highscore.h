@@ -17,6 +17,13 @@
 void highscore_get(uint32_t *score,uint8_t *medal,uint16_t songid);
 void highscore_set(uint16_t songid,uint32_t score,uint8_t medal);
 
+/* Audio/input latency in ms, measured by calibration and kept next to the high scores.
+ * Positive means the player hears things later than we think, so strikes late. Zero if never calibrated.
+ * Native only; tiny reads zero and doesn't save.
+ */
+int16_t highscore_get_latency();
+void highscore_set_latency(int16_t ms);
+
 /* Slightly different concern.
  * Send the score to our server via USB, if possible.
  */
@@ -1,7 +1,37 @@
 #include "platform.h"
+#include "image_internal.h"
 #include <string.h>
 #include <stdio.h>
 
+/* Damage.
+ */
+ 
+void image_damage(struct image *image,int16_t x,int16_t y,int16_t w,int16_t h) {
+  struct image_rect *d=&image->damage;
+  if (d->w<1) {
+    d->x=x; d->y=y; d->w=w; d->h=h;
+    return;
+  }
+  if (x<d->x) { d->w+=d->x-x; d->x=x; }
+  if (y<d->y) { d->h+=d->y-y; d->y=y; }
+  if (x+w>d->x+d->w) d->w=x+w-d->x;
+  if (y+h>d->y+d->h) d->h=y+h-d->y;
+}
+
+/* Clear.
+ */
+ 
+void image_clear(struct image *image) {
+  if (image->stride==image->w) {
+    memset(image->v,0,image->w*image->h*2);
+  } else {
+    uint16_t *row=image->v;
+    int16_t yi=image->h;
+    for (;yi-->0;row+=image->stride) memset(row,0,image->w*2);
+  }
+  image->damage=(struct image_rect){0,0,image->w,image->h};
+}
+
 /* Blit preamble.
  */
  
@@ -11,7 +41,8 @@
   if (dsty<0) { srcy-=dsty; h+=dsty; dsty=0; } \
   if (dstx>dst->w-w) w=dst->w-dstx; \
   if (dsty>dst->h-h) h=dst->h-dsty; \
-  if ((w<1)||(h<1)) return;
+  if ((w<1)||(h<1)) return; \
+  image_damage(dst,dstx,dsty,w,h);
 
 /* Blit opaque.
  */
@@ -40,17 +71,12 @@ void image_blit_colorkey(
   int16_t w,int16_t h
 ) {
   PREBLIT
-  uint16_t *dstrow=dst->v+dsty*dst->stride+dstx;
-  const uint16_t *srcrow=src->v+srcy*src->stride+srcx;
-  int yi=h;
-  for (;yi-->0;dstrow+=dst->stride,srcrow+=src->stride) {
-    uint16_t *dstp=dstrow;
-    const uint16_t *srcp=srcrow;
-    int xi=w;
-    for (;xi-->0;dstp++,srcp++) {
-      if (*srcp) *dstp=*srcp;
-    }
-  }
+  if (!image_blitter) image_blitter_select(0);
+  image_blitter->colorkey(
+    dst->v+dsty*dst->stride+dstx,dst->stride,
+    src->v+srcy*src->stride+srcx,src->stride,
+    w,h
+  );
 }
 
 /* Blit with colorkey, reversing the X axis.
@@ -67,18 +93,14 @@ void image_blit_colorkey_flop(
   if (dstx>dst->w-w) { srcx+=dstx+w-dst->w; w=dst->w-dstx; }
   if (dsty>dst->h-h) h=dst->h-dsty;
   if ((w<1)||(h<1)) return;
+  image_damage(dst,dstx,dsty,w,h);
   
-  uint16_t *dstrow=dst->v+dsty*dst->stride+dstx;
-  const uint16_t *srcrow=src->v+srcy*src->stride+srcx+w-1;
-  int yi=h;
-  for (;yi-->0;dstrow+=dst->stride,srcrow+=src->stride) {
-    uint16_t *dstp=dstrow;
-    const uint16_t *srcp=srcrow;
-    int xi=w;
-    for (;xi-->0;dstp++,srcp--) {
-      if (*srcp) *dstp=*srcp;
-    }
-  }
+  if (!image_blitter) image_blitter_select(0);
+  image_blitter->colorkey_flop(
+    dst->v+dsty*dst->stride+dstx,dst->stride,
+    src->v+srcy*src->stride+srcx,src->stride,
+    w,h
+  );
 }
 
 /* Blit from 1-bit glyph.
@@ -94,6 +116,14 @@ uint8_t image_blit_glyph(
   if (!srcw) return 0; // nonzero but zero width denotes a "nothing" glyph (which we don't use)
   dsty+=srcy;
   
+  // Damage the glyph's whole cell, clipped.
+  int16_t dx=dstx,dy=dsty,dw=srcw,dh=8;
+  if (dx<0) { dw+=dx; dx=0; }
+  if (dy<0) { dh+=dy; dy=0; }
+  if (dx>dst->w-dw) dw=dst->w-dx;
+  if (dy>dst->h-dh) dh=dst->h-dy;
+  if ((dw>0)&&(dh>0)) image_damage(dst,dx,dy,dw,dh);
+  
   uint16_t *dstrow=dst->v+dsty*dst->stride+dstx;
   uint32_t mask=0x04000000;
   uint8_t yi=8;
@@ -144,6 +174,7 @@ void image_fill_rect(struct image *image,int16_t x,int16_t y,int16_t w,int16_t h
   if (x>image->w-w) w=image->w-x;
   if (y>image->h-h) h=image->h-y;
   if ((w<1)||(h<1)) return;
+  image_damage(image,x,y,w,h);
   uint16_t *dstrow=image->v+y*image->w+x;
   for (;h-->0;dstrow+=image->stride) {
     uint16_t *dstp=dstrow;
@@ -0,0 +1,231 @@
+/* image_blit.c
+ * Colorkey blitters, in portable C and a few SIMD flavors.
+ * The SIMD ones key 8 pixels at a time: Compare source against zero, and the mask picks dst or src per lane.
+ * A row's last vector is flush against its right edge, overlapping the one before. Keying is idempotent, so that's harmless,
+ * and it means rows 4 pixels or wider never fall back to scalar. Most of our sprites are 4 to 16 wide.
+ */
+
+#include "image_internal.h"
+
+#if PO_NATIVE && (defined(__x86_64__)||defined(__i386__))
+  #define IMAGE_BLIT_X86 1
+  #include <immintrin.h>
+#endif
+#if PO_NATIVE && (defined(__aarch64__)||defined(__ARM_NEON))
+  #define IMAGE_BLIT_NEON 1
+  #include <arm_neon.h>
+#endif
+
+const struct image_blitter *image_blitter=0;
+
+/* Portable C.
+ */
+
+static void image_colorkey_c(uint16_t *dst,int dststride,const uint16_t *src,int srcstride,int w,int h) {
+  for (;h-->0;dst+=dststride,src+=srcstride) {
+    uint16_t *dstp=dst;
+    const uint16_t *srcp=src;
+    int xi=w;
+    for (;xi-->0;dstp++,srcp++) {
+      if (*srcp) *dstp=*srcp;
+    }
+  }
+}
+
+static void image_colorkey_flop_c(uint16_t *dst,int dststride,const uint16_t *src,int srcstride,int w,int h) {
+  for (src+=w-1;h-->0;dst+=dststride,src+=srcstride) {
+    uint16_t *dstp=dst;
+    const uint16_t *srcp=src;
+    int xi=w;
+    for (;xi-->0;dstp++,srcp--) {
+      if (*srcp) *dstp=*srcp;
+    }
+  }
+}
+
+/* SSE2.
+ * Reversing 8 lanes takes three shuffles: each half's words, then the halves.
+ */
+
+#if IMAGE_BLIT_X86
+
+#define IMAGE_KEY8_SSE2(dstp,s) { \
+  __m128i m=_mm_cmpeq_epi16(s,zero); \
+  __m128i d=_mm_loadu_si128((const __m128i*)(dstp)); \
+  _mm_storeu_si128((__m128i*)(dstp),_mm_or_si128(_mm_and_si128(m,d),_mm_andnot_si128(m,s))); \
+}
+#define IMAGE_KEY4_SSE2(dstp,s) { \
+  __m128i m=_mm_cmpeq_epi16(s,zero); \
+  __m128i d=_mm_loadl_epi64((const __m128i*)(dstp)); \
+  _mm_storel_epi64((__m128i*)(dstp),_mm_or_si128(_mm_and_si128(m,d),_mm_andnot_si128(m,s))); \
+}
+#define IMAGE_REV8_SSE2(s) _mm_shuffle_epi32(_mm_shufflehi_epi16(_mm_shufflelo_epi16(s,0x1b),0x1b),0x4e)
+#define IMAGE_REV4_SSE2(s) _mm_shufflelo_epi16(s,0x1b)
+
+__attribute__((target("sse2")))
+static void image_colorkey_sse2(uint16_t *dst,int dststride,const uint16_t *src,int srcstride,int w,int h) {
+  if (w<4) {
+    image_colorkey_c(dst,dststride,src,srcstride,w,h);
+    return;
+  }
+  const __m128i zero=_mm_setzero_si128();
+  for (;h-->0;dst+=dststride,src+=srcstride) {
+    if (w>=8) {
+      int x=0;
+      for (;x<w-8;x+=8) {
+        __m128i s=_mm_loadu_si128((const __m128i*)(src+x));
+        IMAGE_KEY8_SSE2(dst+x,s)
+      }
+      __m128i s=_mm_loadu_si128((const __m128i*)(src+w-8));
+      IMAGE_KEY8_SSE2(dst+w-8,s)
+    } else {
+      __m128i s=_mm_loadl_epi64((const __m128i*)src);
+      IMAGE_KEY4_SSE2(dst,s)
+      s=_mm_loadl_epi64((const __m128i*)(src+w-4));
+      IMAGE_KEY4_SSE2(dst+w-4,s)
+    }
+  }
+}
+
+__attribute__((target("sse2")))
+static void image_colorkey_flop_sse2(uint16_t *dst,int dststride,const uint16_t *src,int srcstride,int w,int h) {
+  if (w<4) {
+    image_colorkey_flop_c(dst,dststride,src,srcstride,w,h);
+    return;
+  }
+  const __m128i zero=_mm_setzero_si128();
+  for (;h-->0;dst+=dststride,src+=srcstride) {
+    if (w>=8) {
+      int x=0;
+      for (;x<w-8;x+=8) {
+        __m128i s=_mm_loadu_si128((const __m128i*)(src+w-8-x));
+        s=IMAGE_REV8_SSE2(s);
+        IMAGE_KEY8_SSE2(dst+x,s)
+      }
+      __m128i s=_mm_loadu_si128((const __m128i*)src);
+      s=IMAGE_REV8_SSE2(s);
+      IMAGE_KEY8_SSE2(dst+w-8,s)
+    } else {
+      __m128i s=_mm_loadl_epi64((const __m128i*)(src+w-4));
+      s=IMAGE_REV4_SSE2(s);
+      IMAGE_KEY4_SSE2(dst,s)
+      s=_mm_loadl_epi64((const __m128i*)src);
+      s=IMAGE_REV4_SSE2(s);
+      IMAGE_KEY4_SSE2(dst+w-4,s)
+    }
+  }
+}
+
+#endif
+
+/* NEON.
+ * vbsl does the select in one go. Reversing 8 lanes is a rev64 within each half, then swap the halves.
+ */
+
+#if IMAGE_BLIT_NEON
+
+#define IMAGE_KEY8_NEON(dstp,s) { \
+  uint16x8_t m=vceqq_u16(s,vdupq_n_u16(0)); \
+  vst1q_u16(dstp,vbslq_u16(m,vld1q_u16(dstp),s)); \
+}
+#define IMAGE_KEY4_NEON(dstp,s) { \
+  uint16x4_t m=vceq_u16(s,vdup_n_u16(0)); \
+  vst1_u16(dstp,vbsl_u16(m,vld1_u16(dstp),s)); \
+}
+
+static inline uint16x8_t image_rev8_neon(uint16x8_t s) {
+  s=vrev64q_u16(s);
+  return vextq_u16(s,s,4);
+}
+
+static void image_colorkey_neon(uint16_t *dst,int dststride,const uint16_t *src,int srcstride,int w,int h) {
+  if (w<4) {
+    image_colorkey_c(dst,dststride,src,srcstride,w,h);
+    return;
+  }
+  for (;h-->0;dst+=dststride,src+=srcstride) {
+    if (w>=8) {
+      int x=0;
+      for (;x<w-8;x+=8) {
+        uint16x8_t s=vld1q_u16(src+x);
+        IMAGE_KEY8_NEON(dst+x,s)
+      }
+      uint16x8_t s=vld1q_u16(src+w-8);
+      IMAGE_KEY8_NEON(dst+w-8,s)
+    } else {
+      uint16x4_t s=vld1_u16(src);
+      IMAGE_KEY4_NEON(dst,s)
+      s=vld1_u16(src+w-4);
+      IMAGE_KEY4_NEON(dst+w-4,s)
+    }
+  }
+}
+
+static void image_colorkey_flop_neon(uint16_t *dst,int dststride,const uint16_t *src,int srcstride,int w,int h) {
+  if (w<4) {
+    image_colorkey_flop_c(dst,dststride,src,srcstride,w,h);
+    return;
+  }
+  for (;h-->0;dst+=dststride,src+=srcstride) {
+    if (w>=8) {
+      int x=0;
+      for (;x<w-8;x+=8) {
+        uint16x8_t s=image_rev8_neon(vld1q_u16(src+w-8-x));
+        IMAGE_KEY8_NEON(dst+x,s)
+      }
+      uint16x8_t s=image_rev8_neon(vld1q_u16(src));
+      IMAGE_KEY8_NEON(dst+w-8,s)
+    } else {
+      uint16x4_t s=vrev64_u16(vld1_u16(src+w-4));
+      IMAGE_KEY4_NEON(dst,s)
+      s=vrev64_u16(vld1_u16(src));
+      IMAGE_KEY4_NEON(dst+w-4,s)
+    }
+  }
+}
+
+#endif
+
+/* Registry, in order of preference.
+ */
+
+static const struct image_blitter image_blitterv[]={
+#if IMAGE_BLIT_X86
+  {"sse2",image_colorkey_sse2,image_colorkey_flop_sse2},
+#endif
+#if IMAGE_BLIT_NEON
+  {"neon",image_colorkey_neon,image_colorkey_flop_neon},
+#endif
+  {"c",image_colorkey_c,image_colorkey_flop_c},
+};
+
+static int8_t image_blitter_supported(const struct image_blitter *blitter) {
+  #if IMAGE_BLIT_X86
+    if (blitter->colorkey==image_colorkey_sse2) return __builtin_cpu_supports("sse2")?1:0;
+  #endif
+  return 1;
+}
+
+const struct image_blitter *image_blitter_get(uint8_t p) {
+  const struct image_blitter *blitter=image_blitterv;
+  uint8_t i=sizeof(image_blitterv)/sizeof(struct image_blitter);
+  for (;i-->0;blitter++) {
+    if (!image_blitter_supported(blitter)) continue;
+    if (!p--) return blitter;
+  }
+  return 0;
+}
+
+int8_t image_blitter_select(const char *name) {
+  const struct image_blitter *blitter;
+  uint8_t p=0;
+  for (;blitter=image_blitter_get(p);p++) {
+    if (!name) break;
+    const char *a=name,*b=blitter->name;
+    while (*a&&(*a==*b)) { a++; b++; }
+    if (!*a&&!*b) break;
+  }
+  if (!blitter) return -1;
+  image_blitter=blitter;
+  return 0;
+}
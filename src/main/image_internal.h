@@ -0,0 +1,34 @@
+/* image_internal.h
+ * Colorkey blitter kernels, shared between image.c and image_blit.c.
+ * Not for general use, but the benchmark tool peeks in here.
+ */
+
+#ifndef IMAGE_INTERNAL_H
+#define IMAGE_INTERNAL_H
+
+#include <stdint.h>
+
+/* Every blitter must produce output identical to the portable C one.
+ * Both copy a (w,h) rectangle of nonzero source pixels onto (dst). Strides are in pixels. Caller has clipped.
+ * colorkey: dst[x]=src[x] where nonzero.
+ * colorkey_flop: dst[x]=src[w-1-x] where nonzero. (src) is still the rectangle's left edge.
+ * (dst) and (src) must not overlap.
+ */
+struct image_blitter {
+  const char *name;
+  void (*colorkey)(uint16_t *dst,int dststride,const uint16_t *src,int srcstride,int w,int h);
+  void (*colorkey_flop)(uint16_t *dst,int dststride,const uint16_t *src,int srcstride,int w,int h);
+};
+
+extern const struct image_blitter *image_blitter;
+
+/* Null to select the best one this CPU supports, or name one.
+ * Fails if named blitter not compiled in or not supported by the CPU.
+ */
+int8_t image_blitter_select(const char *name);
+
+/* Iterate over compiled-in blitters supported by this CPU, starting at zero. Null at the end.
+ */
+const struct image_blitter *image_blitter_get(uint8_t p);
+
+#endif
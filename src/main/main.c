@@ -4,6 +4,7 @@
 #include "data.h"
 #include "menu.h"
 #include "game.h"
+#include "calibrate.h"
 #include <string.h>
 #include <stdlib.h>
 #include <stdio.h>
@@ -26,6 +27,7 @@ static uint32_t framec=0;
 
 // If null, we are in the menu.
 static const struct songinfo *songinfo=0;
+static uint8_t calibrating=0;
 
 static struct synth synth={0};
 static struct fakesheet fakesheet={0};
@@ -37,6 +39,10 @@ int16_t audio_next() {
   return synth_update(&synth);
 }
 
+void audio_render(int16_t *v,int framec,int chanc) {
+  synth_render(&synth,v,framec,chanc);
+}
+
 /* Main loop.
  */
  
@@ -52,11 +58,50 @@ static uint8_t xxx_input_automation_delay=0;
 static uint8_t xxx_input_override=0;
 #endif
  
+static void deliver_input(uint8_t next,int64_t time) {
+  #if PO_NATIVE
+    if (calibrating) {
+      if (!calibrate_input(next,pvinput,time)) {
+        calibrating=0;
+        menu_init();
+      }
+      pvinput=next;
+      return;
+    }
+  #endif
+  if (songinfo) {
+    if (!game_input(next,pvinput,time)) {
+      songinfo=0;
+      menu_init();
+    }
+  } else {
+    songinfo=menu_input(next,pvinput);
+    #if PO_NATIVE
+      if (songinfo==&menu_calibrate) {
+        songinfo=0;
+        calibrating=1;
+        calibrate_begin(&synth);
+      }
+    #endif
+    if (songinfo) game_begin(songinfo,&synth,&fakesheet);
+  }
+  pvinput=next;
+}
+ 
 void loop() {
   framec++;
 
   input=platform_update();
   
+  #if PO_NATIVE
+    // Replay each transition, so presses shorter than a frame still count, and each carries its own time.
+    struct platform_input_event event;
+    while (platform_next_input_event(&event)>0) {
+      uint8_t next=event.value?(pvinput|event.btnid):(pvinput&~event.btnid);
+      if (next!=pvinput) deliver_input(next,event.time);
+    }
+  #endif
+  
   #if 0 // Input automation
   if (xxx_input_automation_delay) {
     xxx_input_automation_delay--;
@@ -67,27 +112,21 @@ void loop() {
   }
   #endif
   
-  if (input!=pvinput) {
-    if (songinfo) {
-      if (!game_input(input,pvinput)) {
-        songinfo=0;
-        menu_init();
-      }
-    } else {
-      songinfo=menu_input(input,pvinput);
-      if (songinfo) game_begin(songinfo,&synth,&fakesheet);
-    }
-    pvinput=input;
-  }
+  if (input!=pvinput) deliver_input(input,0);
   
   if (songinfo) {
     game_update();
     game_render(&fb);
+  } else if (calibrating) {
+    #if PO_NATIVE
+      calibrate_update(&fb);
+    #endif
   } else {
     menu_update(&fb);
   }
   
-  platform_send_framebuffer(fb.v);
+  platform_send_framebuffer_damaged(fb.v,&fb.damage,fb.damage.w?1:0);
+  fb.damage.w=0;
 }
 
 /* Init.
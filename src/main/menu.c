@@ -11,6 +11,14 @@ static int8_t menup=0;
 static uint8_t medalv[16];
 static uint32_t scorev[16];
 
+// One entry after the songs, for calibration. It shares the bottom row with the high score.
+#if PO_NATIVE
+  #define MENU_ENTRYC (songinfoc+1)
+  const struct songinfo menu_calibrate={0};
+#else
+  #define MENU_ENTRYC songinfoc
+#endif
+
 /* Init.
  */
  
@@ -27,8 +35,8 @@ void menu_init() {
  
 static void menu_move(int8_t d) {
   menup+=d;
-  if (menup<0) menup=songinfoc-1;
-  else if (menup>=songinfoc) menup=0;
+  if (menup<0) menup=MENU_ENTRYC-1;
+  else if (menup>=MENU_ENTRYC) menup=0;
   //TODO sound effect?
 }
 
@@ -39,6 +47,9 @@ const struct songinfo *menu_input(uint8_t input,uint8_t pvinput) {
   #define PRESS(tag) ((input&BUTTON_##tag)&&!(pvinput&BUTTON_##tag))
   if (PRESS(A)||PRESS(B)) {
     //TODO sound effect?
+    #if PO_NATIVE
+      if (menup>=songinfoc) return &menu_calibrate;
+    #endif
     return songinfov+menup;
   }
   if (PRESS(UP)) menu_move(-1);
@@ -51,7 +62,7 @@ const struct songinfo *menu_input(uint8_t input,uint8_t pvinput) {
  */
  
 void menu_update(struct image *fb) {
-  memset(fb->v,0,fb->w*fb->h*2);
+  image_clear(fb);
   
   // List of songs, shouldn't be more than 6.
   int16_t x=9,y=0;
@@ -66,8 +77,11 @@ void menu_update(struct image *fb) {
     }
   }
   
-  // Seventh row: High score for highlighted song.
-  if ((menup>=0)&&(menup<16)) {
+  // Seventh row: High score for highlighted song, and calibration at the right.
+  #if PO_NATIVE
+    image_blit_string(fb,74,9*6,"Sync",-1,(menup>=songinfoc)?0xff07:0x1084,font);
+  #endif
+  if ((menup>=0)&&(menup<songinfoc)&&(menup<16)) {
     y=9*6;
     char tmp[32];
     int16_t tmpc=snprintf(tmp,sizeof(tmp),"Hi: %d",scorev[menup]);
@@ -14,6 +14,11 @@ void menu_init();
 // Returns a songinfo when one is selected -- stop calling menu at that point.
 const struct songinfo *menu_input(uint8_t input,uint8_t pvinput);
 
+#if PO_NATIVE
+  // menu_input() returns this when the player selects calibration (the entry after the last song).
+  extern const struct songinfo menu_calibrate;
+#endif
+
 void menu_update(struct image *fb);
 
 #endif
@@ -14,12 +14,15 @@
   extern "C" {
 #endif
 
+struct image_rect;
+
 /* Provided by game; called by Arduino or genioc.
  *********************************************************************/
 
 void setup();
 void loop();
 int16_t audio_next();
+void audio_render(int16_t *v,int framec,int chanc); // interleaved, same signal in each channel
 
 /* Provided by driver.
  *********************************************************************/
@@ -28,21 +31,61 @@ uint8_t platform_init(int32_t *audio_rate);
 uint8_t platform_update();
 void platform_send_framebuffer(const void *fb);
 
+/* Same thing, promising that nothing outside (rectv) changed since the last send.
+ * Drivers may use that to convert and upload less, or ignore it. (rectc) zero if nothing changed.
+ */
+void platform_send_framebuffer_damaged(const void *fb,const struct image_rect *rectv,int rectc);
+
 void usb_send(const void *v,int c);
 int usb_read(void *dst,int dsta);
 int usb_read_byte();
 
 int audio_estimate_buffered_frame_count();
 
+/* Every input transition since the last platform_update(), in order, with its time.
+ * (time) is microseconds on the driver's monotonic clock, or zero if unknown.
+ * platform_update() still returns the final state, which these transitions lead to unless some were lost.
+ * Native only; the tiny driver reports state once per frame.
+ */
+struct platform_input_event {
+  int64_t time;
+  uint8_t btnid; // one or more BUTTON_*
+  uint8_t value;
+};
+int platform_next_input_event(struct platform_input_event *dst); // =>0 when exhausted
+
+/* Synthesizer frames against input times, zero if unknown.
+ * "audible" is the frame at the speaker at that moment, for judging the player against the song.
+ * The other is one output buffer later, a frame we can usually still render, sounding a constant latency after (time_us),
+ * for triggering a note at the moment the player actually pressed the button, instead of whenever the next audio period happens to start.
+ */
+uint64_t audio_frame_for_time(int64_t time_us);
+uint64_t audio_audible_frame_for_time(int64_t time_us);
+
 /* Imaging.
  *********************************************************************/
  
+struct image_rect {
+  int16_t x,y,w,h;
+};
+
+/* (damage) is the bounds of everything drawn since you last zeroed it; empty if (w) zero.
+ * Drawing functions below maintain it. If you write pixels directly, call image_damage().
+ * Views into another image have their own damage; it's up to you to pass it along to the parent.
+ */
 struct image {
   uint16_t *v;
   int16_t w,h;
   int16_t stride; // in pixels
+  struct image_rect damage;
 };
 
+// Rect must be in bounds.
+void image_damage(struct image *image,int16_t x,int16_t y,int16_t w,int16_t h);
+
+// Fill with black, damaging all of it.
+void image_clear(struct image *image);
+
 /* We check output bounds but not input -- one presumes you know the input geometry well.
  */
 void image_blit_opaque(
@@ -1,26 +1,45 @@
 #include "synth.h"
+#include "synth_internal.h"
 #include <stdio.h>
+#include <string.h>
 
-#define SYNTH_RELEASE_TIME_22050 2000
+static const struct synth_envelope synth_envelope_default={0,0,SYNTH_SUSTAIN_FULL,SYNTH_RELEASE_TIME_22050};
 
 /* MIDI noteid to 22050-based frequency, normalized to 32 bits.
+ * This is the pristine reference; tables for other rates all derive from it directly.
  */
  
-static uint32_t noterates[128]={
-  2125742,2252146,2386065,2527948,2678268,2837526,3006254,3185015,3374406,3575058,3787642,4012867,4251485,
-  4504291,4772130,5055896,5356535,5675051,6012507,6370030,6748811,7150117,7575285,8025735,8502970,9008582,
-  9544261,10111792,10713070,11350103,12025015,12740059,13497623,14300233,15150569,16051469,17005939,18017165,
-  19088521,20223584,21426141,22700205,24050030,25480119,26995246,28600467,30301139,32102938,34011878,36034330,
-  38177043,40447168,42852281,45400411,48100060,50960238,53990491,57200933,60602276,64205876,68023757,72068660,
-  76354085,80894335,85704563,90800821,96200119,101920476,107980983,114401866,121204555,128411753,136047513,
-  144137319,152708170,161788671,171409126,181601643,192400238,203840952,215961966,228803732,242409110,256823506,
-  272095026,288274639,305416341,323577341,342818251,363203285,384800477,407681904,431923931,457607465,484818220,
-  513647012,544190053,576549277,610832681,647154683,685636503,726406571,769600953,815363807,863847862,915214929,
-  969636441,1027294024,1088380105,1153098554,1221665363,1294309365,1371273005,1452813141,1539201906,1630727614,
-  1727695724u,1830429858u,1939272882u,2054588048u,2176760211u,2306197109u,2443330725u,2588618730u,2742546010u,2905626283u,
-  3078403812u,3261455229u,
-};
-static int32_t noterates_ref=22050;
+#define SYNTH_NOTERATES_22050(_) \
+  _(2125742) _(2252146) _(2386065) _(2527948) _(2678268) _(2837526) _(3006254) _(3185015) \
+  _(3374406) _(3575058) _(3787642) _(4012867) _(4251485) _(4504291) _(4772130) _(5055896) \
+  _(5356535) _(5675051) _(6012507) _(6370030) _(6748811) _(7150117) _(7575285) _(8025735) \
+  _(8502970) _(9008582) _(9544261) _(10111792) _(10713070) _(11350103) _(12025015) _(12740059) \
+  _(13497623) _(14300233) _(15150569) _(16051469) _(17005939) _(18017165) _(19088521) _(20223584) \
+  _(21426141) _(22700205) _(24050030) _(25480119) _(26995246) _(28600467) _(30301139) _(32102938) \
+  _(34011878) _(36034330) _(38177043) _(40447168) _(42852281) _(45400411) _(48100060) _(50960238) \
+  _(53990491) _(57200933) _(60602276) _(64205876) _(68023757) _(72068660) _(76354085) _(80894335) \
+  _(85704563) _(90800821) _(96200119) _(101920476) _(107980983) _(114401866) _(121204555) _(128411753) \
+  _(136047513) _(144137319) _(152708170) _(161788671) _(171409126) _(181601643) _(192400238) _(203840952) \
+  _(215961966) _(228803732) _(242409110) _(256823506) _(272095026) _(288274639) _(305416341) _(323577341) \
+  _(342818251) _(363203285) _(384800477) _(407681904) _(431923931) _(457607465) _(484818220) _(513647012) \
+  _(544190053) _(576549277) _(610832681) _(647154683) _(685636503) _(726406571) _(769600953) _(815363807) \
+  _(863847862) _(915214929) _(969636441) _(1027294024) _(1088380105) _(1153098554) _(1221665363) _(1294309365) \
+  _(1371273005) _(1452813141) _(1539201906) _(1630727614) _(1727695724) _(1830429858) _(1939272882) _(2054588048) \
+  _(2176760211) _(2306197109) _(2443330725) _(2588618730) _(2742546010) _(2905626283) _(3078403812) _(3261455229)
+
+/* Tables for the common rates are generated at compile time, exactly as we would at runtime.
+ */
+
+#define SYNTH_NOTERATE_AT(rate,v) (uint32_t)(((uint64_t)(v)*22050)/(rate)),
+#define SYNTH_NOTERATE_22050(v) v##u,
+#define SYNTH_NOTERATE_44100(v) SYNTH_NOTERATE_AT(44100,v##u)
+#define SYNTH_NOTERATE_48000(v) SYNTH_NOTERATE_AT(48000,v##u)
+
+static const uint32_t noterates_22050[128]={SYNTH_NOTERATES_22050(SYNTH_NOTERATE_22050)};
+#if PO_NATIVE
+static const uint32_t noterates_44100[128]={SYNTH_NOTERATES_22050(SYNTH_NOTERATE_44100)};
+static const uint32_t noterates_48000[128]={SYNTH_NOTERATES_22050(SYNTH_NOTERATE_48000)};
+#endif
 
 /* Init.
  */
@@ -28,192 +47,577 @@ static int32_t noterates_ref=22050;
 int8_t synth_init(struct synth *synth,int32_t rate) {
   
   if ((rate<100)||(rate>1000000)) return -1;
+  if (!synth_mixer) synth_mixer_select(0);
   synth->rate=rate;
   
   synth->frames_per_tick=rate/SYNTH_TICKS_PER_SECOND;
   if (synth->frames_per_tick<1) synth->frames_per_tick=1;
   
   synth->release_time=(rate*SYNTH_RELEASE_TIME_22050)/22050;
+  uint8_t waveid=0;
+  for (;waveid<SYNTH_WAVE_COUNT;waveid++) synth->envelopev[waveid]=synth_envelope_default;
   
-  if (rate!=noterates_ref) {
-    uint32_t *v=noterates;
-    uint8_t i=128;
-    for (;i-->0;v++) {
-      uint64_t tmp=*v;
-      tmp=(tmp*noterates_ref)/rate;
-      *v=tmp;
-    }
-    noterates_ref=rate;
+  synth_silence_all(synth);
+  synth->stealc=0;
+  synth->voicepeak=0;
+  
+  switch (rate) {
+    case 22050: synth->noterates=noterates_22050; break;
+    #if PO_NATIVE
+      case 44100: synth->noterates=noterates_44100; break;
+      case 48000: synth->noterates=noterates_48000; break;
+      default: {
+          uint8_t i=0;
+          for (;i<128;i++) {
+            synth->noteratesbuf[i]=((uint64_t)noterates_22050[i]*22050)/rate;
+          }
+          synth->noterates=synth->noteratesbuf;
+        }
+    #else
+      default: return -1;
+    #endif
   }
   
   return 0;
 }
 
-/* Read and process events from song at the current pointer, advancing state.
- * Stops after we set a delay or loop.
+/* Decode one command from a binary song.
+ * Returns the length consumed, or <0 if malformed.
+ * (event->frame) is not touched.
  */
  
-static void synth_consume_song(struct synth *synth) {
-  uint8_t inputchannel=0xff; // if 0..4, the next NOTE_ON or NOTE_FIREFORGET is an input event
-  while (1) {
+static int synth_decode_event(struct synth_event *event,const uint8_t *src,int srcc) {
+  if (srcc<1) return -1;
+  uint8_t lead=src[0];
   
-    // Stop processing at end of song for at least one frame, as a safety measure.
-    if (synth->songp>=synth->songc) {
-      synth_release_all(synth);
-      if (0) {//repeat
-        synth->songp=0;
-        synth->songtime=0;
-      } else {
-        synth->song=0;
-        synth->songc=0;
-        synth->songp=0;
-        synth->songtime=0;
+  if (!(lead&0x80)) {
+    event->op=SYNTH_EVENT_DELAY;
+    event->durticks=lead;
+    return 1;
+  }
+  
+  event->waveid=lead&0x07;
+  // All other currently-defined commands are distinguishable by the top 5 bits.
+  switch (lead&0xf8) {
+    case 0x80: { // NOTE_FIREFORGET
+        if (srcc<3) return -1;
+        event->op=SYNTH_EVENT_FIREFORGET;
+        event->noteid=src[1]&0x7f;
+        event->durticks=src[2];
+      } return 3;
+    case 0xe0: { // NOTE_ON
+        if (srcc<2) return -1;
+        event->op=SYNTH_EVENT_NOTE_ON;
+        event->noteid=src[1]&0x7f;
+      } return 2;
+    case 0xc0: { // NOTE_OFF
+        if (srcc<2) return -1;
+        event->op=SYNTH_EVENT_NOTE_OFF;
+        event->noteid=src[1]&0x7f;
+      } return 2;
+  }
+  return -1;
+}
+
+/* Compile song.
+ * Each batch of commands between delays fires on one frame, and the delay counts from the frame after.
+ */
+ 
+int synth_compile_song(struct synth_event *dst,int dsta,const uint8_t *src,int srcc,int32_t frames_per_tick) {
+  int dstc=0,srcp=0;
+  uint32_t frame=1;
+  while (1) {
+    struct synth_event event={.frame=frame};
+    if (srcp>=srcc) {
+      event.op=SYNTH_EVENT_END;
+    } else {
+      int err=synth_decode_event(&event,src+srcp,srcc-srcp);
+      if (err<0) {
+        fprintf(stderr,"Malformed song command 0x%02x at %d/%d\n",src[srcp],srcp,srcc);
+        return -1;
+      }
+      srcp+=err;
+      if (event.op==SYNTH_EVENT_DELAY) {
+        frame+=1+event.durticks*frames_per_tick;
+        continue;
       }
-      return;
-    }
-    
-    uint8_t lead=synth->song[synth->songp++];
-    
-    // DELAY
-    if (!(lead&0x80)) {
-      synth->songdelay=lead*synth->frames_per_tick;
-      return;
-    }
-    
-    #define REQUIRE(c) { \
-      if (synth->songp>synth->songc-(c)) { \
-        fprintf(stderr,"Overran song expecting %d bytes at %d/%d\n",c,synth->songp,synth->songc); \
-        synth->song=0; \
-        synth->songc=0; \
-        return; \
-      } \
     }
-    
-    // All other currently-defined commands are distinguishable by the top 5 bits.
-    switch (lead&0xf8) {
-    
-      case 0x80: { // NOTE_FIREFORGET
-          REQUIRE(2)
-          uint8_t b1=synth->song[synth->songp++];
-          uint8_t b2=synth->song[synth->songp++];
-          synth_note_fireforget(synth,lead&0x07,b1&0x7f,b2);
-          inputchannel=0xff;
-        } break;
-    
-      case 0xe0: { // NOTE_ON
-          REQUIRE(1)
-          uint8_t b1=synth->song[synth->songp++];
-          synth_note_on(synth,lead&0x07,b1&0x7f);
-          inputchannel=0xff;
-        } break;
-    
-      case 0xc0: { // NOTE_OFF
-          REQUIRE(1)
-          uint8_t b1=synth->song[synth->songp++];
-          synth_note_off(synth,lead&0x07,b1&0x7f);
-        } break;
-    
-      default: {
-          fprintf(stderr,"Unknown song command 0x%02x at %d/%d\n",lead,synth->songp-1,synth->songc);
-          synth->song=0;
-          synth->songc=0;
-          synth_silence_all(synth);
-          return;
-        }
+    if (dst&&(dstc<dsta)) dst[dstc]=event;
+    dstc++;
+    if (event.op==SYNTH_EVENT_END) return dstc;
+  }
+}
+
+/* Begin song.
+ */
+ 
+int8_t synth_play_song(struct synth *synth,const uint8_t *src,uint16_t srcc) {
+  synth->song=0;
+  synth->songc=0;
+  synth->songp=0;
+  synth->songdelay=0;
+  synth->songtime=0;
+  #if SYNTH_EVENT_LIMIT
+    synth->eventc=0;
+    synth->eventp=0;
+  #endif
+  if (!src) return 0;
+  #if SYNTH_EVENT_LIMIT
+    int eventc=synth_compile_song(synth->eventv,SYNTH_EVENT_LIMIT,src,srcc,synth->frames_per_tick);
+    if (eventc>SYNTH_EVENT_LIMIT) {
+      fprintf(stderr,"Song too long, %d events, limit %d\n",eventc,SYNTH_EVENT_LIMIT);
+      return -1;
     }
-    #undef REQUIRE
+    if (eventc<1) return -1;
+    synth->eventc=eventc;
+  #else
+    if (synth_compile_song(0,0,src,srcc,synth->frames_per_tick)<1) return -1;
+  #endif
+  synth->song=src;
+  synth->songc=srcc;
+  return 0;
+}
+
+/* Apply one event from the song.
+ */
+ 
+static void synth_apply_event(struct synth *synth,const struct synth_event *event) {
+  switch (event->op) {
+    case SYNTH_EVENT_FIREFORGET: synth_note_fireforget(synth,event->waveid,event->noteid,event->durticks); break;
+    case SYNTH_EVENT_NOTE_ON: synth_note_on(synth,event->waveid,event->noteid); break;
+    case SYNTH_EVENT_NOTE_OFF: synth_note_off(synth,event->waveid,event->noteid); break;
+    case SYNTH_EVENT_END: {
+        synth_release_all(synth);
+        synth_play_song(synth,0,0);
+      } break;
   }
 }
 
-/* Update.
+#if !SYNTH_EVENT_LIMIT
+
+/* Read and process events from song at the current pointer, advancing state.
+ * Stops after we set a delay or end.
+ * The song was validated at synth_play_song(), so no need to check anything here.
  */
  
-int16_t synth_update(struct synth *synth) {
+static void synth_consume_song(struct synth *synth) {
+  while (synth->song) {
+    struct synth_event event;
+    if (synth->songp>=synth->songc) {
+      event.op=SYNTH_EVENT_END;
+    } else {
+      synth->songp+=synth_decode_event(&event,synth->song+synth->songp,synth->songc-synth->songp);
+      if (event.op==SYNTH_EVENT_DELAY) {
+        synth->songdelay=event.durticks*synth->frames_per_tick;
+        return;
+      }
+    }
+    synth_apply_event(synth,&event);
+  }
+}
+
+#endif
 
-  // Update song.
+/* Advance song state for the first frame of a span, and return the span's length.
+ * Over the whole span, song state is constant; only the counters move.
+ * This is exactly what synth_update() used to do once per frame.
+ */
+ 
+static int synth_advance_song(struct synth *synth,int framec) {
   if (synth->songhold>0) {
-    synth->songhold--;
-  } else if (synth->songdelay>0) {
-    synth->songdelay--;
+    if (framec>synth->songhold) framec=synth->songhold;
+    synth->songhold-=framec;
+    return framec;
+  }
+  if (!synth->song) return framec;
+  #if SYNTH_EVENT_LIMIT
+    const struct synth_event *event=synth->eventv+synth->eventp;
+    uint32_t untilc=event->frame-synth->songtime-1;
+    if (untilc>0) {
+      if (framec>untilc) framec=untilc;
+      synth->songtime+=framec;
+      return framec;
+    }
     synth->songtime++;
-  } else if (synth->song) {
+    while (synth->song&&(event->frame==synth->songtime)) {
+      synth->eventp++;
+      synth_apply_event(synth,event++);
+    }
+  #else
+    if (synth->songdelay>0) {
+      if (framec>synth->songdelay) framec=synth->songdelay;
+      synth->songdelay-=framec;
+      synth->songtime+=framec;
+      return framec;
+    }
     synth->songtime++;
     synth_consume_song(synth);
+  #endif
+  return 1;
+}
+
+/* Voice heap, keyed on ttl.
+ */
+ 
+static void synth_heap_swap(struct synth *synth,uint8_t a,uint8_t b) {
+  uint8_t tmp=synth->heap[a];
+  synth->heap[a]=synth->heap[b];
+  synth->heap[b]=tmp;
+  synth->voices.heapp[synth->heap[a]]=a;
+  synth->voices.heapp[synth->heap[b]]=b;
+}
+
+static void synth_heap_up(struct synth *synth,uint8_t p) {
+  const uint32_t *ttl=synth->voices.ttl;
+  while (p) {
+    uint8_t parent=(p-1)>>1;
+    if (ttl[synth->heap[parent]]<=ttl[synth->heap[p]]) return;
+    synth_heap_swap(synth,p,parent);
+    p=parent;
   }
+}
 
-  // Generate PCM.
-  int32_t sample=0;
-  struct synth_voice *voice=synth->voicev;
-  uint8_t i=synth->voicec;
-  for (;i-->0;voice++) {
-    if (voice->ttl>0) {
-      voice->ttl--;
-      int32_t sample1=voice->v[voice->p>>SYNTH_P_SHIFT];
-      if (voice->ttl<synth->release_time) {
-        if (!voice->ttl) voice->waveid=voice->noteid=0xff;
-        sample1*=((voice->ttl*0x400)/synth->release_time);
-      } else {
-        sample1<<=10;
+static void synth_heap_down(struct synth *synth,uint8_t p) {
+  const uint32_t *ttl=synth->voices.ttl;
+  while (1) {
+    uint8_t least=p;
+    uint8_t child=(p<<1)+1;
+    if ((child<synth->voicec)&&(ttl[synth->heap[child]]<ttl[synth->heap[least]])) least=child;
+    child++;
+    if ((child<synth->voicec)&&(ttl[synth->heap[child]]<ttl[synth->heap[least]])) least=child;
+    if (least==p) return;
+    synth_heap_swap(synth,p,least);
+    p=least;
+  }
+}
+
+/* Held-note index.
+ */
+ 
+static void synth_unindex_voice(struct synth *synth,uint8_t voiceid) {
+  struct synth_voices *voices=&synth->voices;
+  uint8_t waveid=voices->waveid[voiceid];
+  uint8_t noteid=voices->noteid[voiceid];
+  if ((waveid>=SYNTH_WAVE_COUNT)||(noteid>=0x80)) return;
+  #if SYNTH_NOTE_INDEX
+    uint8_t *link=&synth->noteindex[waveid][noteid];
+    while (*link) {
+      if (*link==voiceid+1) {
+        *link=voices->keynext[voiceid];
+        break;
       }
-      sample+=sample1;
-      voice->p+=voice->pd;
+      link=&voices->keynext[*link-1];
     }
+  #endif
+  voices->waveid[voiceid]=voices->noteid[voiceid]=0xff;
+}
+
+/* Remove a voice from the heap and put it back in the free list.
+ */
+ 
+static void synth_retire_voice(struct synth *synth,uint8_t voiceid) {
+  synth_unindex_voice(synth,voiceid);
+  uint8_t p=synth->voices.heapp[voiceid];
+  synth->voicec--;
+  if (p<synth->voicec) {
+    synth_heap_swap(synth,p,synth->voicec);
+    synth_heap_up(synth,p);
+    synth_heap_down(synth,synth->voices.heapp[synth->heap[p]]);
   }
-  sample>>=10;
-  if (sample>32767) return 32767;
-  if (sample<-32768) return -32768;
-  return sample;
+  synth->voices.heapp[voiceid]=0xff;
+  synth->freev[synth->freec++]=voiceid;
 }
 
-/* Get available voice or pick one to overwrite.
+/* Finished voices have ttl zero, so they're all at the top of the heap.
  */
  
-static struct synth_voice *synth_get_available_voice(struct synth *synth) {
-  while (synth->voicec&&!synth->voicev[synth->voicec-1].ttl) synth->voicec--;
-  if (synth->voicec<SYNTH_VOICE_LIMIT) return synth->voicev+synth->voicec++;
-  struct synth_voice *best=0;
-  struct synth_voice *voice=synth->voicev;
-  uint8_t i=synth->voicec;
-  for (;i-->0;voice++) {
-    if (!voice->ttl) return voice;
-    if (!best) best=voice;
-    else if (voice->ttl<best->ttl) best=voice;
+static void synth_drop_finished_voices(struct synth *synth) {
+  while (synth->voicec&&!synth->voices.ttl[synth->heap[0]]) {
+    synth_retire_voice(synth,synth->heap[0]);
+  }
+}
+
+/* Get available voice, or steal the one closest to ending.
+ * Returned voice is not in the heap.
+ */
+ 
+static uint8_t synth_get_available_voice(struct synth *synth) {
+  if (!synth->freec) {
+    uint8_t victim=synth->heap[0];
+    if (synth->voices.ttl[victim]) synth->stealc++;
+    synth_retire_voice(synth,victim);
+  }
+  return synth->freev[--(synth->freec)];
+}
+
+/* Envelope times in frames at our rate.
+ * Only called on stage changes and note starts, never per frame.
+ */
+ 
+static uint32_t synth_envelope_frames(const struct synth *synth,uint16_t frames22050) {
+  #if PO_NATIVE
+    if (synth->rate!=22050) return ((uint64_t)frames22050*synth->rate)/22050;
+  #endif
+  return frames22050;
+}
+
+/* Begin attack, decay, or sustain, skipping any stage with zero length.
+ */
+ 
+static void synth_voice_enter_stage(struct synth *synth,uint8_t voiceid,uint8_t stage) {
+  struct synth_voices *voices=&synth->voices;
+  const struct synth_envelope *env=voices->env[voiceid];
+  uint32_t sustain=(env->sustain<SYNTH_SUSTAIN_FULL)?env->sustain:SYNTH_SUSTAIN_FULL;
+  sustain<<=SYNTH_LEVEL_SHIFT;
+  uint32_t c;
+  if ((stage==SYNTH_STAGE_ATTACK)&&(c=synth_envelope_frames(synth,env->attack))) {
+    voices->level[voiceid]=0;
+    voices->step[voiceid]=SYNTH_LEVEL_FULL/c;
+  } else if ((stage<=SYNTH_STAGE_DECAY)&&(c=synth_envelope_frames(synth,env->decay))) {
+    stage=SYNTH_STAGE_DECAY;
+    voices->level[voiceid]=SYNTH_LEVEL_FULL;
+    voices->step[voiceid]=-(int32_t)((SYNTH_LEVEL_FULL-sustain)/c);
+  } else {
+    stage=SYNTH_STAGE_SUSTAIN;
+    c=0;
+    voices->level[voiceid]=sustain;
+    voices->step[voiceid]=0;
+  }
+  voices->stage[voiceid]=stage;
+  voices->stagec[voiceid]=c;
+}
+
+/* Add one voice into a mix buffer, for so many frames.
+ * Returns without touching the tail if the voice runs out first.
+ * The span is cut wherever the envelope changes stage; each piece is a single kernel call.
+ */
+ 
+static void synth_mix_voice(int32_t *dst,int framec,struct synth *synth,uint8_t voiceid) {
+  struct synth_voices *voices=&synth->voices;
+  uint32_t ttl=voices->ttl[voiceid];
+  const int16_t *v=voices->v[voiceid];
+  uint32_t p=voices->p[voiceid];
+  uint32_t pd=voices->pd[voiceid];
+  while ((framec>0)&&ttl) {
+    uint32_t c=framec;
+    if (ttl>voices->rel[voiceid]) {
+      uint32_t limit=ttl-voices->rel[voiceid];
+      if (limit<c) c=limit;
+      if ((voices->stage[voiceid]!=SYNTH_STAGE_SUSTAIN)&&(voices->stagec[voiceid]<c)) c=voices->stagec[voiceid];
+    } else {
+      // Release is a straight line from wherever we are, reaching zero as ttl does.
+      if (voices->stage[voiceid]!=SYNTH_STAGE_RELEASE) {
+        voices->stage[voiceid]=SYNTH_STAGE_RELEASE;
+        voices->step[voiceid]=-(int32_t)(voices->level[voiceid]/ttl);
+      }
+      if (ttl<c) c=ttl;
+    }
+    uint32_t level=voices->level[voiceid];
+    int32_t step=voices->step[voiceid];
+    if (!step&&(level==SYNTH_LEVEL_FULL)) synth_mixer->sustain(dst,c,v,p,pd);
+    else if (level||step) synth_mixer->envelope(dst,c,v,p,pd,level,step);
+    voices->level[voiceid]=level+(uint32_t)step*c;
+    p+=pd*c;
+    ttl-=c;
+    dst+=c;
+    framec-=c;
+    switch (voices->stage[voiceid]) {
+      case SYNTH_STAGE_ATTACK: if (!(voices->stagec[voiceid]-=c)) synth_voice_enter_stage(synth,voiceid,SYNTH_STAGE_DECAY); break;
+      case SYNTH_STAGE_DECAY: if (!(voices->stagec[voiceid]-=c)) synth_voice_enter_stage(synth,voiceid,SYNTH_STAGE_SUSTAIN); break;
+    }
+  }
+  voices->p[voiceid]=p;
+  voices->ttl[voiceid]=ttl;
+}
+
+/* Command queue, audio side.
+ */
+
+#if SYNTH_CMDQ_SIZE
+
+static void synth_apply_cmd(struct synth *synth,const struct synth_cmd *cmd) {
+  switch (cmd->op) {
+    case SYNTH_CMD_NOTE_ON: synth_note_on(synth,cmd->waveid,cmd->noteid); break;
+    case SYNTH_CMD_NOTE_OFF: synth_note_off(synth,cmd->waveid,cmd->noteid); break;
+    case SYNTH_CMD_FIREFORGET: synth_note_fireforget(synth,cmd->waveid,cmd->noteid,cmd->durticks); break;
+    case SYNTH_CMD_SONG: {
+        synth_play_song(synth,cmd->song,cmd->songc);
+        synth->songhold=cmd->songhold;
+        synth->songapplied++;
+      } break;
+  }
+}
+
+/* Apply every command due by now, and return the span (up to framec) before the next one is due.
+ */
+
+static int synth_apply_cmds(struct synth *synth,int framec) {
+  uint32_t tail=__atomic_load_n(&synth->cmdtail,__ATOMIC_ACQUIRE);
+  uint32_t head=synth->cmdhead;
+  while (head!=tail) {
+    const struct synth_cmd *cmd=synth->cmdv+(head&(SYNTH_CMDQ_SIZE-1));
+    if (cmd->frame>synth->framec) {
+      if (cmd->frame-synth->framec<framec) framec=cmd->frame-synth->framec;
+      break;
+    }
+    synth_apply_cmd(synth,cmd);
+    head++;
+    __atomic_store_n(&synth->cmdhead,head,__ATOMIC_RELEASE);
+  }
+  return framec;
+}
+
+/* Sequence lock: (snapshotseq) is odd while we write, and readers retry if it moved.
+ */
+
+static void synth_publish_snapshot(struct synth *synth) {
+  struct synth_snapshot *snapshot=&synth->snapshot;
+  uint32_t seq=synth->snapshotseq;
+  __atomic_store_n(&synth->snapshotseq,seq+1,__ATOMIC_RELAXED);
+  __atomic_thread_fence(__ATOMIC_RELEASE);
+  __atomic_store_n(&snapshot->framec,synth->framec,__ATOMIC_RELAXED);
+  __atomic_store_n(&snapshot->songtime,synth->songtime,__ATOMIC_RELAXED);
+  __atomic_store_n(&snapshot->songhold,synth->songhold,__ATOMIC_RELAXED);
+  __atomic_store_n(&snapshot->songserial,synth->songapplied,__ATOMIC_RELAXED);
+  __atomic_store_n(&snapshot->playing,synth->song?1:0,__ATOMIC_RELAXED);
+  __atomic_store_n(&synth->snapshotseq,seq+2,__ATOMIC_RELEASE);
+}
+
+#endif
+
+/* Render.
+ */
+ 
+void synth_render(struct synth *synth,int16_t *dst,int framec,int chanc) {
+  if (chanc<1) return;
+  int32_t mix[SYNTH_MIX_CHUNK];
+  while (framec>0) {
+    int spanc=(framec<SYNTH_MIX_CHUNK)?framec:SYNTH_MIX_CHUNK;
+    #if SYNTH_CMDQ_SIZE
+      spanc=synth_apply_cmds(synth,spanc);
+    #endif
+    spanc=synth_advance_song(synth,spanc);
+    memset(mix,0,sizeof(int32_t)*spanc);
+    uint8_t i=0;
+    for (;i<synth->voicec;i++) synth_mix_voice(mix,spanc,synth,synth->heap[i]);
+    synth_drop_finished_voices(synth);
+    synth_mixer->emit(dst,mix,spanc,chanc);
+    dst+=spanc*chanc;
+    framec-=spanc;
+    #if SYNTH_CMDQ_SIZE
+      synth->framec+=spanc;
+    #endif
+  }
+  #if SYNTH_CMDQ_SIZE
+    synth_publish_snapshot(synth);
+  #endif
+}
+
+/* One frame of one voice, the same arithmetic as synth_mix_voice() with the C kernels.
+ */
+ 
+static int32_t synth_update_voice(struct synth *synth,uint8_t voiceid) {
+  struct synth_voices *voices=&synth->voices;
+  uint32_t ttl=voices->ttl[voiceid];
+  if (!ttl) return 0;
+  if ((ttl<=voices->rel[voiceid])&&(voices->stage[voiceid]!=SYNTH_STAGE_RELEASE)) {
+    voices->stage[voiceid]=SYNTH_STAGE_RELEASE;
+    voices->step[voiceid]=-(int32_t)(voices->level[voiceid]/ttl);
+  }
+  uint32_t level=voices->level[voiceid];
+  int32_t sample=voices->v[voiceid][voices->p[voiceid]>>SYNTH_P_SHIFT];
+  sample*=(int32_t)(level>>SYNTH_LEVEL_SHIFT);
+  voices->level[voiceid]=level+(uint32_t)voices->step[voiceid];
+  voices->p[voiceid]+=voices->pd[voiceid];
+  voices->ttl[voiceid]=ttl-1;
+  switch (voices->stage[voiceid]) {
+    case SYNTH_STAGE_ATTACK: if (!--(voices->stagec[voiceid])) synth_voice_enter_stage(synth,voiceid,SYNTH_STAGE_DECAY); break;
+    case SYNTH_STAGE_DECAY: if (!--(voices->stagec[voiceid])) synth_voice_enter_stage(synth,voiceid,SYNTH_STAGE_SUSTAIN); break;
   }
-  return best;
+  return sample;
+}
+
+/* Update.
+ * Tiny calls this from its audio interrupt, once per sample, so it skips the mix buffer and kernel calls.
+ * Output must match synth_render(); synthbench checks.
+ */
+ 
+int16_t synth_update(struct synth *synth) {
+  #if SYNTH_CMDQ_SIZE
+    synth_apply_cmds(synth,1);
+  #endif
+  synth_advance_song(synth,1);
+  int32_t sum=0;
+  uint8_t i=0;
+  for (;i<synth->voicec;i++) sum+=synth_update_voice(synth,synth->heap[i]);
+  synth_drop_finished_voices(synth);
+  #if SYNTH_CMDQ_SIZE
+    synth->framec++;
+    synth_publish_snapshot(synth);
+  #endif
+  sum>>=10;
+  if (sum>32767) return 32767;
+  if (sum<-32768) return -32768;
+  return sum;
 }
 
 /* Play notes, user supplies the wave.
  */
  
-struct synth_voice *synth_begin_note(struct synth *synth,const int16_t *wave,uint8_t noteid) {
-  if (!wave) return 0;
-  struct synth_voice *voice=synth_get_available_voice(synth);
-  voice->v=wave;
-  voice->p=0;
-  voice->pd=noterates[noteid&0x7f];
-  voice->ttl=UINT32_MAX;
-  voice->waveid=voice->noteid=0xff;
-  return voice;
-}
-
-struct synth_voice *synth_fireforget_note(struct synth *synth,const int16_t *wave,uint8_t noteid,uint32_t durframes) {
-  if (!wave) return 0;
-  struct synth_voice *voice=synth_get_available_voice(synth);
-  voice->v=wave;
-  voice->p=0;
-  voice->pd=noterates[noteid&0x7f];
-  voice->ttl=durframes;
-  voice->waveid=voice->noteid=0xff;
-  return voice;
+/* Level (n) holds harmonics up to 256>>n, which stay below Nyquist while (pd) is no more than 1<<(SYNTH_P_SHIFT+n).
+ */
+ 
+static const int16_t *synth_wave_level(const int16_t *wave,uint8_t levelc,uint32_t pd) {
+  uint8_t level=0;
+  while ((level<levelc-1)&&(pd>(1u<<(SYNTH_P_SHIFT+level)))) level++;
+  return wave+(level<<9);
+}
+
+static int8_t synth_start_voice(struct synth *synth,const int16_t *wave,uint8_t levelc,const struct synth_envelope *env,uint8_t noteid,uint32_t durframes) {
+  if (!wave) return -1;
+  if (!durframes) return -1;
+  uint8_t voiceid=synth_get_available_voice(synth);
+  struct synth_voices *voices=&synth->voices;
+  voices->pd[voiceid]=synth->noterates[noteid&0x7f];
+  voices->v[voiceid]=synth_wave_level(wave,levelc,voices->pd[voiceid]);
+  voices->p[voiceid]=0;
+  voices->ttl[voiceid]=durframes;
+  voices->env[voiceid]=env;
+  voices->rel[voiceid]=synth_envelope_frames(synth,env->release);
+  if (durframes<=voices->rel[voiceid]) {
+    // Starts inside its release. Ramp down from (ttl/rel) of full, as the release always did before envelopes.
+    voices->stage[voiceid]=SYNTH_STAGE_RELEASE;
+    voices->stagec[voiceid]=0;
+    voices->level[voiceid]=((uint64_t)durframes*SYNTH_LEVEL_FULL)/voices->rel[voiceid];
+    voices->step[voiceid]=-(int32_t)(voices->level[voiceid]/durframes);
+  } else {
+    synth_voice_enter_stage(synth,voiceid,SYNTH_STAGE_ATTACK);
+  }
+  voices->waveid[voiceid]=voices->noteid[voiceid]=0xff;
+  voices->heapp[voiceid]=synth->voicec;
+  synth->heap[synth->voicec++]=voiceid;
+  synth_heap_up(synth,synth->voicec-1);
+  if (synth->voicec>synth->voicepeak) synth->voicepeak=synth->voicec;
+  return voiceid;
+}
+
+int8_t synth_begin_note(struct synth *synth,const int16_t *wave,uint8_t noteid) {
+  return synth_start_voice(synth,wave,1,&synth_envelope_default,noteid,UINT32_MAX);
+}
+
+int8_t synth_fireforget_note(struct synth *synth,const int16_t *wave,uint8_t noteid,uint32_t durframes) {
+  return synth_start_voice(synth,wave,1,&synth_envelope_default,noteid,durframes);
 }
  
-void synth_end_note(struct synth *synth,struct synth_voice *voice) {
-  if (voice<synth->voicev) return;
-  if (voice>=synth->voicev+SYNTH_VOICE_LIMIT) return;
-  if (voice->ttl>synth->release_time) {
-    voice->ttl=synth->release_time;
+void synth_end_note(struct synth *synth,int8_t voiceid) {
+  if ((voiceid<0)||(voiceid>=SYNTH_VOICE_LIMIT)) return;
+  struct synth_voices *voices=&synth->voices;
+  if (voices->heapp[voiceid]>=synth->voicec) return;
+  if (voices->ttl[voiceid]>voices->rel[voiceid]) {
+    voices->ttl[voiceid]=voices->rel[voiceid];
+    synth_heap_up(synth,voices->heapp[voiceid]);
   }
-  voice->waveid=voice->noteid=0xff;
+  synth_unindex_voice(synth,voiceid);
 }
 
 /* Play notes, close to encoded format.
@@ -221,43 +625,167 @@ void synth_end_note(struct synth *synth,struct synth_voice *voice) {
  
 void synth_note_fireforget(struct synth *synth,uint8_t waveid,uint8_t noteid,uint8_t durticks) {
   if (waveid>=SYNTH_WAVE_COUNT) return;
-  struct synth_voice *voice=synth_fireforget_note(synth,synth->wavev[waveid],noteid,durticks*synth->frames_per_tick);
+  synth_start_voice(synth,synth->wavev[waveid],SYNTH_WAVE_LEVELS,synth->envelopev+waveid,noteid,durticks*synth->frames_per_tick);
 }
 
 void synth_note_on(struct synth *synth,uint8_t waveid,uint8_t noteid) {
   if (waveid>=SYNTH_WAVE_COUNT) return;
-  struct synth_voice *voice=synth_begin_note(synth,synth->wavev[waveid],noteid);
-  if (!voice) return;
-  voice->waveid=waveid;
-  voice->noteid=noteid;
+  int8_t voiceid=synth_start_voice(synth,synth->wavev[waveid],SYNTH_WAVE_LEVELS,synth->envelopev+waveid,noteid,UINT32_MAX);
+  if (voiceid<0) return;
+  noteid&=0x7f;
+  synth->voices.waveid[voiceid]=waveid;
+  synth->voices.noteid[voiceid]=noteid;
+  #if SYNTH_NOTE_INDEX
+    synth->voices.keynext[voiceid]=synth->noteindex[waveid][noteid];
+    synth->noteindex[waveid][noteid]=voiceid+1;
+  #endif
 }
 
 void synth_note_off(struct synth *synth,uint8_t waveid,uint8_t noteid) {
-  struct synth_voice *voice=synth->voicev;
-  uint8_t i=synth->voicec;
-  for (;i-->0;voice++) {
-    if (voice->waveid!=waveid) continue;
-    if (voice->noteid!=noteid) continue;
-    synth_end_note(synth,voice);
-    return;
-  }
-  //fprintf(stderr,"***** WARNING %s %d,%d, voice not found\n",__func__,waveid,noteid);
+  #if SYNTH_NOTE_INDEX
+    if ((waveid>=SYNTH_WAVE_COUNT)||(noteid>=0x80)) return;
+    uint8_t voicep1=synth->noteindex[waveid][noteid];
+    if (voicep1) synth_end_note(synth,voicep1-1);
+  #else
+    const struct synth_voices *voices=&synth->voices;
+    uint8_t i=0;
+    for (;i<synth->voicec;i++) {
+      uint8_t voiceid=synth->heap[i];
+      if (voices->waveid[voiceid]!=waveid) continue;
+      if (voices->noteid[voiceid]!=noteid) continue;
+      synth_end_note(synth,voiceid);
+      return;
+    }
+  #endif
 }
 
 /* Two flavors of "shut up".
  */
  
 void synth_release_all(struct synth *synth) {
-  struct synth_voice *voice=synth->voicev;
+  // Don't use synth_end_note() here; it would reorder the heap as we walk it.
+  uint32_t *ttl=synth->voices.ttl;
   uint8_t i=synth->voicec;
-  for (;i-->0;voice++) {
-    if (voice->ttl>synth->release_time) {
-      voice->ttl=synth->release_time;
-    }
-    voice->waveid=voice->noteid=0xff;
+  while (i-->0) {
+    uint8_t voiceid=synth->heap[i];
+    if (ttl[voiceid]>synth->voices.rel[voiceid]) ttl[voiceid]=synth->voices.rel[voiceid];
+    synth_unindex_voice(synth,voiceid);
   }
+  for (i=synth->voicec>>1;i-->0;) synth_heap_down(synth,i);
 }
 
 void synth_silence_all(struct synth *synth) {
+  struct synth_voices *voices=&synth->voices;
   synth->voicec=0;
+  synth->freec=0;
+  uint8_t i=SYNTH_VOICE_LIMIT;
+  while (i-->0) {
+    voices->ttl[i]=0;
+    voices->waveid[i]=voices->noteid[i]=0xff;
+    voices->heapp[i]=0xff;
+    synth->freev[synth->freec++]=i;
+  }
+  #if SYNTH_NOTE_INDEX
+    memset(synth->noteindex,0,sizeof(synth->noteindex));
+  #endif
+}
+
+/* Command queue, game side.
+ * We are the only writer of (cmdtail), and the audio thread the only writer of (cmdhead).
+ */
+
+#if SYNTH_CMDQ_SIZE
+
+static int8_t synth_post(struct synth *synth,const struct synth_cmd *cmd) {
+  uint32_t tail=synth->cmdtail;
+  uint32_t head=__atomic_load_n(&synth->cmdhead,__ATOMIC_ACQUIRE);
+  if (tail-head>=SYNTH_CMDQ_SIZE) {
+    synth->cmddropc++;
+    return -1;
+  }
+  synth->cmdv[tail&(SYNTH_CMDQ_SIZE-1)]=*cmd;
+  __atomic_store_n(&synth->cmdtail,tail+1,__ATOMIC_RELEASE);
+  return 0;
+}
+
+int8_t synth_post_note_on(struct synth *synth,uint8_t waveid,uint8_t noteid,uint64_t frame) {
+  struct synth_cmd cmd={.frame=frame,.op=SYNTH_CMD_NOTE_ON,.waveid=waveid,.noteid=noteid};
+  return synth_post(synth,&cmd);
+}
+
+int8_t synth_post_note_off(struct synth *synth,uint8_t waveid,uint8_t noteid,uint64_t frame) {
+  struct synth_cmd cmd={.frame=frame,.op=SYNTH_CMD_NOTE_OFF,.waveid=waveid,.noteid=noteid};
+  return synth_post(synth,&cmd);
+}
+
+int8_t synth_post_note_fireforget(struct synth *synth,uint8_t waveid,uint8_t noteid,uint8_t durticks,uint64_t frame) {
+  struct synth_cmd cmd={.frame=frame,.op=SYNTH_CMD_FIREFORGET,.waveid=waveid,.noteid=noteid,.durticks=durticks};
+  return synth_post(synth,&cmd);
+}
+
+int8_t synth_post_song(struct synth *synth,const uint8_t *src,uint16_t srcc,uint32_t songhold) {
+  if (src) {
+    // Validate here, so the caller hears about it. The audio thread will compile it again, that's cheap.
+    int eventc=synth_compile_song(0,0,src,srcc,synth->frames_per_tick);
+    if (eventc>SYNTH_EVENT_LIMIT) {
+      fprintf(stderr,"Song too long, %d events, limit %d\n",eventc,SYNTH_EVENT_LIMIT);
+      return -1;
+    }
+    if (eventc<1) return -1;
+  }
+  struct synth_cmd cmd={.op=SYNTH_CMD_SONG,.song=src,.songc=srcc,.songhold=songhold};
+  if (synth_post(synth,&cmd)<0) return -1;
+  synth->songposted++;
+  return 0;
+}
+
+void synth_get_snapshot(struct synth_snapshot *dst,const struct synth *synth) {
+  const struct synth_snapshot *src=&synth->snapshot;
+  uint32_t seq;
+  do {
+    seq=__atomic_load_n(&synth->snapshotseq,__ATOMIC_ACQUIRE);
+    dst->framec=__atomic_load_n(&src->framec,__ATOMIC_RELAXED);
+    dst->songtime=__atomic_load_n(&src->songtime,__ATOMIC_RELAXED);
+    dst->songhold=__atomic_load_n(&src->songhold,__ATOMIC_RELAXED);
+    dst->songserial=__atomic_load_n(&src->songserial,__ATOMIC_RELAXED);
+    dst->playing=__atomic_load_n(&src->playing,__ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+  } while ((seq&1)||(seq!=__atomic_load_n(&synth->snapshotseq,__ATOMIC_RELAXED)));
+  if (dst->songserial!=synth->songposted) dst->playing=1;
+}
+
+#else
+
+/* Tiny: No other thread, just do it.
+ */
+
+int8_t synth_post_note_on(struct synth *synth,uint8_t waveid,uint8_t noteid,uint64_t frame) {
+  synth_note_on(synth,waveid,noteid);
+  return 0;
 }
+
+int8_t synth_post_note_off(struct synth *synth,uint8_t waveid,uint8_t noteid,uint64_t frame) {
+  synth_note_off(synth,waveid,noteid);
+  return 0;
+}
+
+int8_t synth_post_note_fireforget(struct synth *synth,uint8_t waveid,uint8_t noteid,uint8_t durticks,uint64_t frame) {
+  synth_note_fireforget(synth,waveid,noteid,durticks);
+  return 0;
+}
+
+int8_t synth_post_song(struct synth *synth,const uint8_t *src,uint16_t srcc,uint32_t songhold) {
+  if (synth_play_song(synth,src,srcc)<0) return -1;
+  synth->songhold=songhold;
+  return 0;
+}
+
+void synth_get_snapshot(struct synth_snapshot *dst,const struct synth *synth) {
+  dst->framec=0;
+  dst->songtime=synth->songtime;
+  dst->songhold=synth->songhold;
+  dst->songserial=0;
+  dst->playing=synth->song?1:0;
+}
+
+#endif
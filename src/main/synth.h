@@ -6,49 +6,241 @@
 
 #include <stdint.h>
 
-#define SYNTH_VOICE_LIMIT 8
+/* Polyphony is fixed at compile time. Up to 64, beyond that the mix could overflow.
+ * Native builds can afford plenty; override with -DSYNTH_VOICE_LIMIT=64 if you like.
+ */
+#ifndef SYNTH_VOICE_LIMIT
+  #if PO_NATIVE
+    #define SYNTH_VOICE_LIMIT 32
+  #else
+    #define SYNTH_VOICE_LIMIT 8
+  #endif
+#endif
+#if SYNTH_VOICE_LIMIT>64
+  #error "SYNTH_VOICE_LIMIT must not exceed 64"
+#endif
+
+/* Native builds keep an index of held notes by (waveid,noteid), so note-off doesn't have to search.
+ * It costs 1 kB, which Tiny can't spare, and Tiny's 8 voices are cheap to search anyway.
+ */
+#if PO_NATIVE
+  #define SYNTH_NOTE_INDEX 1
+#endif
 #define SYNTH_WAVE_COUNT 8
+
+/* Waves in (wavev) are SYNTH_WAVE_LEVELS tables of 512 samples, as generated by mkwave.
+ * Level 0 is the wave as designed, and each level after has half the harmonics of the one before.
+ * Voices pick the highest level whose top harmonic clears Nyquist, when the note starts.
+ * Tiny keeps only level 0; flash is precious there.
+ */
+#define SYNTH_WAVE_LEVELS_NATIVE 9
+#if PO_NATIVE
+  #define SYNTH_WAVE_LEVELS SYNTH_WAVE_LEVELS_NATIVE
+#else
+  #define SYNTH_WAVE_LEVELS 1
+#endif
 #define SYNTH_TICKS_PER_SECOND 96 /* approximately */
 
 #define SYNTH_P_SHIFT (32-9)
 
+/* synth_render() mixes through a stack buffer of this many frames.
+ * Tiny calls us one frame at a time from an interrupt, so keep it small there.
+ */
+#if PO_NATIVE
+  #define SYNTH_MIX_CHUNK 256
+#else
+  #define SYNTH_MIX_CHUNK 16
+#endif
+
+/* Songs are validated and, on native builds, compiled to a timeline of these when they start.
+ * Tiny doesn't have the RAM for a timeline; it reads the encoded song as it plays.
+ */
+#if PO_NATIVE
+  #define SYNTH_EVENT_LIMIT 4096
+#endif
+
+struct synth_event {
+  uint32_t frame; // Value of (songtime) on the frame it fires. The first is 1.
+  uint8_t op;
+  uint8_t waveid;
+  uint8_t noteid;
+  uint8_t durticks;
+};
+
+/* Each wave has an envelope: Linear attack to full, linear decay to sustain, hold, linear release.
+ * Times are in frames at 22050 Hz, and scale with the output rate.
+ * Levels are 0..SYNTH_SUSTAIN_FULL.
+ * The default is no attack or decay, full sustain, and about 90 ms release.
+ */
+#define SYNTH_SUSTAIN_FULL 0x400
+#define SYNTH_RELEASE_TIME_22050 2000
+
+struct synth_envelope {
+  uint16_t attack;
+  uint16_t decay;
+  uint16_t sustain;
+  uint16_t release;
+};
+
+/* Voices carry their gain as a fixed-point level with a per-frame step, so the mixer never divides.
+ * (level>>SYNTH_LEVEL_SHIFT) is the gain applied to each sample, up to SYNTH_SUSTAIN_FULL.
+ */
+#define SYNTH_LEVEL_SHIFT 20
+#define SYNTH_LEVEL_FULL ((uint32_t)SYNTH_SUSTAIN_FULL<<SYNTH_LEVEL_SHIFT)
+
+#define SYNTH_STAGE_ATTACK  0
+#define SYNTH_STAGE_DECAY   1
+#define SYNTH_STAGE_SUSTAIN 2
+#define SYNTH_STAGE_RELEASE 3
+
+/* Native builds take commands from another thread.
+ * The game posts to a wait-free single-producer single-consumer ring, and synth_render() applies each command at its target frame.
+ * After each render, the audio thread publishes a snapshot of the song clock, which the game reads without locking.
+ * Tiny runs synth_update() from an interrupt against the same struct, and its post functions apply immediately.
+ */
+#if PO_NATIVE
+  #define SYNTH_CMDQ_SIZE 256 /* power of two */
+#endif
+
+#define SYNTH_CMD_NOTE_ON    1
+#define SYNTH_CMD_NOTE_OFF   2
+#define SYNTH_CMD_FIREFORGET 3
+#define SYNTH_CMD_SONG       4
+
+struct synth_cmd {
+  uint64_t frame; // Apply when (framec) reaches this. Zero for as soon as possible.
+  const uint8_t *song;
+  uint32_t songhold;
+  uint16_t songc;
+  uint8_t op;
+  uint8_t waveid;
+  uint8_t noteid;
+  uint8_t durticks;
+};
+
+struct synth_snapshot {
+  uint64_t framec; // frames rendered since init
+  uint32_t songtime;
+  uint32_t songhold;
+  uint32_t songserial; // song commands applied
+  uint8_t playing; // song playing, or a song command posted and not yet applied
+};
+
+#define SYNTH_EVENT_DELAY      0 /* only during decode; never in a timeline */
+#define SYNTH_EVENT_FIREFORGET 1
+#define SYNTH_EVENT_NOTE_ON    2
+#define SYNTH_EVENT_NOTE_OFF   3
+#define SYNTH_EVENT_END        4
+
 struct synth {
-  struct synth_voice {
-    const int16_t *v;
-    uint32_t p;
-    uint32_t pd;
-    uint32_t ttl;
-    uint8_t waveid,noteid; // for identification
-  } voicev[SYNTH_VOICE_LIMIT];
-  uint8_t voicec;
+  // Voices are stored structure-of-arrays, so the mixer can stream each field.
+  // A voice is identified by its index into these.
+  struct synth_voices {
+    const int16_t *v[SYNTH_VOICE_LIMIT];
+    uint32_t p[SYNTH_VOICE_LIMIT];
+    uint32_t pd[SYNTH_VOICE_LIMIT];
+    uint32_t ttl[SYNTH_VOICE_LIMIT]; // frames until silent, including release
+    uint32_t level[SYNTH_VOICE_LIMIT]; // see SYNTH_LEVEL_SHIFT
+    int32_t step[SYNTH_VOICE_LIMIT]; // added to (level) each frame
+    uint32_t stagec[SYNTH_VOICE_LIMIT]; // frames remaining in attack or decay
+    uint32_t rel[SYNTH_VOICE_LIMIT]; // release begins when (ttl) reaches this
+    const struct synth_envelope *env[SYNTH_VOICE_LIMIT];
+    uint8_t stage[SYNTH_VOICE_LIMIT];
+    uint8_t waveid[SYNTH_VOICE_LIMIT]; // for identification
+    uint8_t noteid[SYNTH_VOICE_LIMIT];
+    uint8_t heapp[SYNTH_VOICE_LIMIT]; // position in (heap), if active
+    #if SYNTH_NOTE_INDEX
+      uint8_t keynext[SYNTH_VOICE_LIMIT]; // next voice+1 held at the same (waveid,noteid), or zero
+    #endif
+  } voices;
+  
+  // Active voices, a min-heap on ttl: heap[0] is the next to end and the first to steal.
+  // Every active voice counts down at the same rate, so order is stable between note commands.
+  uint8_t heap[SYNTH_VOICE_LIMIT];
+  uint8_t voicec; // length of (heap)
+  uint8_t freev[SYNTH_VOICE_LIMIT]; // inactive voices, a stack
+  uint8_t freec;
+  #if SYNTH_NOTE_INDEX
+    uint8_t noteindex[SYNTH_WAVE_COUNT][128]; // voice+1 most recently started at (waveid,noteid), or zero
+  #endif
+  
+  // Statistics, for your information only. Cleared at init.
+  uint32_t stealc; // voices cut off to make room for a new one
+  uint8_t voicepeak; // highest (voicec)
   
   // Owner should populate directly.
-  const int16_t *wavev[SYNTH_WAVE_COUNT];
+  const int16_t *wavev[SYNTH_WAVE_COUNT]; // SYNTH_WAVE_LEVELS*512 samples each
+  struct synth_envelope envelopev[SYNTH_WAVE_COUNT]; // reset to the default at init
   uint32_t songhold; // extra delay before starting song, frames.
   
-  const uint8_t *song;
+  // Use synth_play_song() to set these.
+  const uint8_t *song; // Nonzero while a song is playing, even if we're reading from the timeline.
   uint16_t songc;
   uint16_t songp;
   uint32_t songdelay;
   uint32_t songtime; // frames since start
+  #if SYNTH_EVENT_LIMIT
+    struct synth_event eventv[SYNTH_EVENT_LIMIT];
+    uint16_t eventc;
+    uint16_t eventp;
+  #endif
   
   int32_t frames_per_tick;
   int32_t rate;
-  int32_t release_time;
+  int32_t release_time; // default release, in frames at our rate
+  const uint32_t *noterates; // [128] phase step by noteid; shared constant for common rates
+  #if PO_NATIVE
+    uint32_t noteratesbuf[128]; // for uncommon rates
+  #endif
+
+  #if SYNTH_CMDQ_SIZE
+    uint64_t framec; // frames rendered since init; audio thread only
+    struct synth_cmd cmdv[SYNTH_CMDQ_SIZE];
+    uint32_t cmdhead; // next to apply; written by the audio thread only
+    uint32_t cmdtail; // next to post; written by the game thread only
+    uint32_t cmddropc; // posts refused because the queue was full; game thread
+    uint32_t songposted; // song commands posted; game thread
+    uint32_t songapplied; // song commands applied; audio thread, published as (snapshot.songserial)
+    uint32_t snapshotseq; // odd while the audio thread is writing (snapshot)
+    struct synth_snapshot snapshot;
+  #endif
 };
 
-/* Beware, if you initialize more than once with different rates,
- * rounding error will accumulate and gradually detune the notes.
+/* Synths are independent of each other; run as many as you like, at any rates.
+ * Tiny only supports 22050 Hz.
  */
 int8_t synth_init(struct synth *synth,int32_t rate);
 
+/* Validate a binary song, and if (dst) not null, compile it into a timeline.
+ * Returns the event count including the terminal SYNTH_EVENT_END, or <0 if malformed.
+ * If (dsta) is too small, we return the required length and fill what we can.
+ */
+int synth_compile_song(struct synth_event *dst,int dsta,const uint8_t *src,int srcc,int32_t frames_per_tick);
+
+/* Begin playing a binary song (just the song part, not the combined file).
+ * Malformed songs are rejected before anything plays.
+ * Null to stop the song (voices are not released).
+ * Set (songhold) after this if you want a lead-in.
+ */
+int8_t synth_play_song(struct synth *synth,const uint8_t *src,uint16_t srcc);
+
+/* Produce (framec) frames of (chanc) interleaved channels, all channels identical.
+ * Song events are processed on the exact frame, same as calling synth_update() (framec) times.
+ * Not before synth_init(); drivers that start early must play silence until then.
+ */
+void synth_render(struct synth *synth,int16_t *dst,int framec,int chanc);
+
+/* Single mono sample. Prefer synth_render() if you can.
+ */
 int16_t synth_update(struct synth *synth);
 
 /* Loose note commands, caller supplies a 512-sample wave.
+ * Loose notes use the default envelope, and their waves have no band-limited levels.
+ * These return a voice index, or <0 if no wave.
  */
-struct synth_voice *synth_begin_note(struct synth *synth,const int16_t *wave,uint8_t noteid);
-void synth_end_note(struct synth *synth,struct synth_voice *voice);
-struct synth_voice *synth_fireforget_note(struct synth *synth,const int16_t *wave,uint8_t noteid,uint32_t durframes);
+int8_t synth_begin_note(struct synth *synth,const int16_t *wave,uint8_t noteid);
+void synth_end_note(struct synth *synth,int8_t voiceid);
+int8_t synth_fireforget_note(struct synth *synth,const int16_t *wave,uint8_t noteid,uint32_t durframes);
 
 /* Note commands matching our serial song format.
  */
@@ -56,7 +248,21 @@ void synth_note_fireforget(struct synth *synth,uint8_t waveid,uint8_t noteid,uin
 void synth_note_on(struct synth *synth,uint8_t waveid,uint8_t noteid);
 void synth_note_off(struct synth *synth,uint8_t waveid,uint8_t noteid);
 
+/* Commands from the game thread, applied by synth_render() at (frame), compared against synth_snapshot.framec.
+ * Commands apply in the order posted; one with a future frame holds back everything after it.
+ * Posting returns <0 if the queue is full or the song is malformed, and nothing will happen.
+ * synth_post_song() replaces the song and sets (songhold) as one step.
+ */
+int8_t synth_post_note_on(struct synth *synth,uint8_t waveid,uint8_t noteid,uint64_t frame);
+int8_t synth_post_note_off(struct synth *synth,uint8_t waveid,uint8_t noteid,uint64_t frame);
+int8_t synth_post_note_fireforget(struct synth *synth,uint8_t waveid,uint8_t noteid,uint8_t durticks,uint64_t frame);
+int8_t synth_post_song(struct synth *synth,const uint8_t *src,uint16_t srcc,uint32_t songhold);
+
+/* Copy the song clock as of the end of the last render. Call from the game thread; never blocks the audio thread.
+ */
+void synth_get_snapshot(struct synth_snapshot *dst,const struct synth *synth);
+
 void synth_release_all(struct synth *synth);
-void synth_silence_all(struct synth *synth);
+void synth_silence_all(struct synth *synth); // also resets the voice bank
 
 #endif
@@ -0,0 +1,36 @@
+/* synth_internal.h
+ * Mixer kernels, shared between synth.c and synth_mix.c.
+ * Not for general use, but the benchmark tool peeks in here.
+ */
+ 
+#ifndef SYNTH_INTERNAL_H
+#define SYNTH_INTERNAL_H
+
+#include <stdint.h>
+
+/* Every mixer must produce bit-identical output to the portable C one.
+ * sustain: dst[i]+=v[(p+i*pd)>>SYNTH_P_SHIFT]<<10, for i in 0..c-1
+ * envelope: Same but scaled by (level+i*step)>>SYNTH_LEVEL_SHIFT instead of <<10.
+ *   Caller ensures the level stays within 0..SYNTH_LEVEL_FULL for the whole span.
+ * emit: dst=clamp(src>>10), duplicated into (chanc) interleaved channels.
+ */
+struct synth_mixer {
+  const char *name;
+  void (*sustain)(int32_t *dst,int c,const int16_t *v,uint32_t p,uint32_t pd);
+  void (*envelope)(int32_t *dst,int c,const int16_t *v,uint32_t p,uint32_t pd,uint32_t level,int32_t step);
+  void (*emit)(int16_t *dst,const int32_t *src,int c,int chanc);
+};
+
+extern const struct synth_mixer *synth_mixer;
+
+/* Null to select the best one this CPU supports, or name one.
+ * Fails if named mixer not compiled in or not supported by the CPU.
+ * Affects all synth instances.
+ */
+int8_t synth_mixer_select(const char *name);
+
+/* Iterate over compiled-in mixers supported by this CPU, starting at zero. Null at the end.
+ */
+const struct synth_mixer *synth_mixer_get(uint8_t p);
+
+#endif
@@ -0,0 +1,259 @@
+/* synth_mix.c
+ * Inner loops of the synthesizer, in portable C and a few SIMD flavors.
+ * Each kernel runs one voice across a span of frames; the SIMD ones do 8 frames at a time.
+ * Envelope gain is a fixed-point level plus a constant step per frame, so lane i of a vector is just level+i*step.
+ */
+
+#include "synth.h"
+#include "synth_internal.h"
+
+#if PO_NATIVE && (defined(__x86_64__)||defined(__i386__))
+  #define SYNTH_MIX_X86 1
+  #include <immintrin.h>
+#endif
+#if PO_NATIVE && defined(__aarch64__)
+  #define SYNTH_MIX_NEON 1
+  #include <arm_neon.h>
+#endif
+
+const struct synth_mixer *synth_mixer=0;
+
+#define SAMPLE(i) v[(p+(i)*pd)>>SYNTH_P_SHIFT]
+
+/* Portable C.
+ */
+
+static void synth_mix_sustain_c(int32_t *dst,int c,const int16_t *v,uint32_t p,uint32_t pd) {
+  for (;c-->0;dst++,p+=pd) *dst+=v[p>>SYNTH_P_SHIFT]<<10;
+}
+
+static void synth_mix_envelope_c(int32_t *dst,int c,const int16_t *v,uint32_t p,uint32_t pd,uint32_t level,int32_t step) {
+  for (;c-->0;dst++,p+=pd,level+=step) {
+    int32_t sample=v[p>>SYNTH_P_SHIFT];
+    sample*=(int32_t)(level>>SYNTH_LEVEL_SHIFT);
+    *dst+=sample;
+  }
+}
+
+static void synth_emit_c(int16_t *dst,const int32_t *src,int c,int chanc) {
+  switch (chanc) {
+    case 1: {
+        for (;c-->0;dst++,src++) {
+          int32_t sample=(*src)>>10;
+          if (sample>32767) *dst=32767;
+          else if (sample<-32768) *dst=-32768;
+          else *dst=sample;
+        }
+      } break;
+    case 2: {
+        for (;c-->0;dst+=2,src++) {
+          int32_t sample=(*src)>>10;
+          if (sample>32767) sample=32767;
+          else if (sample<-32768) sample=-32768;
+          dst[0]=dst[1]=sample;
+        }
+      } break;
+    default: {
+        for (;c-->0;src++) {
+          int32_t sample=(*src)>>10;
+          if (sample>32767) sample=32767;
+          else if (sample<-32768) sample=-32768;
+          int i=chanc;
+          for (;i-->0;dst++) *dst=sample;
+        }
+      }
+  }
+}
+
+/* SSE2.
+ */
+
+#if SYNTH_MIX_X86
+
+__attribute__((target("sse2")))
+static void synth_mix_sustain_sse2(int32_t *dst,int c,const int16_t *v,uint32_t p,uint32_t pd) {
+  const __m128i zero=_mm_setzero_si128();
+  for (;c>=8;c-=8,dst+=8,p+=pd*8) {
+    __m128i s=_mm_setr_epi16(SAMPLE(0),SAMPLE(1),SAMPLE(2),SAMPLE(3),SAMPLE(4),SAMPLE(5),SAMPLE(6),SAMPLE(7));
+    // Unpacking against zero puts each sample in the high half; arithmetic shift brings it back down to <<10.
+    __m128i lo=_mm_srai_epi32(_mm_unpacklo_epi16(zero,s),6);
+    __m128i hi=_mm_srai_epi32(_mm_unpackhi_epi16(zero,s),6);
+    _mm_storeu_si128((__m128i*)dst,_mm_add_epi32(_mm_loadu_si128((__m128i*)dst),lo));
+    _mm_storeu_si128((__m128i*)(dst+4),_mm_add_epi32(_mm_loadu_si128((__m128i*)(dst+4)),hi));
+  }
+  synth_mix_sustain_c(dst,c,v,p,pd);
+}
+
+__attribute__((target("sse2")))
+static void synth_mix_envelope_sse2(int32_t *dst,int c,const int16_t *v,uint32_t p,uint32_t pd,uint32_t level,int32_t step) {
+  const __m128i stepv=_mm_setr_epi32(0,(uint32_t)step,(uint32_t)step*2,(uint32_t)step*3);
+  const __m128i step4=_mm_set1_epi32((uint32_t)step*4);
+  for (;c>=8;c-=8,dst+=8,p+=pd*8,level+=(uint32_t)step*8) {
+    __m128i s=_mm_setr_epi16(SAMPLE(0),SAMPLE(1),SAMPLE(2),SAMPLE(3),SAMPLE(4),SAMPLE(5),SAMPLE(6),SAMPLE(7));
+    __m128i l0=_mm_add_epi32(_mm_set1_epi32(level),stepv);
+    __m128i l1=_mm_add_epi32(l0,step4);
+    __m128i g=_mm_packs_epi32(_mm_srli_epi32(l0,SYNTH_LEVEL_SHIFT),_mm_srli_epi32(l1,SYNTH_LEVEL_SHIFT));
+    // Gains fit in 16 bits, so a 16x16 multiply with both halves recombined gives the exact 32-bit product.
+    __m128i plo=_mm_mullo_epi16(s,g);
+    __m128i phi=_mm_mulhi_epi16(s,g);
+    __m128i lo=_mm_unpacklo_epi16(plo,phi);
+    __m128i hi=_mm_unpackhi_epi16(plo,phi);
+    _mm_storeu_si128((__m128i*)dst,_mm_add_epi32(_mm_loadu_si128((__m128i*)dst),lo));
+    _mm_storeu_si128((__m128i*)(dst+4),_mm_add_epi32(_mm_loadu_si128((__m128i*)(dst+4)),hi));
+  }
+  synth_mix_envelope_c(dst,c,v,p,pd,level,step);
+}
+
+__attribute__((target("sse2")))
+static void synth_emit_sse2(int16_t *dst,const int32_t *src,int c,int chanc) {
+  switch (chanc) {
+    case 1: {
+        for (;c>=8;c-=8,dst+=8,src+=8) {
+          __m128i a=_mm_srai_epi32(_mm_loadu_si128((__m128i*)src),10);
+          __m128i b=_mm_srai_epi32(_mm_loadu_si128((__m128i*)(src+4)),10);
+          _mm_storeu_si128((__m128i*)dst,_mm_packs_epi32(a,b));
+        }
+      } break;
+    case 2: {
+        for (;c>=8;c-=8,dst+=16,src+=8) {
+          __m128i a=_mm_srai_epi32(_mm_loadu_si128((__m128i*)src),10);
+          __m128i b=_mm_srai_epi32(_mm_loadu_si128((__m128i*)(src+4)),10);
+          __m128i s=_mm_packs_epi32(a,b);
+          _mm_storeu_si128((__m128i*)dst,_mm_unpacklo_epi16(s,s));
+          _mm_storeu_si128((__m128i*)(dst+8),_mm_unpackhi_epi16(s,s));
+        }
+      } break;
+  }
+  synth_emit_c(dst,src,c,chanc);
+}
+
+/* AVX2.
+ */
+
+__attribute__((target("avx2")))
+static void synth_mix_sustain_avx2(int32_t *dst,int c,const int16_t *v,uint32_t p,uint32_t pd) {
+  for (;c>=8;c-=8,dst+=8,p+=pd*8) {
+    __m256i s=_mm256_setr_epi32(SAMPLE(0),SAMPLE(1),SAMPLE(2),SAMPLE(3),SAMPLE(4),SAMPLE(5),SAMPLE(6),SAMPLE(7));
+    s=_mm256_slli_epi32(s,10);
+    _mm256_storeu_si256((__m256i*)dst,_mm256_add_epi32(_mm256_loadu_si256((__m256i*)dst),s));
+  }
+  synth_mix_sustain_c(dst,c,v,p,pd);
+}
+
+__attribute__((target("avx2")))
+static void synth_mix_envelope_avx2(int32_t *dst,int c,const int16_t *v,uint32_t p,uint32_t pd,uint32_t level,int32_t step) {
+  const uint32_t u=step;
+  const __m256i stepv=_mm256_setr_epi32(0,u,u*2,u*3,u*4,u*5,u*6,u*7);
+  for (;c>=8;c-=8,dst+=8,p+=pd*8,level+=u*8) {
+    __m256i s=_mm256_setr_epi32(SAMPLE(0),SAMPLE(1),SAMPLE(2),SAMPLE(3),SAMPLE(4),SAMPLE(5),SAMPLE(6),SAMPLE(7));
+    __m256i g=_mm256_srli_epi32(_mm256_add_epi32(_mm256_set1_epi32(level),stepv),SYNTH_LEVEL_SHIFT);
+    s=_mm256_mullo_epi32(s,g);
+    _mm256_storeu_si256((__m256i*)dst,_mm256_add_epi32(_mm256_loadu_si256((__m256i*)dst),s));
+  }
+  synth_mix_envelope_c(dst,c,v,p,pd,level,step);
+}
+
+#endif
+
+/* NEON, aarch64 only.
+ */
+
+#if SYNTH_MIX_NEON
+
+static void synth_mix_sustain_neon(int32_t *dst,int c,const int16_t *v,uint32_t p,uint32_t pd) {
+  for (;c>=8;c-=8,dst+=8,p+=pd*8) {
+    int16_t tmp[8]={SAMPLE(0),SAMPLE(1),SAMPLE(2),SAMPLE(3),SAMPLE(4),SAMPLE(5),SAMPLE(6),SAMPLE(7)};
+    int16x8_t s=vld1q_s16(tmp);
+    vst1q_s32(dst,vaddq_s32(vld1q_s32(dst),vshll_n_s16(vget_low_s16(s),10)));
+    vst1q_s32(dst+4,vaddq_s32(vld1q_s32(dst+4),vshll_n_s16(vget_high_s16(s),10)));
+  }
+  synth_mix_sustain_c(dst,c,v,p,pd);
+}
+
+static void synth_mix_envelope_neon(int32_t *dst,int c,const int16_t *v,uint32_t p,uint32_t pd,uint32_t level,int32_t step) {
+  const uint32_t u=step;
+  const uint32_t stepa[4]={0,u,u*2,u*3};
+  const uint32x4_t stepv=vld1q_u32(stepa);
+  const uint32x4_t step4=vdupq_n_u32(u*4);
+  for (;c>=8;c-=8,dst+=8,p+=pd*8,level+=u*8) {
+    int16_t tmp[8]={SAMPLE(0),SAMPLE(1),SAMPLE(2),SAMPLE(3),SAMPLE(4),SAMPLE(5),SAMPLE(6),SAMPLE(7)};
+    int16x8_t s=vld1q_s16(tmp);
+    uint32x4_t l0=vaddq_u32(vdupq_n_u32(level),stepv);
+    uint32x4_t l1=vaddq_u32(l0,step4);
+    int32x4_t lo=vmulq_s32(vmovl_s16(vget_low_s16(s)),vreinterpretq_s32_u32(vshrq_n_u32(l0,SYNTH_LEVEL_SHIFT)));
+    int32x4_t hi=vmulq_s32(vmovl_s16(vget_high_s16(s)),vreinterpretq_s32_u32(vshrq_n_u32(l1,SYNTH_LEVEL_SHIFT)));
+    vst1q_s32(dst,vaddq_s32(vld1q_s32(dst),lo));
+    vst1q_s32(dst+4,vaddq_s32(vld1q_s32(dst+4),hi));
+  }
+  synth_mix_envelope_c(dst,c,v,p,pd,level,step);
+}
+
+static void synth_emit_neon(int16_t *dst,const int32_t *src,int c,int chanc) {
+  switch (chanc) {
+    case 1: {
+        for (;c>=8;c-=8,dst+=8,src+=8) {
+          int16x4_t a=vqmovn_s32(vshrq_n_s32(vld1q_s32(src),10));
+          int16x4_t b=vqmovn_s32(vshrq_n_s32(vld1q_s32(src+4),10));
+          vst1q_s16(dst,vcombine_s16(a,b));
+        }
+      } break;
+    case 2: {
+        for (;c>=8;c-=8,dst+=16,src+=8) {
+          int16x4_t a=vqmovn_s32(vshrq_n_s32(vld1q_s32(src),10));
+          int16x4_t b=vqmovn_s32(vshrq_n_s32(vld1q_s32(src+4),10));
+          int16x8x2_t s;
+          s.val[0]=s.val[1]=vcombine_s16(a,b);
+          vst2q_s16(dst,s);
+        }
+      } break;
+  }
+  synth_emit_c(dst,src,c,chanc);
+}
+
+#endif
+
+/* Registry, in order of preference.
+ */
+
+static const struct synth_mixer synth_mixerv[]={
+#if SYNTH_MIX_X86
+  {"avx2",synth_mix_sustain_avx2,synth_mix_envelope_avx2,synth_emit_sse2},
+  {"sse2",synth_mix_sustain_sse2,synth_mix_envelope_sse2,synth_emit_sse2},
+#endif
+#if SYNTH_MIX_NEON
+  {"neon",synth_mix_sustain_neon,synth_mix_envelope_neon,synth_emit_neon},
+#endif
+  {"c",synth_mix_sustain_c,synth_mix_envelope_c,synth_emit_c},
+};
+
+static int8_t synth_mixer_supported(const struct synth_mixer *mixer) {
+  #if SYNTH_MIX_X86
+    if (mixer->sustain==synth_mix_sustain_avx2) return __builtin_cpu_supports("avx2")?1:0;
+    if (mixer->sustain==synth_mix_sustain_sse2) return __builtin_cpu_supports("sse2")?1:0;
+  #endif
+  return 1;
+}
+
+const struct synth_mixer *synth_mixer_get(uint8_t p) {
+  const struct synth_mixer *mixer=synth_mixerv;
+  uint8_t i=sizeof(synth_mixerv)/sizeof(struct synth_mixer);
+  for (;i-->0;mixer++) {
+    if (!synth_mixer_supported(mixer)) continue;
+    if (!p--) return mixer;
+  }
+  return 0;
+}
+
+int8_t synth_mixer_select(const char *name) {
+  const struct synth_mixer *mixer;
+  uint8_t p=0;
+  for (;mixer=synth_mixer_get(p);p++) {
+    if (!name) break;
+    const char *a=name,*b=mixer->name;
+    while (*a&&(*a==*b)) { a++; b++; }
+    if (!*a&&!*b) break;
+  }
+  if (!mixer) return -1;
+  synth_mixer=mixer;
+  return 0;
+}
@@ -1,18 +1,34 @@
+#define _GNU_SOURCE /* pthread_setaffinity_np */
 #include "alsa.h"
 #include <string.h>
 #include <stdlib.h>
 #include <limits.h>
 #include <pthread.h>
-#include <sys/time.h>
+#include <time.h>
 #include <sys/poll.h>
 #include <alsa/asoundlib.h>
 
-static int64_t alsa_now() {
-  struct timeval tv={0};
-  gettimeofday(&tv,0);
-  return (int64_t)tv.tv_sec*1000000+tv.tv_usec;
+/* Default 256 frames x 3: 35 ms at 22050 Hz, 16 ms at 48000.
+ * The old fixed 2048-frame buffer was 93 ms at 22050.
+ */
+#define ALSA_PERIOD_DEFAULT 256
+#define ALSA_PERIODC_DEFAULT 3
+
+static double alsa_now() {
+  struct timespec tv={0};
+  clock_gettime(CLOCK_MONOTONIC,&tv);
+  return (double)tv.tv_sec+(double)tv.tv_nsec/1000000000.0;
 }
 
+/* Playback clock tuning.
+ * Each time the I/O thread transfers, it measures the device's position and feeds it to a second-order loop:
+ * Phase moves a fraction of the error toward each measurement, and rate absorbs a smaller fraction of the error per second.
+ * An error beyond RESYNC frames means something really happened (xrun, device restart), so we jump to the measurement.
+ */
+#define ALSA_CLOCK_GAIN_PHASE 0.1
+#define ALSA_CLOCK_GAIN_RATE 0.005
+#define ALSA_CLOCK_RATE_TOLERANCE 0.005 /* relative to nominal */
+
 /* Object definition.
  */
 
@@ -24,17 +40,28 @@ struct alsa {
   snd_pcm_hw_params_t *hwparams;
   snd_rawmidi_t *rawmidi;
 
-  int hwbuffersize;
-  int bufc; // frames
+  int hwbuffersize; // frames
+  int mmap;
+  int bufc; // frames, one period
   int bufc_samples;
-  int16_t *buf;
+  int16_t *buf; // only for read/write access; with mmap we render straight into the device's buffer
 
   pthread_t iothd;
   pthread_mutex_t iomtx;
   int ioabort;
   int cberror;
 
-  int64_t update_time;
+  // Playback clock and statistics, guarded by (clockmtx). Positions are frames since the stream opened.
+  pthread_mutex_t clockmtx;
+  struct alsa_stats stats;
+  double cbtime; // start of the last callback
+  int tstamp; // device timestamps are enabled and on our clock
+  int64_t produced; // frames delivered by the callback
+  int running; // clock is extrapolating; otherwise it holds at (pos0)
+  double t0; // monotonic seconds
+  double pos0; // audible frame at (t0)
+  double clockrate; // frames per second, nominal +- a little
+  int64_t audible; // last reported, so we never go backward
 };
 
 /* Delete.
@@ -50,6 +77,7 @@ void alsa_del(struct alsa *alsa) {
     pthread_join(alsa->iothd,0);
   }
   pthread_mutex_destroy(&alsa->iomtx);
+  pthread_mutex_destroy(&alsa->clockmtx);
   if (alsa->hwparams) snd_pcm_hw_params_free(alsa->hwparams);
   if (alsa->alsa) snd_pcm_close(alsa->alsa);
   if (alsa->buf) free(alsa->buf);
@@ -69,43 +97,204 @@ int alsa_ref(struct alsa *alsa) {
   return 0;
 }
 
-/* I/O thread.
+/* Measure the device's position and update the playback clock.
+ * Called by the I/O thread after each transfer, with (producedc) new frames just handed over.
+ * Prefer the device's timestamp of its last pointer update; otherwise snd_pcm_delay() and our own clock.
+ */
+
+static void alsa_clock_measure(struct alsa *alsa,int producedc) {
+  double t=0.0;
+  int64_t queued=-1;
+  if (alsa->tstamp) {
+    snd_pcm_uframes_t avail=0;
+    snd_htimestamp_t ts={0};
+    if ((snd_pcm_htimestamp(alsa->alsa,&avail,&ts)>=0)&&(ts.tv_sec||ts.tv_nsec)&&(avail<=alsa->hwbuffersize)) {
+      t=(double)ts.tv_sec+(double)ts.tv_nsec/1000000000.0;
+      queued=alsa->hwbuffersize-avail;
+    }
+  }
+  if (queued<0) {
+    snd_pcm_sframes_t delay=0;
+    if (snd_pcm_delay(alsa->alsa,&delay)<0) delay=-1;
+    t=alsa_now();
+    queued=delay;
+  }
+  int running=(snd_pcm_state(alsa->alsa)==SND_PCM_STATE_RUNNING);
+
+  if (pthread_mutex_lock(&alsa->clockmtx)) return;
+  alsa->produced+=producedc;
+  if (queued>=0) {
+    double pos=(double)(alsa->produced-queued);
+    double dt=t-alsa->t0;
+    double err=(alsa->running&&running)?pos-(alsa->pos0+dt*alsa->clockrate):0.0;
+    if (!alsa->running||!running||(err>alsa->bufc*2)||(err<-alsa->bufc*2)) {
+      alsa->t0=t;
+      alsa->pos0=pos;
+      alsa->clockrate=alsa->delegate.rate;
+      alsa->running=running;
+    } else if (dt>0.0) { // otherwise the device hasn't moved since our last measurement
+      alsa->t0=t;
+      alsa->pos0+=dt*alsa->clockrate+err*ALSA_CLOCK_GAIN_PHASE;
+      // Over a very short interval, a frame of jitter looks like a huge rate error.
+      // Back-to-back commits on the snd_pcm_delay() path can be microseconds apart, so only trust a period or more.
+      if (dt*alsa->delegate.rate>=alsa->bufc) {
+        alsa->clockrate+=(err*ALSA_CLOCK_GAIN_RATE)/dt;
+        double lo=alsa->delegate.rate*(1.0-ALSA_CLOCK_RATE_TOLERANCE);
+        double hi=alsa->delegate.rate*(1.0+ALSA_CLOCK_RATE_TOLERANCE);
+        if (alsa->clockrate<lo) alsa->clockrate=lo;
+        else if (alsa->clockrate>hi) alsa->clockrate=hi;
+      }
+    }
+  }
+  pthread_mutex_unlock(&alsa->clockmtx);
+}
+
+/* Recover from an I/O error, counting xruns.
+ * <0 if it's not recoverable.
+ */
+
+static int alsa_recover(struct alsa *alsa,int err) {
+  if ((err==-EPIPE)&&!pthread_mutex_lock(&alsa->clockmtx)) {
+    alsa->stats.xrunc++;
+    pthread_mutex_unlock(&alsa->clockmtx);
+  }
+  if ((err=snd_pcm_recover(alsa->alsa,err,0))<0) {
+    fprintf(stderr,"ALSA: Unrecoverable error, audio stopped: %s\n",snd_strerror(err));
+    return -1;
+  }
+  return 0;
+}
+
+/* Call the owner for (samplec) samples, with the lock held, and time it.
+ */
+
+static int alsa_callback(struct alsa *alsa,int16_t *dst,int samplec) {
+  if (pthread_mutex_lock(&alsa->iomtx)) return -1;
+  double start=alsa_now();
+  alsa->delegate.cb_pcm_out(dst,samplec,alsa);
+  double end=alsa_now();
+  pthread_mutex_unlock(&alsa->iomtx);
+  if (pthread_mutex_lock(&alsa->clockmtx)) return -1;
+  struct alsa_stats *stats=&alsa->stats;
+  double duration=end-start;
+  if (!stats->callbackc||(duration<stats->cbmin)) stats->cbmin=duration;
+  if (duration>stats->cbmax) stats->cbmax=duration;
+  stats->cbtotal+=duration;
+  if (stats->callbackc) {
+    double interval=start-alsa->cbtime;
+    if ((stats->callbackc==1)||(interval<stats->intervalmin)) stats->intervalmin=interval;
+    if (interval>stats->intervalmax) stats->intervalmax=interval;
+    stats->intervaltotal+=interval;
+  }
+  stats->callbackc++;
+  alsa->cbtime=start;
+  pthread_mutex_unlock(&alsa->clockmtx);
+  return 0;
+}
+
+/* I/O thread, read/write access.
+ * Render a period into our buffer, then block writing it.
  */
 
+static int alsa_io_rw(struct alsa *alsa) {
+  if (alsa_callback(alsa,alsa->buf,alsa->bufc_samples)<0) return -1;
+  if (alsa->ioabort) return 0;
+
+  int framep=0;
+  while (framep<alsa->bufc) {
+    pthread_testcancel();
+    int err=snd_pcm_writei(alsa->alsa,alsa->buf+framep*alsa->delegate.chanc,alsa->bufc-framep);
+    if (alsa->ioabort) return 0;
+    if (err<=0) {
+      if (alsa_recover(alsa,err)<0) return -1;
+      break;
+    }
+    framep+=err;
+  }
+  alsa_clock_measure(alsa,alsa->bufc);
+  return 0;
+}
+
+/* I/O thread, mmap access.
+ * Wait until at least a period is free, then render directly into the ring buffer.
+ * The device starts on its own once the buffer fills (start_threshold).
+ */
+
+static int alsa_io_mmap(struct alsa *alsa) {
+  snd_pcm_sframes_t avail=snd_pcm_avail_update(alsa->alsa);
+  if (avail<0) {
+    if (alsa_recover(alsa,avail)<0) return -1;
+    return 0;
+  }
+  if (avail<alsa->bufc) {
+    int err=snd_pcm_wait(alsa->alsa,1000);
+    if (err<0) {
+      if (alsa_recover(alsa,err)<0) return -1;
+    }
+    return 0;
+  }
+  while (avail>0) {
+    const snd_pcm_channel_area_t *areas=0;
+    snd_pcm_uframes_t offset=0,framec=avail;
+    int err=snd_pcm_mmap_begin(alsa->alsa,&areas,&offset,&framec);
+    if (err<0) {
+      if (alsa_recover(alsa,err)<0) return -1;
+      return 0;
+    }
+    if (!framec) break;
+    // Interleaved S16: a single area, (step) is the frame size in bits.
+    int16_t *dst=(int16_t*)((uint8_t*)areas[0].addr+(areas[0].first>>3)+offset*(areas[0].step>>3));
+    if (alsa_callback(alsa,dst,framec*alsa->delegate.chanc)<0) return -1;
+    if (alsa->ioabort) return 0;
+    snd_pcm_sframes_t committed=snd_pcm_mmap_commit(alsa->alsa,offset,framec);
+    if ((committed<0)||((snd_pcm_uframes_t)committed!=framec)) {
+      if (alsa_recover(alsa,(committed<0)?committed:-EPIPE)<0) return -1;
+      return 0;
+    }
+    avail-=framec;
+    alsa_clock_measure(alsa,framec);
+  }
+  return 0;
+}
+
 static void *_alsa_iothd(void *dummy) {
   struct alsa *alsa=dummy;
   pthread_setcancelstate(PTHREAD_CANCEL_DISABLE,0);
   while (1) {
     pthread_testcancel();
-
-    if (pthread_mutex_lock(&alsa->iomtx)) {
+    int err=alsa->mmap?alsa_io_mmap(alsa):alsa_io_rw(alsa);
+    if (err<0) {
       alsa->cberror=1;
       return 0;
     }
-    alsa->delegate.cb_pcm_out(alsa->buf,alsa->bufc_samples,alsa);
-    pthread_mutex_unlock(&alsa->iomtx);
     if (alsa->ioabort) return 0;
-    alsa->update_time=alsa_now();
-
-    int16_t *samplev=alsa->buf;
-    int samplep=0,samplec=alsa->bufc;
-    while (samplep<samplec) {
-      pthread_testcancel();
-      int err=snd_pcm_writei(alsa->alsa,samplev+samplep,samplec-samplep);
-      if (alsa->ioabort) return 0;
-      if (err<=0) {
-        if ((err=snd_pcm_recover(alsa->alsa,err,0))<0) {
-          alsa->cberror=1;
-          return 0;
-        }
-        break;
-      }
-      samplep+=err*alsa->delegate.chanc;
-    }
   }
   return 0;
 }
 
+/* Scheduling for the I/O thread, if requested. Failures are warnings only.
+ * SCHED_FIFO needs CAP_SYS_NICE or an rtprio limit (/etc/security/limits.conf).
+ */
+
+static void alsa_init_thread(struct alsa *alsa) {
+  if (alsa->delegate.rtprio>0) {
+    struct sched_param param={.sched_priority=alsa->delegate.rtprio};
+    int err=pthread_setschedparam(alsa->iothd,SCHED_FIFO,&param);
+    if (err) {
+      fprintf(stderr,"ALSA: Failed to set SCHED_FIFO priority %d: %s. Proceeding at normal priority.\n",alsa->delegate.rtprio,strerror(err));
+    }
+  }
+  if (alsa->delegate.cpu>0) {
+    cpu_set_t cpuset;
+    CPU_ZERO(&cpuset);
+    CPU_SET(alsa->delegate.cpu-1,&cpuset);
+    int err=pthread_setaffinity_np(alsa->iothd,sizeof(cpuset),&cpuset);
+    if (err) {
+      fprintf(stderr,"ALSA: Failed to pin I/O thread to CPU %d: %s\n",alsa->delegate.cpu-1,strerror(err));
+    }
+  }
+}
+
 /* Init MIDI-in.
  */
  
@@ -117,39 +306,83 @@ static int alsa_midi_init(struct alsa *alsa) {
 /* Init.
  */
  
+static int alsa_init_hw(struct alsa *alsa,snd_pcm_access_t access) {
+  snd_pcm_uframes_t period=alsa->delegate.period;
+  snd_pcm_uframes_t buffer_size=period*alsa->delegate.periodc;
+  if (
+    (snd_pcm_hw_params_any(alsa->alsa,alsa->hwparams)<0)||
+    (snd_pcm_hw_params_set_access(alsa->alsa,alsa->hwparams,access)<0)||
+    (snd_pcm_hw_params_set_format(alsa->alsa,alsa->hwparams,SND_PCM_FORMAT_S16)<0)||
+    (snd_pcm_hw_params_set_rate_near(alsa->alsa,alsa->hwparams,&alsa->delegate.rate,0)<0)||
+    (snd_pcm_hw_params_set_channels_near(alsa->alsa,alsa->hwparams,&alsa->delegate.chanc)<0)||
+    (snd_pcm_hw_params_set_period_size_near(alsa->alsa,alsa->hwparams,&period,0)<0)||
+    (snd_pcm_hw_params_set_buffer_size_near(alsa->alsa,alsa->hwparams,&buffer_size)<0)||
+    (snd_pcm_hw_params(alsa->alsa,alsa->hwparams)<0)
+  ) return -1;
+  if (snd_pcm_hw_params_get_period_size(alsa->hwparams,&period,0)<0) return -1;
+  if (snd_pcm_hw_params_get_buffer_size(alsa->hwparams,&buffer_size)<0) return -1;
+  if ((period<1)||(period>INT_MAX)||(buffer_size<period)||(buffer_size>INT_MAX)) return -1;
+  alsa->bufc=period;
+  alsa->hwbuffersize=buffer_size;
+  return 0;
+}
+
+static int alsa_init_sw(struct alsa *alsa) {
+  snd_pcm_sw_params_t *swparams=0;
+  if (snd_pcm_sw_params_malloc(&swparams)<0) return -1;
+  int err=0;
+  if (
+    (snd_pcm_sw_params_current(alsa->alsa,swparams)<0)||
+    (snd_pcm_sw_params_set_avail_min(alsa->alsa,swparams,alsa->bufc)<0)||
+    (snd_pcm_sw_params_set_start_threshold(alsa->alsa,swparams,alsa->hwbuffersize-alsa->bufc)<0)
+  ) err=-1;
+  // Timestamps are optional; without them the clock falls back to snd_pcm_delay().
+  if (!err&&
+    (snd_pcm_sw_params_set_tstamp_mode(alsa->alsa,swparams,SND_PCM_TSTAMP_ENABLE)>=0)&&
+    (snd_pcm_sw_params_set_tstamp_type(alsa->alsa,swparams,SND_PCM_TSTAMP_TYPE_MONOTONIC)>=0)
+  ) alsa->tstamp=1;
+  if (!err&&(snd_pcm_sw_params(alsa->alsa,swparams)<0)) err=-1;
+  snd_pcm_sw_params_free(swparams);
+  return err;
+}
+ 
 static int _alsa_init(struct alsa *alsa) {
   
   if (!alsa->delegate.device||!alsa->delegate.device[0]) {
     alsa->delegate.device="default";
   }
-  
-  int buffer_size=2048;
+  if (alsa->delegate.period<1) alsa->delegate.period=ALSA_PERIOD_DEFAULT;
+  if (alsa->delegate.periodc<2) alsa->delegate.periodc=ALSA_PERIODC_DEFAULT;
 
   if (
     (snd_pcm_open(&alsa->alsa,alsa->delegate.device,SND_PCM_STREAM_PLAYBACK,0)<0)||
-    (snd_pcm_hw_params_malloc(&alsa->hwparams)<0)||
-    (snd_pcm_hw_params_any(alsa->alsa,alsa->hwparams)<0)||
-    (snd_pcm_hw_params_set_access(alsa->alsa,alsa->hwparams,SND_PCM_ACCESS_RW_INTERLEAVED)<0)||
-    (snd_pcm_hw_params_set_format(alsa->alsa,alsa->hwparams,SND_PCM_FORMAT_S16)<0)||
-    (snd_pcm_hw_params_set_rate_near(alsa->alsa,alsa->hwparams,&alsa->delegate.rate,0)<0)||
-    (snd_pcm_hw_params_set_channels_near(alsa->alsa,alsa->hwparams,&alsa->delegate.chanc)<0)||
-    (snd_pcm_hw_params_set_buffer_size(alsa->alsa,alsa->hwparams,buffer_size)<0)||
-    (snd_pcm_hw_params(alsa->alsa,alsa->hwparams)<0)
+    (snd_pcm_hw_params_malloc(&alsa->hwparams)<0)
   ) return -1;
+
+  // Prefer mmap, and fall back to read/write if the device or plugin can't do it.
+  if (!alsa->delegate.no_mmap&&(alsa_init_hw(alsa,SND_PCM_ACCESS_MMAP_INTERLEAVED)>=0)) {
+    alsa->mmap=1;
+  } else if (alsa_init_hw(alsa,SND_PCM_ACCESS_RW_INTERLEAVED)<0) {
+    return -1;
+  }
+  if (alsa_init_sw(alsa)<0) return -1;
   
   if (snd_pcm_nonblock(alsa->alsa,0)<0) return -1;
   if (snd_pcm_prepare(alsa->alsa)<0) return -1;
 
-  alsa->bufc=buffer_size;
   alsa->bufc_samples=alsa->bufc*alsa->delegate.chanc;
-  if (!(alsa->buf=malloc(alsa->bufc_samples*2))) return -1;
+  if (!alsa->mmap) {
+    if (!(alsa->buf=malloc(alsa->bufc_samples*2))) return -1;
+  }
 
   pthread_mutexattr_t mattr;
   pthread_mutexattr_init(&mattr);
   pthread_mutexattr_settype(&mattr,PTHREAD_MUTEX_RECURSIVE);
   if (pthread_mutex_init(&alsa->iomtx,&mattr)) return -1;
   pthread_mutexattr_destroy(&mattr);
+  if (pthread_mutex_init(&alsa->clockmtx,0)) return -1;
   if (pthread_create(&alsa->iothd,0,_alsa_iothd,alsa)) return -1;
+  alsa_init_thread(alsa);
   
   if (alsa->delegate.cb_midi_in) {
     if (alsa_midi_init(alsa)<0) {
@@ -197,6 +430,21 @@ void *alsa_get_userdata(const struct alsa *alsa) {
   if (!alsa) return 0;
   return alsa->delegate.userdata;
 }
+
+int alsa_get_period(const struct alsa *alsa) {
+  if (!alsa) return 0;
+  return alsa->bufc;
+}
+
+int alsa_get_buffer_size(const struct alsa *alsa) {
+  if (!alsa) return 0;
+  return alsa->hwbuffersize;
+}
+
+int alsa_get_mmap(const struct alsa *alsa) {
+  if (!alsa) return 0;
+  return alsa->mmap;
+}
   
 int alsa_get_status(const struct alsa *alsa) {
   if (!alsa) return -1;
@@ -244,17 +492,58 @@ int alsa_update(struct alsa *alsa) {
   return 0;
 }
 
+/* Playback clock.
+ */
+
+int64_t alsa_get_audible_frame(struct alsa *alsa) {
+  if (!alsa) return 0;
+  if (pthread_mutex_lock(&alsa->clockmtx)) return 0;
+  double pos=alsa->pos0;
+  if (alsa->running) pos+=(alsa_now()-alsa->t0)*alsa->clockrate;
+  int64_t audible=(int64_t)pos;
+  if (audible>alsa->produced) audible=alsa->produced;
+  if (audible<alsa->audible) audible=alsa->audible;
+  alsa->audible=audible;
+  pthread_mutex_unlock(&alsa->clockmtx);
+  return audible;
+}
+
+int64_t alsa_get_audible_frame_at(struct alsa *alsa,double t) {
+  if (!alsa) return 0;
+  if (pthread_mutex_lock(&alsa->clockmtx)) return 0;
+  double pos=alsa->pos0;
+  if (alsa->running) pos+=(t-alsa->t0)*alsa->clockrate;
+  pthread_mutex_unlock(&alsa->clockmtx);
+  return (int64_t)pos;
+}
+
+int64_t alsa_get_produced_frame(struct alsa *alsa) {
+  if (!alsa) return 0;
+  if (pthread_mutex_lock(&alsa->clockmtx)) return 0;
+  int64_t produced=alsa->produced;
+  pthread_mutex_unlock(&alsa->clockmtx);
+  return produced;
+}
+
 /* Buffered frames outstanding.
  */
 
 int alsa_estimate_buffered_frame_count(struct alsa *alsa) {
-  if (alsa->update_time<1) return 0;
-  int64_t now=alsa_now();
-  int64_t elapsedus=now-alsa->update_time;
-  int64_t uspercycle=(alsa->bufc*1000000ll)/alsa->delegate.rate;
-  if (uspercycle<1) return 0;
-  int doneframec=(elapsedus*alsa->bufc)/uspercycle;
-  if (doneframec<1) return alsa->bufc;
-  if (doneframec>=alsa->bufc) return 0;
-  return alsa->bufc-doneframec;
+  if (!alsa) return 0;
+  int64_t audible=alsa_get_audible_frame(alsa);
+  int64_t produced=alsa_get_produced_frame(alsa);
+  if (produced<=audible) return 0;
+  if (produced-audible>INT_MAX) return INT_MAX;
+  return produced-audible;
+}
+
+/* Statistics.
+ */
+
+void alsa_get_stats(struct alsa_stats *dst,struct alsa *alsa) {
+  memset(dst,0,sizeof(struct alsa_stats));
+  if (!alsa) return;
+  if (pthread_mutex_lock(&alsa->clockmtx)) return;
+  memcpy(dst,&alsa->stats,sizeof(struct alsa_stats));
+  pthread_mutex_unlock(&alsa->clockmtx);
 }
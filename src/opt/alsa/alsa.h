@@ -16,6 +16,11 @@ struct alsa_delegate {
   int rate;
   int chanc;
   const char *device; // eg "hw:0,3"
+  int period; // frames per transfer; zero for default. Negotiated value may differ.
+  int periodc; // periods in the hardware buffer; zero for default
+  int no_mmap; // nonzero to use plain read/write transfer even if mmap is available
+  int rtprio; // SCHED_FIFO priority for the I/O thread (1..99), or zero for normal scheduling
+  int cpu; // pin the I/O thread to CPU (cpu-1), or zero to let it float
   void *userdata;
   int (*cb_pcm_out)(int16_t *dst,int dsta,struct alsa *alsa);
   // Leave this null for no midi:
@@ -40,11 +45,44 @@ int alsa_unlock(struct alsa *alsa);
 int alsa_get_rate(const struct alsa *alsa);
 int alsa_get_chanc(const struct alsa *alsa);
 void *alsa_get_userdata(const struct alsa *alsa);
+
+/* What the device actually agreed to, in frames.
+ * Output latency is about (buffer_size): the hardware buffer stays full, and we refill it a period at a time.
+ */
+int alsa_get_period(const struct alsa *alsa);
+int alsa_get_buffer_size(const struct alsa *alsa);
+int alsa_get_mmap(const struct alsa *alsa);
 int alsa_get_status(const struct alsa *alsa); // => 0,-1
 
 // No harm either way, but only necessary if you're using MIDI in.
 int alsa_update(struct alsa *alsa);
 
+/* Playback clock, in frames since the stream opened.
+ * "produced" counts every frame your callback has been asked for.
+ * "audible" is the one reaching the device's output right now.
+ * It's measured from the device's position after each transfer, and smoothed, so our thread's scheduling jitter doesn't show.
+ * Audible never goes backward and never passes produced.
+ * Estimated buffered frame count is the difference.
+ */
+int64_t alsa_get_audible_frame(struct alsa *alsa);
+int64_t alsa_get_produced_frame(struct alsa *alsa);
+
+/* Frame that was or will be audible at (t), seconds on CLOCK_MONOTONIC, by extrapolating the clock.
+ * Unlike alsa_get_audible_frame(), this is not clamped.
+ */
+int64_t alsa_get_audible_frame_at(struct alsa *alsa,double t);
 int alsa_estimate_buffered_frame_count(struct alsa *alsa);
 
+/* Counters since the stream opened. Times are in seconds.
+ * Intervals are between the starts of consecutive callbacks.
+ * With mmap, one wakeup may make two callbacks when the ring buffer wraps.
+ */
+struct alsa_stats {
+  int xrunc;
+  int callbackc;
+  double cbmin,cbmax,cbtotal;
+  double intervalmin,intervalmax,intervaltotal;
+};
+void alsa_get_stats(struct alsa_stats *dst,struct alsa *alsa);
+
 #endif
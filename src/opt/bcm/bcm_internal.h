@@ -2,6 +2,7 @@
 #define BCM_INTERNAL_H
 
 #include "bcm.h"
+#include "opt/pixcvt/pixcvt.h"
 #include <bcm_host.h>
 #include <EGL/egl.h>
 #include <GLES2/gl2.h>
@@ -29,8 +29,6 @@ static const char bcm_fshader[]=
   "varying vec2 vtexcoord;\n"
   "void main() {\n"
   "  gl_FragColor=texture2D(sampler,vtexcoord);\n"
-  // This actually gives us BGR, not RGB. Not a big deal.
-  "  gl_FragColor=gl_FragColor.bgra;\n"
   "}\n"
 ;
 
@@ -105,26 +103,14 @@ int bcm_render_init(struct bcm *bcm) {
   return 0;
 }
 
-/* Swap bytes in framebuffer.
- */
-
-static void bcm_swap_bytes(struct bcm *bcm,const uint8_t *src) {
-  uint8_t *dst=bcm->swapbuf;
-  int i=bcm->fbw*bcm->fbh;
-  for (;i-->0;src+=2,dst+=2) {
-    dst[0]=src[1];
-    dst[1]=src[0];
-  }
-}
-
-/* Copy framebuffer and swap, public entry point.
+/* Convert framebuffer and swap, public entry point.
  */
 
 void bcm_swap(struct bcm *bcm,const void *fb) {
 
   // We need GL_UNSIGNED_SHORT_5_6_5_REV but i guess that doesn't exist in ES.
-  //glPixelStorei(GL_PACK_SWAP_BYTES,1); // oh dear this doesn't seem to exist either.
-  bcm_swap_bytes(bcm,fb);
+  // So convert to plain RGB565, which also saves swizzling in the shader.
+  pixcvt_convert(bcm->swapbuf,PIXCVT_FMT_RGB565,fb,bcm->fbw*bcm->fbh);
   glTexImage2D(GL_TEXTURE_2D,0,GL_RGB,bcm->fbw,bcm->fbh,0,GL_RGB,GL_UNSIGNED_SHORT_5_6_5,bcm->swapbuf);
 
   glViewport(0,0,bcm->screenw,bcm->screenh);
@@ -6,6 +6,7 @@
 #define DRMFB_H
 
 struct drmfb;
+struct image_rect;
 
 void drmfb_del(struct drmfb *drmfb);
 
@@ -22,4 +23,9 @@ struct drmfb *drmfb_new(
  */
 void drmfb_swap(struct drmfb *drmfb,const void *fb);
 
+/* Same, promising that only (rectv) changed since the last swap.
+ * We convert and scale only the rows each buffer is missing, and don't flip at all if nothing changed.
+ */
+void drmfb_swap_damaged(struct drmfb *drmfb,const void *fb,const struct image_rect *rectv,int rectc);
+
 #endif
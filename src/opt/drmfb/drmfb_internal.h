@@ -13,6 +13,8 @@
 #include <xf86drm.h>
 #include <xf86drmMode.h>
 #include "drmfb.h"
+#include "opt/pixcvt/pixcvt.h"
+#include "main/platform.h"
 
 // We're scaling in software; don't go too high.
 #define DRMFB_SCALE_LIMIT 6
@@ -37,6 +39,7 @@ struct drmfb {
     int handle;
     int size;
     void *v;
+    uint8_t *dirtyv; // (fbh), nonzero for rows this buffer hasn't seen the latest of
   } fbv[2];
   int fbp; // (0,1) which is attached -- draw to the other
 };
@@ -44,6 +47,6 @@ struct drmfb {
 int drmfb_init_connection(struct drmfb *drmfb);
 int drmfb_init_buffers(struct drmfb *drm);
 int drmfb_calculate_output_bounds(struct drmfb *drm);
-void drmfb_scale(struct drmfb_fb *dst,struct drmfb *drm,const uint16_t *src);
+void drmfb_scale(struct drmfb_fb *dst,struct drmfb *drm,const uint16_t *src); // dirty rows only
 
 #endif
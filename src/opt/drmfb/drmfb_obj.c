@@ -10,6 +10,7 @@ static void drmfb_fb_cleanup(struct drmfb *drmfb,struct drmfb_fb *fb) {
   if (fb->v) {
     munmap(fb->v,fb->size);
   }
+  if (fb->dirtyv) free(fb->dirtyv);
 }
  
 void drmfb_del(struct drmfb *drmfb) {
@@ -65,6 +66,14 @@ struct drmfb *drmfb_new(int w,int h,int rate) {
     return 0;
   }
   
+  // Both buffers start out missing everything.
+  if (!(drmfb->fbv[0].dirtyv=malloc(h))||!(drmfb->fbv[1].dirtyv=malloc(h))) {
+    drmfb_del(drmfb);
+    return 0;
+  }
+  memset(drmfb->fbv[0].dirtyv,1,h);
+  memset(drmfb->fbv[1].dirtyv,1,h);
+  
   return drmfb;
 }
 
@@ -72,6 +81,18 @@ struct drmfb *drmfb_new(int w,int h,int rate) {
  */
  
 void drmfb_swap(struct drmfb *drmfb,const void *src) {
+  struct image_rect all={0,0,drmfb->fbw,drmfb->fbh};
+  drmfb_swap_damaged(drmfb,src,&all,1);
+}
+
+void drmfb_swap_damaged(struct drmfb *drmfb,const void *src,const struct image_rect *rectv,int rectc) {
+  
+  // Nothing changed, and the front buffer is already current.
+  if (rectc<1) return;
+  for (;rectc-->0;rectv++) {
+    memset(drmfb->fbv[0].dirtyv+rectv->y,1,rectv->h);
+    memset(drmfb->fbv[1].dirtyv+rectv->y,1,rectv->h);
+  }
   
   drmfb->fbp^=1;
   struct drmfb_fb *fb=drmfb->fbv+drmfb->fbp;
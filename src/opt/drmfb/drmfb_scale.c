@@ -32,37 +32,25 @@ int drmfb_calculate_output_bounds(struct drmfb *drmfb) {
 }
 
 /* Scale image into framebuffer.
+ * Only the rows this buffer is missing, in runs, since the other buffer may have gotten some that we didn't.
  */
  
 void drmfb_scale(struct drmfb_fb *dst,struct drmfb *drmfb,const uint16_t *src) {
-  uint16_t *dstrow=dst->v;
-  dstrow+=drmfb->dsty*drmfb->stridewords+drmfb->dstx;
-  int cpc=drmfb->dstw*sizeof(uint16_t);
-  const uint16_t *srcrow=src;
-  int yi=drmfb->fbh;
-  for (;yi-->0;srcrow+=drmfb->fbw) {
-    uint16_t *dstp=dstrow;
-    const uint16_t *srcp=srcrow;
-    int xi=drmfb->fbw;
-    for (;xi-->0;srcp++) {
-      uint16_t pixel=*srcp;
-      
-      // Don't ask me why the Tiny does it this way...
-      uint8_t r=(pixel>>8)&0x1f;
-      uint8_t b=(pixel>>3)&0x1f;
-      uint8_t g=((pixel<<3)&0x38)|(pixel>>13);
-      pixel=(r<<11)|(g<<5)|b;
-      
-      int ri=drmfb->scale;
-      for (;ri-->0;dstp++) {
-        *dstp=pixel;
-      }
-    }
-    dstp=dstrow;
-    dstrow+=drmfb->stridewords;
-    int ri=drmfb->scale-1;
-    for (;ri-->0;dstrow+=drmfb->stridewords) {
-      memcpy(dstrow,dstp,cpc);
+  uint16_t *dstorigin=dst->v;
+  dstorigin+=drmfb->dsty*drmfb->stridewords+drmfb->dstx;
+  int y=0;
+  while (y<drmfb->fbh) {
+    if (!dst->dirtyv[y]) {
+      y++;
+      continue;
     }
+    int h=1;
+    while ((y+h<drmfb->fbh)&&dst->dirtyv[y+h]) h++;
+    pixcvt_scale(
+      dstorigin+y*drmfb->scale*drmfb->stridewords,drmfb->stridewords*sizeof(uint16_t),PIXCVT_FMT_RGB565,
+      src+y*drmfb->fbw,drmfb->fbw,drmfb->fbw,h,drmfb->scale
+    );
+    memset(dst->dirtyv+y,0,h);
+    y+=h;
   }
 }
@@ -2,6 +2,7 @@
 #define DRMGX_INTERNAL_H
 
 #include "drmgx.h"
+#include "opt/pixcvt/pixcvt.h"
 #include <stdlib.h>
 #include <string.h>
 #include <limits.h>
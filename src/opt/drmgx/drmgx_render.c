@@ -204,12 +204,7 @@ static void drmgx_fbcvt_RGB_TINY8(uint8_t *dst,const uint8_t *src,int w,int h) {
  */
  
 static void drmgx_fbcvt_RGB_TINY16(uint8_t *dst,const uint8_t *src,int w,int h) {
-  int pxc=w*h;
-  for (;pxc-->0;dst+=3,src+=2) {
-    dst[2]=((src[0]&0xf8));
-    dst[1]=((src[0]&0x07)<<5)|((src[1]&0xe0)>>3);
-    dst[0]=((src[1]&0x1f)<<3);
-  }
+  pixcvt_convert(dst,PIXCVT_FMT_RGB24,(const uint16_t*)src,w*h);
 }
 
 /* Upload and render framebuffer.
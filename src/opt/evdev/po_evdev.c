@@ -6,14 +6,19 @@
 #include <fcntl.h>
 #include <unistd.h>
 #include <dirent.h>
+#include <time.h>
 #include <sys/poll.h>
 #include <sys/inotify.h>
+#include <pthread.h>
 #include <linux/input.h>
 #include "main/platform.h"
 
 // Must end with slash.
 #define PO_EVDEV_DIR "/dev/input/"
 
+// Events between the input thread and the client. Must be a power of two.
+#define PO_EVDEV_QUEUE_SIZE 256
+
 #define PO_EVDEV_AXIS_MODE_BUTTON 1 /* >=hi ON, <hi OFF */
 #define PO_EVDEV_AXIS_MODE_TWOWAY 2 /* <=lo left/up, >=hi right/down */
 #define PO_EVDEV_AXIS_MODE_HAT    3 /* (v-lo) = (0,1,2,3,4,5,6,7) = (N,NE,E,SE,S,SW,W,NW)... why do these exist */
@@ -41,6 +46,7 @@ struct po_evdev {
   void *userdata;
   int infd;
   int rescan;
+  int64_t eventtime; // us, of the event being reported, or zero
   
   int config_loaded;
   struct po_evdev_config {
@@ -57,6 +63,7 @@ struct po_evdev {
     int evno;
     uint16_t vendor,product;
     uint16_t state;
+    int monotonic; // kernel stamps events with CLOCK_MONOTONIC (we ask at open)
     // axisv is used during mapping, or on the fly for auto-configured devices:
     struct po_evdev_axis {
       uint16_t code;
@@ -80,6 +87,22 @@ struct po_evdev {
   int devicec,devicea;
   struct pollfd *pollfdv;
   int pollfdc,pollfda;
+  
+  // Input thread, if started. It owns everything above, except (cb_button) is swapped for our enqueuer.
+  // The queue is single-producer single-consumer: the thread writes (queuetail), the client (queuehead).
+  pthread_t thd;
+  int thd_running;
+  volatile int thdabort;
+  int wakefd[2]; // pipe, to break the thread's poll
+  int (*cb_client)(struct po_evdev *evdev,uint8_t btnid,int value);
+  int64_t clienttime; // (eventtime) as the client sees it
+  struct po_evdev_event {
+    int64_t time;
+    uint8_t btnid;
+    uint8_t value;
+  } queuev[PO_EVDEV_QUEUE_SIZE];
+  unsigned int queuehead,queuetail;
+  int dropc; // thread only
 };
 
 /* Cleanup.
@@ -94,6 +117,14 @@ static void po_evdev_device_cleanup(struct po_evdev_device *device) {
 void po_evdev_del(struct po_evdev *evdev) {
   if (!evdev) return;
   
+  if (evdev->thd_running) {
+    evdev->thdabort=1;
+    if (write(evdev->wakefd[1],"",1)<0) ;
+    pthread_join(evdev->thd,0);
+    if (evdev->dropc) fprintf(stderr,"%s: Dropped %d input events to a full queue.\n",PO_EVDEV_DIR,evdev->dropc);
+  }
+  if (evdev->wakefd[0]>=0) close(evdev->wakefd[0]);
+  if (evdev->wakefd[1]>=0) close(evdev->wakefd[1]);
   if (evdev->infd>=0) close(evdev->infd);
   if (evdev->pollfdv) free(evdev->pollfdv);
   
@@ -132,6 +163,7 @@ struct po_evdev *po_evdev_new(
   
   evdev->cb_button=cb_button;
   evdev->userdata=userdata;
+  evdev->wakefd[0]=evdev->wakefd[1]=-1;
   
   if (po_evdev_init_inotify(evdev)<0) {
     fprintf(stderr,"%s: Failed to initialize inotify. Joystick connections will not be detected.\n",PO_EVDEV_DIR);
@@ -705,6 +737,8 @@ static int po_evdev_try_file(struct po_evdev *evdev,const char *base,int basec)
   }
   device->vendor=id.vendor;
   device->product=id.product;
+  int clockid=CLOCK_MONOTONIC;
+  if (ioctl(fd,EVIOCSCLOCKID,&clockid)>=0) device->monotonic=1;
   
   uint8_t absbit[(ABS_CNT+7)>>3]={0};
   ioctl(fd,EVIOCGBIT(EV_ABS,sizeof(absbit)),absbit);
@@ -1060,16 +1094,18 @@ static int po_evdev_read_device(struct po_evdev *evdev,struct po_evdev_device *d
   if (eventc<=0) return po_evdev_drop_fd(evdev,device->fd);
   eventc/=sizeof(struct input_event);
   const struct input_event *event=eventv;
-  if (device->mapc) {
-    for (;eventc-->0;event++) {
-      if (po_evdev_event_configured(evdev,device,event)<0) return -1;
-    }
-  } else {
-    for (;eventc-->0;event++) {
-      if (po_evdev_event_unconfigured(evdev,device,event)<0) return -1;
+  int err=0;
+  for (;eventc-->0;event++) {
+    if (device->monotonic) evdev->eventtime=(int64_t)event->time.tv_sec*1000000+event->time.tv_usec;
+    else evdev->eventtime=0;
+    if (device->mapc) {
+      if ((err=po_evdev_event_configured(evdev,device,event))<0) break;
+    } else {
+      if ((err=po_evdev_event_unconfigured(evdev,device,event))<0) break;
     }
   }
-  return 0;
+  evdev->eventtime=0;
+  return err;
 }
 
 /* Add to poll list.
@@ -1093,10 +1129,10 @@ static int po_evdev_pollfdv_add(struct po_evdev *evdev,int fd) {
   return 0;
 }
 
-/* Update.
+/* Poll devices and report whatever they have, waiting up to (timeout) ms.
  */
  
-int po_evdev_update(struct po_evdev *evdev) {
+static int po_evdev_poll(struct po_evdev *evdev,int timeout) {
   if (evdev->rescan) {
     po_evdev_scan(evdev);
     evdev->rescan=0;
@@ -1107,13 +1143,19 @@ int po_evdev_update(struct po_evdev *evdev) {
   struct po_evdev_device *device=evdev->devicev;
   int i=evdev->devicec;
   for (;i-->0;device++) po_evdev_pollfdv_add(evdev,device->fd);
+  if (evdev->wakefd[0]>=0) po_evdev_pollfdv_add(evdev,evdev->wakefd[0]);
   if (evdev->pollfdc<1) return 0;
   
-  if (poll(evdev->pollfdv,evdev->pollfdc,0)<1) return 0;
+  if (poll(evdev->pollfdv,evdev->pollfdc,timeout)<1) return 0;
   
   struct pollfd *pollfd=evdev->pollfdv;
   for (i=evdev->pollfdc;i-->0;pollfd++) {
-    if (pollfd->revents&(POLLERR|POLLHUP)) {
+    if (pollfd->fd==evdev->wakefd[0]) {
+      if (pollfd->revents) {
+        char dummy[16];
+        if (read(pollfd->fd,dummy,sizeof(dummy))<0) ;
+      }
+    } else if (pollfd->revents&(POLLERR|POLLHUP)) {
       po_evdev_drop_fd(evdev,pollfd->fd);
     } else if (pollfd->revents&POLLIN) {
       if (pollfd->fd==evdev->infd) {
@@ -1126,3 +1168,77 @@ int po_evdev_update(struct po_evdev *evdev) {
   
   return 0;
 }
+
+/* Update.
+ * With the thread running, we only deliver what it queued.
+ */
+ 
+int po_evdev_update(struct po_evdev *evdev) {
+  if (!evdev->thd_running) return po_evdev_poll(evdev,0);
+  unsigned int head=evdev->queuehead;
+  unsigned int tail=__atomic_load_n(&evdev->queuetail,__ATOMIC_ACQUIRE);
+  while (head!=tail) {
+    const struct po_evdev_event *event=evdev->queuev+(head&(PO_EVDEV_QUEUE_SIZE-1));
+    evdev->clienttime=event->time;
+    int err=evdev->cb_client(evdev,event->btnid,event->value);
+    head++;
+    __atomic_store_n(&evdev->queuehead,head,__ATOMIC_RELEASE);
+    if (err<0) break;
+  }
+  evdev->clienttime=0;
+  return 0;
+}
+
+/* Input thread.
+ * We stand in for the client's callback, and queue events with the time the kernel gave them.
+ * If the queue is full, the event is lost. That means the client hasn't updated in a long time.
+ */
+ 
+static int po_evdev_cb_enqueue(struct po_evdev *evdev,uint8_t btnid,int value) {
+  unsigned int tail=evdev->queuetail;
+  unsigned int head=__atomic_load_n(&evdev->queuehead,__ATOMIC_ACQUIRE);
+  if (tail-head>=PO_EVDEV_QUEUE_SIZE) {
+    evdev->dropc++;
+    return 0;
+  }
+  struct po_evdev_event *event=evdev->queuev+(tail&(PO_EVDEV_QUEUE_SIZE-1));
+  event->time=evdev->eventtime;
+  event->btnid=btnid;
+  event->value=value;
+  __atomic_store_n(&evdev->queuetail,tail+1,__ATOMIC_RELEASE);
+  return 0;
+}
+
+static void *po_evdev_thd(void *arg) {
+  struct po_evdev *evdev=arg;
+  while (!evdev->thdabort) {
+    po_evdev_poll(evdev,-1);
+  }
+  return 0;
+}
+
+int po_evdev_start_thread(struct po_evdev *evdev) {
+  if (!evdev) return -1;
+  if (evdev->thd_running) return 0;
+  if (pipe(evdev->wakefd)<0) {
+    evdev->wakefd[0]=evdev->wakefd[1]=-1;
+    return -1;
+  }
+  evdev->cb_client=evdev->cb_button;
+  evdev->cb_button=po_evdev_cb_enqueue;
+  if (pthread_create(&evdev->thd,0,po_evdev_thd,evdev)) {
+    evdev->cb_button=evdev->cb_client;
+    return -1;
+  }
+  evdev->thd_running=1;
+  return 0;
+}
+
+/* Event time.
+ */
+
+int64_t po_evdev_get_event_time(const struct po_evdev *evdev) {
+  if (!evdev) return 0;
+  if (evdev->thd_running) return evdev->clienttime;
+  return evdev->eventtime;
+}
@@ -21,4 +21,16 @@ void *po_evdev_get_userdata(const struct po_evdev *evdev);
 
 int po_evdev_update(struct po_evdev *evdev);
 
+/* Read devices on a thread of our own, from now on.
+ * It blocks on the devices and queues each event with its kernel timestamp as it arrives.
+ * po_evdev_update() then just delivers the queue to your callback, in order, on your thread.
+ * Nothing else about the object is safe to touch after this, until po_evdev_del().
+ */
+int po_evdev_start_thread(struct po_evdev *evdev);
+
+/* During your callback, when the kernel stamped the event, in microseconds on CLOCK_MONOTONIC.
+ * Zero if we don't know, eg buttons released because their device went away.
+ */
+int64_t po_evdev_get_event_time(const struct po_evdev *evdev);
+
 #endif
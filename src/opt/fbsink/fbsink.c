@@ -0,0 +1,234 @@
+#include "fbsink.h"
+#include "opt/pixcvt/pixcvt.h"
+#include "tool/common/png.h"
+#include "tool/common/decoder.h"
+#include "tool/common/serial.h"
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <limits.h>
+#include <errno.h>
+#include <time.h>
+#include <sys/stat.h>
+
+static int64_t fbsink_now_ns() {
+  struct timespec tv={0};
+  clock_gettime(CLOCK_MONOTONIC,&tv);
+  return (int64_t)tv.tv_sec*1000000000ll+tv.tv_nsec;
+}
+
+/* Object definition.
+ */
+
+struct fbsink {
+  struct fbsink_delegate delegate;
+  int refc;
+  int error;
+
+  FILE *log; // HASH
+  uint8_t *rgb; // PNG, (w*scale)*(h*scale)*3
+  struct encoder png; // PNG, the last frame encoded
+
+  struct fbsink_stats stats;
+};
+
+/* Delete.
+ */
+
+void fbsink_del(struct fbsink *fbsink) {
+  if (!fbsink) return;
+  if (fbsink->refc-->1) return;
+
+  if (fbsink->log) fclose(fbsink->log);
+  if (fbsink->rgb) free(fbsink->rgb);
+  encoder_cleanup(&fbsink->png);
+
+  free(fbsink);
+}
+
+/* Retain.
+ */
+
+int fbsink_ref(struct fbsink *fbsink) {
+  if (!fbsink) return -1;
+  if (fbsink->refc<1) return -1;
+  if (fbsink->refc==INT_MAX) return -1;
+  fbsink->refc++;
+  return 0;
+}
+
+/* Init.
+ */
+
+static int fbsink_init(struct fbsink *fbsink) {
+  if ((fbsink->delegate.w<1)||(fbsink->delegate.h<1)) return -1;
+  if (fbsink->delegate.scale<1) fbsink->delegate.scale=1;
+  switch (fbsink->delegate.mode) {
+
+    case FBSINK_MODE_NULL: break;
+
+    case FBSINK_MODE_HASH: {
+        if (fbsink->delegate.path) {
+          if (!(fbsink->log=fopen(fbsink->delegate.path,"w"))) {
+            fprintf(stderr,"%s: Failed to open for writing: %m\n",fbsink->delegate.path);
+            return -1;
+          }
+        }
+      } break;
+
+    case FBSINK_MODE_PNG: {
+        if (!fbsink->delegate.path||!fbsink->delegate.path[0]) return -1;
+        if ((mkdir(fbsink->delegate.path,0775)<0)&&(errno!=EEXIST)) {
+          fprintf(stderr,"%s: mkdir: %m\n",fbsink->delegate.path);
+          return -1;
+        }
+        int scale=fbsink->delegate.scale;
+        if (fbsink->delegate.w*scale>INT_MAX/(fbsink->delegate.h*scale*3)) return -1;
+        if (!(fbsink->rgb=malloc(fbsink->delegate.w*scale*fbsink->delegate.h*scale*3))) return -1;
+      } break;
+
+    default: return -1;
+  }
+  return 0;
+}
+
+/* New.
+ */
+
+struct fbsink *fbsink_new(const struct fbsink_delegate *delegate) {
+  if (!delegate) return 0;
+
+  struct fbsink *fbsink=calloc(1,sizeof(struct fbsink));
+  if (!fbsink) return 0;
+
+  fbsink->refc=1;
+  memcpy(&fbsink->delegate,delegate,sizeof(struct fbsink_delegate));
+
+  if (fbsink_init(fbsink)<0) {
+    fbsink_del(fbsink);
+    return 0;
+  }
+
+  return fbsink;
+}
+
+/* Trivial accessors.
+ */
+
+int fbsink_get_mode(const struct fbsink *fbsink) {
+  return fbsink->delegate.mode;
+}
+
+int fbsink_get_status(const struct fbsink *fbsink) {
+  return fbsink->error?-1:0;
+}
+
+const char *fbsink_mode_name(int mode) {
+  switch (mode) {
+    case FBSINK_MODE_NULL: return "null";
+    case FBSINK_MODE_HASH: return "hash";
+    case FBSINK_MODE_PNG: return "png";
+  }
+  return "?";
+}
+
+int fbsink_mode_eval(const char *name) {
+  if (!name) return -1;
+  if (!strcmp(name,"null")) return FBSINK_MODE_NULL;
+  if (!strcmp(name,"hash")) return FBSINK_MODE_HASH;
+  if (!strcmp(name,"png")) return FBSINK_MODE_PNG;
+  return -1;
+}
+
+void fbsink_get_stats(struct fbsink_stats *dst,const struct fbsink *fbsink) {
+  memcpy(dst,&fbsink->stats,sizeof(struct fbsink_stats));
+}
+
+/* Hash one frame, log it, and fold it into the sequence digest.
+ */
+
+static int fbsink_hash(struct fbsink *fbsink,const void *fb,int changed) {
+  if (changed||!fbsink->stats.framec) {
+    sr_md5(fbsink->stats.last,16,fb,fbsink->delegate.w*fbsink->delegate.h*2);
+  }
+  uint8_t pair[32];
+  memcpy(pair,fbsink->stats.digest,16);
+  memcpy(pair+16,fbsink->stats.last,16);
+  sr_md5(fbsink->stats.digest,16,pair,sizeof(pair));
+  if (fbsink->log) {
+    char hex[33];
+    sr_hexstring_encode(hex,sizeof(hex),fbsink->stats.last,16);
+    int c=fprintf(fbsink->log,"%d %s\n",fbsink->stats.framec,hex);
+    if (c<0) {
+      fprintf(stderr,"%s: Error writing frame hash.\n",fbsink->delegate.path);
+      return -1;
+    }
+    fbsink->stats.bytes+=c;
+  }
+  return 0;
+}
+
+/* Encode one frame if it changed, and write it.
+ */
+
+static int fbsink_png(struct fbsink *fbsink,const void *fb,int changed) {
+  if (changed||!fbsink->png.c) {
+    int scale=fbsink->delegate.scale;
+    int w=fbsink->delegate.w*scale,h=fbsink->delegate.h*scale;
+    pixcvt_scale(fbsink->rgb,w*3,PIXCVT_FMT_RGB24,fb,fbsink->delegate.w,fbsink->delegate.w,fbsink->delegate.h,scale);
+    struct png_image image={
+      .pixels=fbsink->rgb,
+      .stride=w*3,
+      .pixelsize=24,
+      .w=w,
+      .h=h,
+      .depth=8,
+      .colortype=PNG_COLORTYPE_RGB,
+    };
+    fbsink->png.c=0;
+    if (png_encode(&fbsink->png,&image)<0) {
+      fprintf(stderr,"Failed to encode PNG.\n");
+      return -1;
+    }
+  }
+  char path[1024];
+  int pathc=snprintf(path,sizeof(path),"%s/%06d.png",fbsink->delegate.path,fbsink->stats.framec);
+  if ((pathc<1)||(pathc>=(int)sizeof(path))) return -1;
+  FILE *f=fopen(path,"wb");
+  if (!f) {
+    fprintf(stderr,"%s: Failed to open for writing: %m\n",path);
+    return -1;
+  }
+  int ok=(fwrite(fbsink->png.v,1,fbsink->png.c,f)==fbsink->png.c);
+  if (fclose(f)) ok=0;
+  if (!ok) {
+    fprintf(stderr,"%s: Error writing frame.\n",path);
+    return -1;
+  }
+  fbsink->stats.bytes+=fbsink->png.c;
+  return 0;
+}
+
+/* Swap.
+ */
+
+int fbsink_swap(struct fbsink *fbsink,const void *fb,int changed) {
+  if (!fbsink||!fb) return -1;
+  if (fbsink->error) return -1;
+  int64_t start=fbsink_now_ns();
+  int err=0;
+  switch (fbsink->delegate.mode) {
+    case FBSINK_MODE_HASH: err=fbsink_hash(fbsink,fb,changed); break;
+    case FBSINK_MODE_PNG: err=fbsink_png(fbsink,fb,changed); break;
+  }
+  if (err<0) {
+    fbsink->error=1;
+    return -1;
+  }
+  if (changed||!fbsink->stats.framec) fbsink->stats.changec++;
+  fbsink->stats.framec++;
+  double elapsed=(fbsink_now_ns()-start)/1000000000.0;
+  fbsink->stats.swaptime+=elapsed;
+  if (elapsed>fbsink->stats.maxtime) fbsink->stats.maxtime=elapsed;
+  return 0;
+}
@@ -0,0 +1,59 @@
+/* fbsink.h
+ * Video output without a display, for headless runs: CI, profiling, and comparing renderer output.
+ * Accepts Tiny16 framebuffers like the other video drivers, and:
+ *   NULL: Discards them.
+ *   HASH: MD5 of each frame's raw bytes. Optionally logs one line per frame: "INDEX HEX".
+ *   PNG: Writes each frame to a numbered file "DIR/INDEX.png", 8-bit RGB, optionally upscaled.
+ * Pacing is not our problem; we return as soon as the frame is handled.
+ */
+
+#ifndef FBSINK_H
+#define FBSINK_H
+
+struct fbsink;
+
+#include <stdint.h>
+
+#define FBSINK_MODE_NULL 0
+#define FBSINK_MODE_HASH 1
+#define FBSINK_MODE_PNG  2
+
+struct fbsink_delegate {
+  int w,h;
+  int mode;
+  const char *path; // HASH: log file, or null for just the summary. PNG: directory, required.
+  int scale; // PNG only; zero for 1
+};
+
+void fbsink_del(struct fbsink *fbsink);
+int fbsink_ref(struct fbsink *fbsink);
+
+struct fbsink *fbsink_new(
+  const struct fbsink_delegate *delegate
+);
+
+int fbsink_get_mode(const struct fbsink *fbsink);
+int fbsink_get_status(const struct fbsink *fbsink); // => 0,-1
+const char *fbsink_mode_name(int mode);
+int fbsink_mode_eval(const char *name); // => mode, or -1
+
+/* Present one frame.
+ * (changed) zero if you know it's identical to the last one; we reuse its digest or encoded image.
+ */
+int fbsink_swap(struct fbsink *fbsink,const void *fb,int changed);
+
+/* Counters since start.
+ * (digest) is MD5 of the concatenated per-frame digests, one value for the whole sequence.
+ * (last) is the final frame's digest.
+ */
+struct fbsink_stats {
+  int framec;
+  int changec; // frames that differed from the one before
+  int64_t bytes; // written to disk
+  double swaptime,maxtime; // seconds
+  uint8_t digest[16];
+  uint8_t last[16];
+};
+void fbsink_get_stats(struct fbsink_stats *dst,const struct fbsink *fbsink);
+
+#endif
@@ -2,6 +2,7 @@
 #include <string.h>
 #include <unistd.h>
 #include <time.h>
+#include <errno.h>
 #include <sys/time.h>
 
 /* Current time.
@@ -13,6 +14,12 @@ int64_t now_us() {
   return (int64_t)tv.tv_sec*1000000+tv.tv_usec;
 }
 
+int64_t now_mono_us() {
+  struct timespec tv={0};
+  clock_gettime(CLOCK_MONOTONIC,&tv);
+  return (int64_t)tv.tv_sec*1000000+tv.tv_nsec/1000;
+}
+
 double now_s() {
   struct timeval tv={0};
   gettimeofday(&tv,0);
@@ -36,6 +43,78 @@ void sleep_s(double s) {
   usleep((int)(s*1000000.0));
 }
 
+/* Frame pacer.
+ */
+
+static int64_t pacer_now() {
+  struct timespec tv={0};
+  clock_gettime(CLOCK_MONOTONIC,&tv);
+  return (int64_t)tv.tv_sec*1000000000ll+tv.tv_nsec;
+}
+
+void pacer_init(struct pacer *pacer,int hz,int spin_us) {
+  memset(pacer,0,sizeof(struct pacer));
+  pacer->hz=(hz>0)?hz:0;
+  pacer->spin_ns=(spin_us>0)?(spin_us*1000ll):0;
+  pacer->start=pacer_now();
+  pacer->last=pacer->start;
+}
+
+int pacer_wait(struct pacer *pacer) {
+  int64_t now=pacer_now();
+  int64_t due=1;
+  if (pacer->hz) {
+    int64_t deadline=pacer->start+((pacer->tickc+1)*1000000000ll)/pacer->hz;
+    if (now<deadline) {
+      int64_t wake=deadline-pacer->spin_ns;
+      if (now<wake) {
+        struct timespec ts={
+          .tv_sec=wake/1000000000ll,
+          .tv_nsec=wake%1000000000ll,
+        };
+        while (clock_nanosleep(CLOCK_MONOTONIC,TIMER_ABSTIME,&ts,0)==EINTR) ;
+      }
+      while ((now=pacer_now())<deadline) ;
+    }
+    due=((now-pacer->start)*pacer->hz)/1000000000ll-pacer->tickc;
+    if (due<1) due=1;
+  }
+
+  pacer->missc+=due-1;
+  pacer->tickc+=due;
+  if (due>PACER_CATCHUP_LIMIT) {
+    pacer->dropc+=due-PACER_CATCHUP_LIMIT;
+    due=PACER_CATCHUP_LIMIT;
+  }
+
+  int64_t interval=now-pacer->last;
+  pacer->last=now;
+  if (interval>pacer->max_ns) pacer->max_ns=interval;
+  int64_t bucket=interval/(PACER_HIST_US*1000);
+  if (bucket>=PACER_HIST_SIZE) bucket=PACER_HIST_SIZE-1;
+  pacer->histv[bucket]++;
+  pacer->framec++;
+
+  return due;
+}
+
+double pacer_get_percentile(const struct pacer *pacer,double p) {
+  if (pacer->framec<1) return 0.0;
+  if (p>=1.0) return pacer->max_ns/1000000000.0;
+  uint32_t target=(uint32_t)(p*pacer->framec);
+  uint32_t sum=0;
+  int i=0;
+  for (;i<PACER_HIST_SIZE;i++) {
+    sum+=pacer->histv[i];
+    if (sum>target) return ((i+0.5)*PACER_HIST_US)/1000000.0;
+  }
+  return pacer->max_ns/1000000000.0;
+}
+
+double pacer_get_elapsed(const struct pacer *pacer) {
+  return (pacer->last-pacer->start)/1000000000.0;
+}
+
 /* Structured timer.
  */
  
@@ -8,6 +8,7 @@
 #include <stdint.h>
 
 int64_t now_us();
+int64_t now_mono_us(); // CLOCK_MONOTONIC, the same clock as input and audio timestamps
 double now_s();
 double now_cpu_s();
 
@@ -41,4 +42,36 @@ double timer_get_step(const struct timer *timer,int p);
 // How long from the beginning to sample (p)? Same as total for (p>=c-1).
 double timer_get_time_to_step(const struct timer *timer,int p);
 
+/* Frame pacer.
+ * Tick (n) is due at (start+n/hz) on CLOCK_MONOTONIC, computed fresh each time so error never accumulates.
+ * We sleep to each deadline with an absolute clock_nanosleep, optionally spinning the last (spin_us) for precision.
+ * pacer_wait() returns how many ticks are due, usually 1: Run that many updates and present once.
+ * Past PACER_CATCHUP_LIMIT we drop ticks instead of fast-forwarding through them.
+ * With (hz) zero we don't wait at all: Every call returns 1 immediately, for headless runs at full speed.
+ */
+
+#define PACER_CATCHUP_LIMIT 4
+#define PACER_HIST_US 100 /* bucket width */
+#define PACER_HIST_SIZE 1000 /* up to 100 ms; longer go in the last bucket */
+
+struct pacer {
+  int hz;
+  int64_t spin_ns;
+  int64_t start; // ns
+  int64_t tickc; // ticks elapsed, run or dropped
+  int64_t last; // ns, when the previous wait returned
+  int framec; // waits returned
+  int missc; // deadlines we didn't wake for in time, ie extra ticks returned
+  int dropc; // ticks skipped entirely
+  int64_t max_ns;
+  uint32_t histv[PACER_HIST_SIZE]; // time between frames
+};
+
+void pacer_init(struct pacer *pacer,int hz,int spin_us);
+int pacer_wait(struct pacer *pacer);
+
+// Frame interval at percentile (p) in 0..1, in seconds. To the nearest PACER_HIST_US.
+double pacer_get_percentile(const struct pacer *pacer,double p);
+double pacer_get_elapsed(const struct pacer *pacer);
+
 #endif
@@ -27,6 +27,20 @@
 #if PO_USE_evdev
   #include "opt/evdev/po_evdev.h"
 #endif
+#if PO_USE_upsample
+  #include "opt/upsample/upsample.h"
+#endif
+#if PO_USE_pcmsink
+  #include "opt/pcmsink/pcmsink.h"
+#endif
+#if PO_USE_fbsink
+  #include "opt/fbsink/fbsink.h"
+#endif
+
+#define GENIOC_INPUT_EVENT_LIMIT 64
+#define GENIOC_FBW 96
+#define GENIOC_FBH 64
+#define GENIOC_DAMAGE_LIMIT 8 /* Changed row spans per presented frame; more get merged. */
 
 extern struct genioc {
   #if PO_USE_x11
@@ -44,15 +58,48 @@ extern struct genioc {
   #if PO_USE_alsa
     struct alsa *alsa;
   #endif
+  #if PO_USE_pcmsink
+    struct pcmsink *pcmsink; // null or file driver
+  #endif
+  #if PO_USE_fbsink
+    struct fbsink *fbsink; // null, hash, or png driver
+  #endif
   #if PO_USE_evdev
     struct po_evdev *evdev;
   #endif
+  #if PO_USE_upsample
+    struct upsample *upsample; // present if the synthesizer runs slower than the audio driver
+  #endif
   int terminate;
   uint8_t inputstate;
+  struct platform_input_event inputeventv[GENIOC_INPUT_EVENT_LIMIT]; // since the last platform_update()
+  int inputeventc,inputeventp;
   volatile int sigc;
+  int audio_ready; // set once setup() returns; the driver may start calling before
+  int64_t audio_unrendered; // driver frames we played as silence before (audio_ready)
+  int audio_manual; // pcmsink without its thread; main() produces audio for each update
   int audio_skipc;
   int16_t audio_skipv;
   const void *fbtmp;
+  struct image_rect fbdamage; // union of damage from every send since we last presented
+  uint16_t fbprev[GENIOC_FBW*GENIOC_FBH]; // what we last presented
+  int fbprev_valid;
+  int video_full; // nonzero to ignore damage and always present everything
 } genioc;
 
+// Record a change to (inputstate), with its time in us on genioc_now_us()'s clock, or zero for now.
+void genioc_set_input(uint8_t btnid,int value,int64_t time);
+
+// Microseconds on the audio driver's clock. CLOCK_MONOTONIC, unless the frame loop is driving audio (--frame-rate=0 with pcmsink).
+int64_t genioc_now_us();
+
+// genioc_loopback.c, automated calibration. (ms) <0 to disable.
+int genioc_loopback_init(int ms);
+void genioc_loopback_pcm(const int16_t *v,int c,int chanc); // audio thread
+void genioc_loopback_update();
+
+// genioc_script.c, --input-script.
+int genioc_script_init(const char *src);
+void genioc_script_update(); // once per update, before delivering input
+
 #endif
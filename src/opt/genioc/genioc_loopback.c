@@ -0,0 +1,153 @@
+/* genioc_loopback.c
+ * Automated latency calibration, for test rigs: --calibrate-loopback=MS with the null or file audio driver.
+ * We select calibration from the menu with scripted presses, then listen to our own output,
+ * and press A exactly (MS) after each click becomes audible. Calibration should report (MS).
+ * See etc/tool/calibrate-loopback.sh.
+ */
+
+#include "genioc_internal.h"
+
+#if PO_USE_pcmsink
+
+#define LOOPBACK_QUIET_MS    100 /* Silent this long before another onset counts. */
+#define LOOPBACK_TAP_MS       40 /* How long we hold A. */
+#define LOOPBACK_IDLE_MS    3000 /* No clicks this long after the first, and we quit. */
+#define LOOPBACK_ONSET_LIMIT  16 /* Must be a power of two. */
+
+/* Menu navigation: The calibration entry comes after the last song, so UP from the top selects it.
+ */
+static const struct loopback_step {
+  int ms; // from startup
+  uint8_t btnid;
+  uint8_t value;
+} loopback_script[]={
+  {500,BUTTON_UP,1},
+  {600,BUTTON_UP,0},
+  {700,BUTTON_A,1},
+  {800,BUTTON_A,0},
+};
+
+static struct {
+  int enable;
+  int ms;
+  // Audio thread only:
+  int64_t frame; // driver frames so far, counting from before we were enabled
+  int quiet; // consecutive silent frames
+  int quietlimit;
+  // Audio thread to main thread, single-producer single-consumer:
+  int64_t onsetv[LOOPBACK_ONSET_LIMIT]; // us, when each click becomes audible
+  unsigned int onsethead,onsettail;
+  // Main thread only:
+  int64_t starttime;
+  int scriptp;
+  int64_t tapv[LOOPBACK_ONSET_LIMIT];
+  int tapp,tapc;
+  int64_t releasetime;
+  int64_t lastonset;
+} loopback={0};
+
+/* Init.
+ */
+
+int genioc_loopback_init(int ms) {
+  if (ms<0) return 0;
+  if (!genioc.pcmsink) {
+    fprintf(stderr,"--calibrate-loopback requires --audio-driver=null or file.\n");
+    return -1;
+  }
+  loopback.ms=ms;
+  loopback.quietlimit=(pcmsink_get_rate(genioc.pcmsink)*LOOPBACK_QUIET_MS)/1000;
+  loopback.quiet=loopback.quietlimit;
+  loopback.starttime=genioc_now_us();
+  __atomic_store_n(&loopback.enable,1,__ATOMIC_RELEASE);
+  fprintf(stderr,"Calibration loopback: Tapping %d ms after each click.\n",ms);
+  return 0;
+}
+
+/* Audio thread: Find clicks in our output.
+ * The synthesizer renders exact silence between notes, so any nonzero sample after a quiet spell is an onset.
+ */
+
+void genioc_loopback_pcm(const int16_t *v,int c,int chanc) {
+  int framec=c/chanc;
+  if (!__atomic_load_n(&loopback.enable,__ATOMIC_ACQUIRE)) {
+    loopback.frame+=framec;
+    return;
+  }
+  int i=0;
+  for (;i<framec;i++,v+=chanc) {
+    if (!*v) {
+      loopback.quiet++;
+      continue;
+    }
+    if (loopback.quiet>=loopback.quietlimit) {
+      unsigned int tail=loopback.onsettail;
+      if (tail-__atomic_load_n(&loopback.onsethead,__ATOMIC_ACQUIRE)<LOOPBACK_ONSET_LIMIT) {
+        double t=pcmsink_get_frame_time(genioc.pcmsink,loopback.frame+i);
+        loopback.onsetv[tail&(LOOPBACK_ONSET_LIMIT-1)]=(int64_t)(t*1000000.0);
+        __atomic_store_n(&loopback.onsettail,tail+1,__ATOMIC_RELEASE);
+      }
+    }
+    loopback.quiet=0;
+  }
+  loopback.frame+=framec;
+}
+
+/* Main thread: Run the script and press buttons when due, with the exact times we meant to.
+ */
+
+void genioc_loopback_update() {
+  if (!loopback.enable) return;
+  int64_t now=genioc_now_us();
+
+  while (loopback.scriptp<sizeof(loopback_script)/sizeof(struct loopback_step)) {
+    const struct loopback_step *step=loopback_script+loopback.scriptp;
+    int64_t time=loopback.starttime+step->ms*1000ll;
+    if (time>now) break;
+    genioc_set_input(step->btnid,step->value,time);
+    loopback.scriptp++;
+  }
+
+  unsigned int head=loopback.onsethead;
+  unsigned int tail=__atomic_load_n(&loopback.onsettail,__ATOMIC_ACQUIRE);
+  for (;head!=tail;head++) {
+    loopback.lastonset=loopback.onsetv[head&(LOOPBACK_ONSET_LIMIT-1)];
+    if (loopback.tapc<LOOPBACK_ONSET_LIMIT) {
+      loopback.tapv[(loopback.tapp+loopback.tapc++)&(LOOPBACK_ONSET_LIMIT-1)]=loopback.lastonset+loopback.ms*1000ll;
+    }
+  }
+  __atomic_store_n(&loopback.onsethead,head,__ATOMIC_RELEASE);
+
+  if (loopback.releasetime&&(loopback.releasetime<=now)) {
+    genioc_set_input(BUTTON_A,0,loopback.releasetime);
+    loopback.releasetime=0;
+  }
+  while (loopback.tapc&&!loopback.releasetime) {
+    int64_t time=loopback.tapv[loopback.tapp];
+    if (time>now) break;
+    loopback.tapp=(loopback.tapp+1)&(LOOPBACK_ONSET_LIMIT-1);
+    loopback.tapc--;
+    genioc_set_input(BUTTON_A,1,time);
+    loopback.releasetime=time+LOOPBACK_TAP_MS*1000ll;
+  }
+
+  if (loopback.lastonset&&(now-loopback.lastonset>LOOPBACK_IDLE_MS*1000ll)) {
+    genioc.terminate=1;
+  }
+}
+
+#else
+
+int genioc_loopback_init(int ms) {
+  if (ms<0) return 0;
+  fprintf(stderr,"--calibrate-loopback requires the pcmsink unit.\n");
+  return -1;
+}
+
+void genioc_loopback_pcm(const int16_t *v,int c,int chanc) {
+}
+
+void genioc_loopback_update() {
+}
+
+#endif
@@ -1,5 +1,6 @@
 #include "genioc_internal.h"
 #include <signal.h>
+#include <sys/mman.h>
 
 struct genioc genioc={0};
 
@@ -10,13 +11,35 @@ static void genioc_print_help(const char *exename) {
   fprintf(stderr,"Usage: %s [OPTIONS]\n",exename);
   fprintf(stderr,
     "OPTIONS:\n"
+    "  --video-driver=NAME    x11, drmfb, drmgx, bcm, null, hash, or png. Default the first of x11..bcm that works.\n"
+    "  --video-out=PATH       With --video-driver=png, directory for numbered frames (required).\n"
+    "                         With --video-driver=hash, log each frame's MD5 here (optional).\n"
+    "  --video-scale=INT      With --video-driver=png, upscale frames this much. Default 1.\n"
+    "  --frame-rate=HZ        Updates per second, default 60. 0 to run as fast as possible, eg with a headless video driver.\n"
+    "                         With --audio-driver=null or file, 0 also produces exactly 1/60 s of audio per update, for reproducible runs.\n"
+    "  --frame-limit=INT      Exit after presenting so many frames.\n"
     "  --fullscreen           GLX only, start fullscreen.\n"
     "  --video-device=PATH    DRM only.\n"
     "  --video-rate=HZ        DRM only, guides our mode selection, not exact.\n"
     "  --glsl-version=INT     DRM only, default 100.\n"
+    "  --audio-driver=NAME    alsa, null, or file. Default alsa, or null if ALSA fails.\n"
+    "  --audio-file=PATH      With --audio-driver=file, stream WAV here. A FIFO works, once something opens it for reading.\n"
     "  --audio-device=PATH    ALSA only.\n"
     "  --audio-rate=INT       Default 22050.\n"
     "  --audio-chanc=INT      Default 1. In stereo, we output the same thing L and R.\n"
+    "  --audio-period=FRAMES  ALSA only, frames per transfer. Default 256.\n"
+    "  --audio-periods=INT    ALSA only, periods in the hardware buffer. Default 3.\n"
+    "  --audio-mmap=0         ALSA only, use read/write transfer instead of mmap.\n"
+    "  --audio-rtprio=INT     ALSA only, run the audio thread SCHED_FIFO at this priority (1..99).\n"
+    "  --audio-cpu=INT        ALSA only, pin the audio thread to this CPU.\n"
+    "  --mlock                Lock all memory, so the audio thread never waits for a page fault.\n"
+    "  --synth-rate=INT       Run the synthesizer at this rate and upsample to the driver's. 22050 is cheapest.\n"
+    "  --input-thread=0       Poll joysticks once per frame on the main thread, instead of reading them as events arrive.\n"
+    "  --video-damage=0       Convert and upload the whole framebuffer every frame, instead of just the rows that changed.\n"
+    "  --x11-shm=0            X11 only, send frames over the socket with XPutImage instead of sharing memory.\n"
+    "  --frame-spin=US        Sleep until this long before each frame's deadline, then spin. Costs CPU, gains precision.\n"
+    "  --calibrate-loopback=MS  With --audio-driver=null or file, run latency calibration by tapping MS after each click we output.\n"
+    "  --input-script=STEPS   Press buttons at fixed updates: UPDATE=BUTTONS,... from 'udlrab'. eg '30=a,34=' starts the first song.\n"
   );
 }
 
@@ -73,9 +96,18 @@ static void genioc_quit_drivers() {
   #if PO_USE_alsa
     alsa_del(genioc.alsa);
   #endif
+  #if PO_USE_pcmsink
+    pcmsink_del(genioc.pcmsink);
+  #endif
+  #if PO_USE_fbsink
+    fbsink_del(genioc.fbsink);
+  #endif
   #if PO_USE_evdev
     po_evdev_del(genioc.evdev);
   #endif
+  #if PO_USE_upsample
+    upsample_del(genioc.upsample);
+  #endif
 }
 
 /* Signal handler.
@@ -92,12 +124,31 @@ static void genioc_rcvsig(int sigid) {
 
 /* Driver callbacks.
  */
+
+int64_t genioc_now_us() {
+  #if PO_USE_pcmsink
+    if (genioc.audio_manual) return (int64_t)(pcmsink_now(genioc.pcmsink)*1000000.0);
+  #endif
+  return now_mono_us();
+}
  
+void genioc_set_input(uint8_t btnid,int value,int64_t time) {
+  uint8_t pv=genioc.inputstate;
+  if (value) genioc.inputstate|=btnid;
+  else genioc.inputstate&=~btnid;
+  uint8_t changed=pv^genioc.inputstate;
+  if (!changed) return;
+  if (genioc.inputeventc>=GENIOC_INPUT_EVENT_LIMIT) return; // game will still see the final state
+  struct platform_input_event *event=genioc.inputeventv+genioc.inputeventc++;
+  event->time=time?time:genioc_now_us();
+  event->btnid=changed;
+  event->value=value?1:0;
+}
+
 #if PO_USE_x11
  
 static int genioc_cb_x11_button(struct po_x11 *x11,uint8_t btnid,int value) {
-  if (value) genioc.inputstate|=btnid;
-  else genioc.inputstate&=~btnid;
+  genioc_set_input(btnid,value,0);
   return 0;
 }
 
@@ -108,32 +159,33 @@ static int genioc_cb_x11_close(struct po_x11 *x11) {
 
 #endif
 
+#if PO_USE_upsample
+
+static void genioc_cb_upsample(int16_t *v,int c,void *userdata) {
+  audio_render(v,c,1);
+}
+
+#endif
+
 static void genioc_cb_pcm(int16_t *v,int c,int chanc,int driver_rate) {
   if (chanc<1) {
     memset(v,0,c<<1);
     return;
   }
-  switch (chanc) {
-  
-    case 1: {
-        for (;c-->0;v++) *v=audio_next();
-      } break;
-      
-    case 2: {
-        int framec=c>>1;
-        for (;framec-->0;v+=2) v[0]=v[1]=audio_next();
-      } break;
-      
-    default: {
-        // (chanc>2), I reckon this is unlikely to happen so not bothering with rate correction.
-        int framec=c/chanc;
-        for (;framec-->0;) {
-          int16_t sample=audio_next();
-          int i=chanc;
-          for (;i-->0;v++) *v=sample;
-        }
-      }
+  // Drivers start before setup() has initialized the synth. Keep it out of the way until then,
+  // and count what we skipped so the synth's frame count stays a fixed ratio of the driver's.
+  if (!__atomic_load_n(&genioc.audio_ready,__ATOMIC_ACQUIRE)) {
+    memset(v,0,c<<1);
+    __atomic_add_fetch(&genioc.audio_unrendered,c/chanc,__ATOMIC_RELAXED);
+    return;
   }
+  #if PO_USE_upsample
+    if (genioc.upsample) {
+      upsample_render(genioc.upsample,v,c/chanc,chanc);
+      return;
+    }
+  #endif
+  audio_render(v,c/chanc,chanc);
 }
 
 #if PO_USE_alsa
@@ -145,12 +197,21 @@ static int genioc_cb_alsa(int16_t *v,int c,struct alsa *alsa) {
 
 #endif
 
+#if PO_USE_pcmsink
+
+static int genioc_cb_pcmsink(int16_t *v,int c,struct pcmsink *pcmsink) {
+  genioc_cb_pcm(v,c,pcmsink_get_chanc(pcmsink),pcmsink_get_rate(pcmsink));
+  genioc_loopback_pcm(v,c,pcmsink_get_chanc(pcmsink));
+  return 0;
+}
+
+#endif
+
 #if PO_USE_evdev
 
 static int genioc_cb_evdev(struct po_evdev *evdev,uint8_t btnid,int value) {
   if (btnid<BUTTON_NONSTANDARD) {
-    if (value) genioc.inputstate|=btnid;
-    else genioc.inputstate&=~btnid;
+    genioc_set_input(btnid,value,po_evdev_get_event_time(evdev));
   } else switch (btnid) {
     case BUTTON_QUIT: genioc.terminate=1; break;
   }
@@ -165,11 +226,12 @@ static int genioc_cb_evdev(struct po_evdev *evdev,uint8_t btnid,int value) {
 /* Init video driver.
  */
 
-static int genioc_init_video_driver(int argc,char **argv) {
+static int genioc_init_x11(int argc,char **argv) {
   #if PO_USE_x11
     if (genioc.x11=po_x11_new(
       "Pocket Orchestra",
-      96,64,genioc_argv_get_boolean(argc,argv,"--fullscreen"),
+      GENIOC_FBW,GENIOC_FBH,genioc_argv_get_boolean(argc,argv,"--fullscreen"),
+      genioc_argv_get_int(argc,argv,"--x11-shm",1),
       genioc_cb_x11_button,
       genioc_cb_x11_close,
       &genioc
@@ -178,19 +240,25 @@ static int genioc_init_video_driver(int argc,char **argv) {
       return 0;
     }
   #endif
-  
+  return -1;
+}
+
+static int genioc_init_drmfb(int argc,char **argv) {
   #if PO_USE_drmfb
-    if (genioc.drmfb=drmfb_new(96,64,genioc_argv_get_int(argc,argv,"--video-rate",60))) {
+    if (genioc.drmfb=drmfb_new(GENIOC_FBW,GENIOC_FBH,genioc_argv_get_int(argc,argv,"--video-rate",60))) {
       fprintf(stderr,"Using DRM unaccelerated for video.\n");
       return 0;
     }
   #endif
+  return -1;
+}
 
+static int genioc_init_drmgx(int argc,char **argv) {
   #if PO_USE_drmgx
     if (genioc.drmgx=drmgx_new(
       genioc_argv_get_string(argc,argv,"--video-device",0),
       genioc_argv_get_int(argc,argv,"--video-rate",60),
-      96,64,DRMGX_FMT_TINY16,
+      GENIOC_FBW,GENIOC_FBH,DRMGX_FMT_TINY16,
       genioc_argv_get_int(argc,argv,"--video-filter",0),
       genioc_argv_get_int(argc,argv,"--glsl-version",0)
     )) {
@@ -198,34 +266,161 @@ static int genioc_init_video_driver(int argc,char **argv) {
       return 0;
     }
   #endif
+  return -1;
+}
 
+static int genioc_init_bcm(int argc,char **argv) {
   #if PO_USE_bcm
-    if (genioc.bcm=bcm_new(96,64)) {
+    if (genioc.bcm=bcm_new(GENIOC_FBW,GENIOC_FBH)) {
       fprintf(stderr,"Using BCM for video.\n");
       return 0;
     }
   #endif
+  return -1;
+}
+
+static int genioc_init_fbsink(int argc,char **argv,const char *name) {
+  #if PO_USE_fbsink
+    int mode=fbsink_mode_eval(name);
+    struct fbsink_delegate fbsink_delegate={
+      .w=GENIOC_FBW,
+      .h=GENIOC_FBH,
+      .mode=mode,
+      .path=genioc_argv_get_string(argc,argv,"--video-out",0),
+      .scale=genioc_argv_get_int(argc,argv,"--video-scale",1),
+    };
+    if ((mode==FBSINK_MODE_PNG)&&!fbsink_delegate.path) {
+      fprintf(stderr,"--video-driver=png requires --video-out=DIRECTORY\n");
+      return -1;
+    }
+    if (genioc.fbsink=fbsink_new(&fbsink_delegate)) {
+      fprintf(stderr,
+        "Using %s driver%s%s for video.\n",
+        name,fbsink_delegate.path?" to ":"",fbsink_delegate.path?fbsink_delegate.path:""
+      );
+      return 0;
+    }
+  #endif
+  return -1;
+}
+
+static int genioc_init_video_driver(int argc,char **argv) {
+  const char *driver=genioc_argv_get_string(argc,argv,"--video-driver",0);
+  if (!driver) {
+    if (genioc_init_x11(argc,argv)>=0) return 0;
+    if (genioc_init_drmfb(argc,argv)>=0) return 0;
+    if (genioc_init_drmgx(argc,argv)>=0) return 0;
+    if (genioc_init_bcm(argc,argv)>=0) return 0;
+  } else if (!strcmp(driver,"x11")) {
+    if (genioc_init_x11(argc,argv)>=0) return 0;
+  } else if (!strcmp(driver,"drmfb")) {
+    if (genioc_init_drmfb(argc,argv)>=0) return 0;
+  } else if (!strcmp(driver,"drmgx")) {
+    if (genioc_init_drmgx(argc,argv)>=0) return 0;
+  } else if (!strcmp(driver,"bcm")) {
+    if (genioc_init_bcm(argc,argv)>=0) return 0;
+  } else if (!strcmp(driver,"null")||!strcmp(driver,"hash")||!strcmp(driver,"png")) {
+    if (genioc_init_fbsink(argc,argv,driver)>=0) return 0;
+  } else {
+    fprintf(stderr,"Unknown video driver '%s'. Expected x11, drmfb, drmgx, bcm, null, hash, or png.\n",driver);
+    return -1;
+  }
   
   fprintf(stderr,"Unable to initialize any video driver.\n");
   return -1;
 }
 
-/* Init audio driver.
+/* Init upsampler, if the user asked for a synth rate below the driver's.
  */
  
-static int genioc_init_audio_driver(int argc,char **argv) {
+static void genioc_init_upsample(int argc,char **argv,int driver_rate) {
+  #if PO_USE_upsample
+    int synth_rate=genioc_argv_get_int(argc,argv,"--synth-rate",0);
+    if ((synth_rate<=0)||(synth_rate>=driver_rate)) return;
+    if (!(genioc.upsample=upsample_new(synth_rate,driver_rate,genioc_cb_upsample,0))) {
+      fprintf(stderr,"Failed to initialize upsampler. Synthesizer will run at %d Hz.\n",driver_rate);
+      return;
+    }
+    fprintf(stderr,"Synthesizer running at %d Hz, upsampling to %d.\n",synth_rate,driver_rate);
+  #endif
+}
+
+/* Init audio driver.
+ */
+
+static int genioc_init_alsa(int argc,char **argv) {
   #if PO_USE_alsa
     struct alsa_delegate alsa_delegate={
       .rate=genioc_argv_get_int(argc,argv,"--audio-rate",22050),
       .chanc=genioc_argv_get_int(argc,argv,"--audio-chanc",1),
       .device=genioc_argv_get_string(argc,argv,"--audio-device",0),
+      .period=genioc_argv_get_int(argc,argv,"--audio-period",0),
+      .periodc=genioc_argv_get_int(argc,argv,"--audio-periods",0),
+      .no_mmap=!genioc_argv_get_int(argc,argv,"--audio-mmap",1),
+      .rtprio=genioc_argv_get_int(argc,argv,"--audio-rtprio",0),
+      .cpu=genioc_argv_get_int(argc,argv,"--audio-cpu",-1)+1,
       .cb_pcm_out=genioc_cb_alsa,
     };
     if (genioc.alsa=alsa_new(&alsa_delegate)) {
-      fprintf(stderr,"Using ALSA for audio. rate=%d chanc=%d\n",alsa_get_rate(genioc.alsa),alsa_get_chanc(genioc.alsa));
+      int rate=alsa_get_rate(genioc.alsa);
+      int buffer_size=alsa_get_buffer_size(genioc.alsa);
+      fprintf(stderr,
+        "Using ALSA for audio. rate=%d chanc=%d period=%d buffer=%d latency=%.1f ms access=%s\n",
+        rate,alsa_get_chanc(genioc.alsa),alsa_get_period(genioc.alsa),buffer_size,
+        (rate>0)?(buffer_size*1000.0)/rate:0.0,alsa_get_mmap(genioc.alsa)?"mmap":"rw"
+      );
+      genioc_init_upsample(argc,argv,alsa_get_rate(genioc.alsa));
       return 0;
     }
   #endif
+  return -1;
+}
+
+static int genioc_init_pcmsink(int argc,char **argv,const char *path) {
+  #if PO_USE_pcmsink
+    struct pcmsink_delegate pcmsink_delegate={
+      .rate=genioc_argv_get_int(argc,argv,"--audio-rate",22050),
+      .chanc=genioc_argv_get_int(argc,argv,"--audio-chanc",1),
+      .period=genioc_argv_get_int(argc,argv,"--audio-period",0),
+      .path=path,
+      .manual=!genioc_argv_get_int(argc,argv,"--frame-rate",60),
+      .cb_pcm_out=genioc_cb_pcmsink,
+    };
+    if (genioc.pcmsink=pcmsink_new(&pcmsink_delegate)) {
+      genioc.audio_manual=pcmsink_delegate.manual;
+      fprintf(stderr,
+        "Using %s%s for audio. rate=%d chanc=%d period=%d%s\n",
+        path?"WAV file ":"null driver",path?path:"",
+        pcmsink_get_rate(genioc.pcmsink),pcmsink_get_chanc(genioc.pcmsink),pcmsink_get_period(genioc.pcmsink),
+        genioc.audio_manual?", driven by updates":""
+      );
+      genioc_init_upsample(argc,argv,pcmsink_get_rate(genioc.pcmsink));
+      return 0;
+    }
+  #endif
+  return -1;
+}
+ 
+static int genioc_init_audio_driver(int argc,char **argv) {
+  const char *driver=genioc_argv_get_string(argc,argv,"--audio-driver",0);
+  if (!driver) {
+    if (genioc_init_alsa(argc,argv)>=0) return 0;
+    if (genioc_init_pcmsink(argc,argv,0)>=0) return 0;
+  } else if (!strcmp(driver,"alsa")) {
+    if (genioc_init_alsa(argc,argv)>=0) return 0;
+  } else if (!strcmp(driver,"null")) {
+    if (genioc_init_pcmsink(argc,argv,0)>=0) return 0;
+  } else if (!strcmp(driver,"file")) {
+    const char *path=genioc_argv_get_string(argc,argv,"--audio-file",0);
+    if (!path||!path[0]) {
+      fprintf(stderr,"--audio-driver=file requires --audio-file=PATH\n");
+      return -1;
+    }
+    if (genioc_init_pcmsink(argc,argv,path)>=0) return 0;
+  } else {
+    fprintf(stderr,"Unknown audio driver '%s'. Expected alsa, null, or file.\n",driver);
+    return -1;
+  }
   
   fprintf(stderr,"Unable to initialize any audio driver.\n");
   return -1;
@@ -238,12 +433,25 @@ static int genioc_init_drivers(int argc,char **argv) {
 
   signal(SIGINT,genioc_rcvsig);
 
+  if (genioc_argv_get_boolean(argc,argv,"--mlock")) {
+    if (mlockall(MCL_CURRENT|MCL_FUTURE)<0) {
+      fprintf(stderr,"mlockall: %m. Proceeding with unlocked memory.\n");
+    }
+  }
+
   if (genioc_init_video_driver(argc,argv)<0) return -1;
+  genioc.video_full=!genioc_argv_get_int(argc,argv,"--video-damage",1);
   if (genioc_init_audio_driver(argc,argv)<0) return -1;
+  if (genioc_loopback_init(genioc_argv_get_int(argc,argv,"--calibrate-loopback",-1))<0) return -1;
+  if (genioc_script_init(genioc_argv_get_string(argc,argv,"--input-script",0))<0) return -1;
   
   #if PO_USE_evdev
     if (!(genioc.evdev=po_evdev_new(genioc_cb_evdev,&genioc))) {
       fprintf(stderr,"Failed to initialize evdev. Proceeding without joystick support.\n");
+    } else if (genioc_argv_get_int(argc,argv,"--input-thread",1)) {
+      if (po_evdev_start_thread(genioc.evdev)<0) {
+        fprintf(stderr,"Failed to start input thread. Polling joysticks once per frame.\n");
+      }
     }
   #endif
   
@@ -256,9 +464,15 @@ static int genioc_init_drivers(int argc,char **argv) {
 uint8_t platform_init(int32_t *audio_rate) {
 
   if (0) ;
+  #if PO_USE_upsample
+    else if (genioc.upsample) *audio_rate=upsample_get_srcrate(genioc.upsample);
+  #endif
   #if PO_USE_alsa
     else if (genioc.alsa) *audio_rate=alsa_get_rate(genioc.alsa);
   #endif
+  #if PO_USE_pcmsink
+    else if (genioc.pcmsink) *audio_rate=pcmsink_get_rate(genioc.pcmsink);
+  #endif
   else *audio_rate=0;
   
   return 1;
@@ -268,6 +482,10 @@ uint8_t platform_init(int32_t *audio_rate) {
  */
  
 uint8_t platform_update() {
+  genioc.inputeventc=0;
+  genioc.inputeventp=0;
+  genioc_loopback_update();
+  genioc_script_update();
   #if PO_USE_x11
     if (genioc.x11) {
       po_x11_update(genioc.x11);
@@ -281,30 +499,102 @@ uint8_t platform_update() {
   return genioc.inputstate;
 }
 
+int platform_next_input_event(struct platform_input_event *dst) {
+  if (genioc.inputeventp>=genioc.inputeventc) return 0;
+  *dst=genioc.inputeventv[genioc.inputeventp++];
+  return 1;
+}
+
 /* Receive framebuffer.
- * We run the whole client update inside an audio lock.
- * There's reasons for that, don't worry about it.
- * But the video swap might block, and that could be a problem.
- * So we'll only record the framebuffer address when client sends it, and commit once the audio is unlocked.
+ * We only record the framebuffer address when client sends it, and commit after the client update returns.
+ * (That used to be because the update ran inside an audio lock. It doesn't anymore; the game talks to the synth through its command queue.)
  * This introduces a danger that changes to the framebuffer after platform_send_framebuffer() would be sent early.
  * Pretty safe to assume that the app is not doing that, that its platform_send_framebuffer() is the very end of the cycle.
  */
  
 void platform_send_framebuffer(const void *fb) {
+  struct image_rect all={0,0,GENIOC_FBW,GENIOC_FBH};
+  platform_send_framebuffer_damaged(fb,&all,1);
+}
+
+void platform_send_framebuffer_damaged(const void *fb,const struct image_rect *rectv,int rectc) {
   genioc.fbtmp=fb;
+  // We may get several sends per presented frame, so keep the union.
+  struct image_rect *d=&genioc.fbdamage;
+  for (;rectc-->0;rectv++) {
+    if ((rectv->w<1)||(rectv->h<1)) continue;
+    if (d->w<1) {
+      *d=*rectv;
+      continue;
+    }
+    int16_t r=d->x+d->w,b=d->y+d->h;
+    if (rectv->x+rectv->w>r) r=rectv->x+rectv->w;
+    if (rectv->y+rectv->h>b) b=rectv->y+rectv->h;
+    if (rectv->x<d->x) d->x=rectv->x;
+    if (rectv->y<d->y) d->y=rectv->y;
+    d->w=r-d->x;
+    d->h=b-d->y;
+  }
+}
+
+/* Find what actually changed: The game redraws everything each frame, so damage alone is usually the whole screen.
+ * Within the damage, compare against what we last presented and return spans of changed rows,
+ * each with the horizontal bounds of its changes. Copies those into (fbprev) as we go.
+ */
+
+static int genioc_diff_framebuffer(struct image_rect *dstv,int dsta,const uint16_t *fb) {
+  struct image_rect d=genioc.fbdamage;
+  genioc.fbdamage.w=0;
+  if ((d.x<0)||(d.y<0)||(d.x+d.w>GENIOC_FBW)||(d.y+d.h>GENIOC_FBH)) d=(struct image_rect){0,0,GENIOC_FBW,GENIOC_FBH};
+  if (!genioc.fbprev_valid||genioc.video_full) {
+    memcpy(genioc.fbprev,fb,sizeof(genioc.fbprev));
+    genioc.fbprev_valid=1;
+    dstv[0]=(struct image_rect){0,0,GENIOC_FBW,GENIOC_FBH};
+    return 1;
+  }
+  if ((d.w<1)||(d.h<1)) return 0;
+  int dstc=0;
+  struct image_rect *run=0; // open span, if the previous row changed
+  int y=d.y,yz=d.y+d.h;
+  for (;y<yz;y++) {
+    const uint16_t *src=fb+y*GENIOC_FBW;
+    uint16_t *prev=genioc.fbprev+y*GENIOC_FBW;
+    int l=d.x,r=d.x+d.w;
+    while ((l<r)&&(src[l]==prev[l])) l++;
+    if (l>=r) {
+      run=0;
+      continue;
+    }
+    while (src[r-1]==prev[r-1]) r--;
+    memcpy(prev+l,src+l,(r-l)*2);
+    if (!run) {
+      if (dstc<dsta) {
+        run=dstv+dstc++;
+        *run=(struct image_rect){l,y,r-l,1};
+      } else { // out of spans; stretch the last one down to here
+        run=dstv+dsta-1;
+      }
+    }
+    if (l<run->x) { run->w+=run->x-l; run->x=l; }
+    if (r>run->x+run->w) run->w=r-run->x;
+    run->h=y+1-run->y;
+  }
+  return dstc;
 }
 
 static void genioc_finish_video_frame() {
   if (!genioc.fbtmp) return;
+  struct image_rect rectv[GENIOC_DAMAGE_LIMIT];
+  int rectc=genioc_diff_framebuffer(rectv,GENIOC_DAMAGE_LIMIT,genioc.fbtmp);
   #if PO_USE_x11
     if (genioc.x11) {
-      po_x11_swap(genioc.x11,genioc.fbtmp);
+      po_x11_swap_damaged(genioc.x11,genioc.fbtmp,rectv,rectc);
       return;
     }
   #endif
   #if PO_USE_drmfb
     if (genioc.drmfb) {
-      drmfb_swap(genioc.drmfb,genioc.fbtmp);
+      drmfb_swap_damaged(genioc.drmfb,genioc.fbtmp,rectv,rectc);
       return;
     }
   #endif
@@ -320,6 +610,12 @@ static void genioc_finish_video_frame() {
       return;
     }
   #endif
+  #if PO_USE_fbsink
+    if (genioc.fbsink) {
+      if (fbsink_swap(genioc.fbsink,genioc.fbtmp,rectc)<0) genioc.terminate=1;
+      return;
+    }
+  #endif
 }
 
 /* USB stub.
@@ -360,10 +656,62 @@ int usb_read_byte() {
  */
 
 int audio_estimate_buffered_frame_count() {
+  int framec=0;
   #if PO_USE_alsa
-    if (genioc.alsa) return alsa_estimate_buffered_frame_count(genioc.alsa);
+    if (genioc.alsa) framec=alsa_estimate_buffered_frame_count(genioc.alsa);
   #endif
-  return 0;
+  #if PO_USE_pcmsink
+    if (genioc.pcmsink) framec=pcmsink_estimate_buffered_frame_count(genioc.pcmsink);
+  #endif
+  // Driver reports at its own rate, and the game wants synthesizer frames.
+  #if PO_USE_upsample
+    if (genioc.upsample) {
+      framec=((int64_t)framec*upsample_get_srcrate(genioc.upsample))/upsample_get_dstrate(genioc.upsample);
+      framec+=UPSAMPLE_LATENCY;
+    }
+  #endif
+  return framec;
+}
+
+/* Audio frame for a given time.
+ * The driver tells us which of its frames was audible at that moment.
+ * A frame we render now won't be audible until the whole buffer ahead of it drains, so a note for time (t)
+ * goes at (audible(t)+buffer), which is usually still in the future from the synth's point of view.
+ */
+
+static uint64_t genioc_audio_frame_at(int64_t time_us,int include_buffer) {
+  if (!time_us) return 0;
+  double t=time_us/1000000.0;
+  int64_t frame=0;
+  #if PO_USE_alsa
+    if (genioc.alsa) {
+      frame=alsa_get_audible_frame_at(genioc.alsa,t);
+      if (include_buffer) frame+=alsa_get_buffer_size(genioc.alsa);
+    }
+  #endif
+  #if PO_USE_pcmsink
+    if (genioc.pcmsink) {
+      frame=pcmsink_get_audible_frame_at(genioc.pcmsink,t);
+      if (include_buffer) frame+=pcmsink_get_period(genioc.pcmsink);
+    }
+  #endif
+  frame-=__atomic_load_n(&genioc.audio_unrendered,__ATOMIC_RELAXED);
+  #if PO_USE_upsample
+    if (genioc.upsample) {
+      frame=(frame*upsample_get_srcrate(genioc.upsample))/upsample_get_dstrate(genioc.upsample);
+      frame-=UPSAMPLE_LATENCY;
+    }
+  #endif
+  if (frame<=0) return 0;
+  return frame;
+}
+
+uint64_t audio_frame_for_time(int64_t time_us) {
+  return genioc_audio_frame_at(time_us,1);
+}
+
+uint64_t audio_audible_frame_for_time(int64_t time_us) {
+  return genioc_audio_frame_at(time_us,0);
 }
 
 /* XXX print my generated waves for verification
@@ -401,6 +749,99 @@ static void XXX_tempmain() {
   free(image);
 }
 
+/* Video statistics, at exit.
+ */
+
+static void genioc_report_video() {
+  #if PO_USE_fbsink
+    if (genioc.fbsink) {
+      struct fbsink_stats stats;
+      fbsink_get_stats(&stats,genioc.fbsink);
+      if (stats.framec<1) return;
+      fprintf(stderr,
+        "Video %s: %d frames (%d changed), %.01f kB written, swap avg %.03f ms, max %.03f ms%s\n",
+        fbsink_mode_name(fbsink_get_mode(genioc.fbsink)),stats.framec,stats.changec,stats.bytes/1024.0,
+        (stats.swaptime*1000.0)/stats.framec,stats.maxtime*1000.0,
+        fbsink_get_status(genioc.fbsink)?", FAILED":""
+      );
+      if (fbsink_get_mode(genioc.fbsink)==FBSINK_MODE_HASH) {
+        int i;
+        fprintf(stderr,"Sequence MD5: ");
+        for (i=0;i<16;i++) fprintf(stderr,"%02x",stats.digest[i]);
+        fprintf(stderr,", last frame MD5: ");
+        for (i=0;i<16;i++) fprintf(stderr,"%02x",stats.last[i]);
+        fprintf(stderr,"\n");
+      }
+      return;
+    }
+  #endif
+  #if PO_USE_x11
+    if (!genioc.x11) return;
+    struct po_x11_stats stats;
+    po_x11_get_stats(&stats,genioc.x11);
+    if (stats.swapc<1) return;
+    fprintf(stderr,
+      "X11 %s: %d swaps (%d idle), %.0f px/swap, %.01f kB/swap, convert avg %.03f ms, put avg %.03f ms, wait avg %.03f ms, swap max %.03f ms\n",
+      stats.shm?"MIT-SHM":"XPutImage",stats.swapc,stats.idlec,(double)stats.pixelc/stats.swapc,stats.bytes/(stats.swapc*1024.0),
+      (stats.convtime*1000.0)/stats.swapc,(stats.puttime*1000.0)/stats.swapc,(stats.waittime*1000.0)/stats.swapc,
+      stats.maxtime*1000.0
+    );
+  #endif
+}
+
+/* Audio statistics, at exit.
+ */
+
+static void genioc_report_audio() {
+  #if PO_USE_pcmsink
+    if (genioc.pcmsink) {
+      struct pcmsink_stats stats;
+      pcmsink_get_stats(&stats,genioc.pcmsink);
+      if (stats.callbackc<1) return;
+      fprintf(stderr,
+        "%d audio callbacks, %d late, callback min/avg/max %.03f/%.03f/%.03f ms, audio thread CPU %.03fs in %.03fs (%.2f%%)%s\n",
+        stats.callbackc,stats.latec,
+        stats.cbmin*1000.0,(stats.cbtotal*1000.0)/stats.callbackc,stats.cbmax*1000.0,
+        stats.cputime,stats.walltime,(stats.walltime>0.0)?(stats.cputime*100.0)/stats.walltime:0.0,
+        pcmsink_get_status(genioc.pcmsink)?", FAILED":""
+      );
+      return;
+    }
+  #endif
+  #if PO_USE_alsa
+    if (!genioc.alsa) return;
+    struct alsa_stats stats;
+    alsa_get_stats(&stats,genioc.alsa);
+    if (stats.callbackc<1) return;
+    fprintf(stderr,
+      "%d audio callbacks, %d xruns, callback min/avg/max %.03f/%.03f/%.03f ms",
+      stats.callbackc,stats.xrunc,
+      stats.cbmin*1000.0,(stats.cbtotal*1000.0)/stats.callbackc,stats.cbmax*1000.0
+    );
+    if (stats.callbackc>1) {
+      fprintf(stderr,", interval min/avg/max %.03f/%.03f/%.03f ms",
+        stats.intervalmin*1000.0,(stats.intervaltotal*1000.0)/(stats.callbackc-1),stats.intervalmax*1000.0
+      );
+    }
+    fprintf(stderr,"%s\n",alsa_get_status(genioc.alsa)?", FAILED":"");
+  #endif
+}
+
+/* With --frame-rate=0 and pcmsink, audio doesn't run on its own clock: Produce each update's share before the update.
+ * Counting from the start each time, so 22050 Hz alternates 367 and 368 frames and never drifts.
+ */
+
+#define GENIOC_MANUAL_HZ 60
+
+static void genioc_update_audio(int updatec) {
+  #if PO_USE_pcmsink
+    if (!genioc.audio_manual) return;
+    int64_t rate=pcmsink_get_rate(genioc.pcmsink);
+    int framec=(int)(((updatec+1)*rate)/GENIOC_MANUAL_HZ-(updatec*rate)/GENIOC_MANUAL_HZ);
+    pcmsink_update(genioc.pcmsink,framec);
+  #endif
+}
+
 /* Main.
  */
 
@@ -417,45 +858,44 @@ int main(int argc,char **argv) {
   }
   
   setup();
+  __atomic_store_n(&genioc.audio_ready,1,__ATOMIC_RELEASE);
   
-  int framec=0;
-  const int64_t frametime=1000000/60;
-  int64_t nexttime=now_us();
-  int64_t starttime=nexttime;
+  struct pacer pacer;
+  pacer_init(&pacer,genioc_argv_get_int(argc,argv,"--frame-rate",60),genioc_argv_get_int(argc,argv,"--frame-spin",0));
+  int framelimit=genioc_argv_get_int(argc,argv,"--frame-limit",0);
+  int updatec=0;
   while (!genioc.terminate&&!genioc.sigc) {
-  
-    int64_t now=now_us();
-    while (now<nexttime) {
-      int64_t sleeptime=nexttime-now;
-      if (sleeptime>100000) {
-        nexttime=now;
-        break;
-      }
-      if (sleeptime>0) sleep_us(sleeptime);
-      now=now_us();
-    }
-    nexttime+=frametime;
-    framec++;
-    
-    #if PO_USE_alsa
-      if (alsa_lock(genioc.alsa)<0) {
-        fprintf(stderr,"ERROR! Failed to acquire ALSA lock.\n");
-        return 1;
-      }
-    #endif
-    loop();
-    #if PO_USE_alsa
-      alsa_unlock(genioc.alsa);
-    #endif
+    if ((framelimit>0)&&(pacer.framec>=framelimit)) break;
+    int tickc=pacer_wait(&pacer);
+    // Updates stay at --frame-rate no matter what; if presenting is slow, we present less often.
+    while (tickc-->0) {
+      genioc_update_audio(updatec);
+      loop();
+      updatec++;
+      if (genioc.terminate) break;
+    }
     genioc_finish_video_frame();
   }
   
-  if (framec>0) {
-    double elapsed=(nexttime-starttime)/1000000.0;
-    fprintf(stderr,"%d video frames in %.03fs, average %.03f Hz\n",framec,elapsed,framec/elapsed);
+  if (pacer.framec>0) {
+    double elapsed=pacer_get_elapsed(&pacer);
+    fprintf(stderr,
+      "%d video frames, %d updates in %.03fs, average %.03f Hz. Frame time p50 %.02f ms, p99 %.02f ms, max %.02f ms.\n",
+      pacer.framec,updatec,elapsed,(elapsed>0.0)?(pacer.framec/elapsed):0.0,
+      pacer_get_percentile(&pacer,0.5)*1000.0,pacer_get_percentile(&pacer,0.99)*1000.0,pacer_get_percentile(&pacer,1.0)*1000.0
+    );
+    if (pacer.missc) fprintf(stderr,"Missed %d frame deadlines, and dropped %d updates.\n",pacer.missc,pacer.dropc);
   }
+  genioc_report_video();
+  genioc_report_audio();
   
+  // Headless runs are usually scripted, so a video sink that couldn't write is a failure.
+  int status=0;
+  #if PO_USE_fbsink
+    if (genioc.fbsink&&fbsink_get_status(genioc.fbsink)) status=1;
+  #endif
   genioc_quit_drivers();
-  fprintf(stderr,"Normal exit.\n");
-  return 0;
+  if (status) fprintf(stderr,"Exit with video errors.\n");
+  else fprintf(stderr,"Normal exit.\n");
+  return status;
 }
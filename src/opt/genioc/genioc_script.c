@@ -0,0 +1,80 @@
+/* genioc_script.c
+ * Scripted input for headless runs: --input-script=UPDATE=BUTTONS,...
+ * At update UPDATE (counting from zero), the held buttons become exactly BUTTONS, any of "udlrab", or empty for none.
+ * Steps must be in order. eg "30=a,34=" taps A on the menu, which starts the first song.
+ * Keyed to updates rather than time, so with --frame-rate=0 the whole run is reproducible.
+ */
+
+#include "genioc_internal.h"
+
+#define SCRIPT_STEP_LIMIT 64
+
+static struct {
+  struct script_step {
+    int updatep;
+    uint8_t state;
+  } stepv[SCRIPT_STEP_LIMIT];
+  int stepc,stepp;
+  int updatec;
+} script={0};
+
+/* Parse one step "UPDATE=BUTTONS", up to the comma or end. Returns length consumed, or <0.
+ */
+
+static int genioc_script_parse_step(struct script_step *step,const char *src) {
+  int srcp=0;
+  if ((src[srcp]<'0')||(src[srcp]>'9')) return -1;
+  for (step->updatep=0;(src[srcp]>='0')&&(src[srcp]<='9');srcp++) {
+    if (step->updatep>INT_MAX/10-1) return -1;
+    step->updatep=step->updatep*10+(src[srcp]-'0');
+  }
+  if (src[srcp++]!='=') return -1;
+  for (step->state=0;src[srcp]&&(src[srcp]!=',');srcp++) switch (src[srcp]) {
+    case 'u': step->state|=BUTTON_UP; break;
+    case 'd': step->state|=BUTTON_DOWN; break;
+    case 'l': step->state|=BUTTON_LEFT; break;
+    case 'r': step->state|=BUTTON_RIGHT; break;
+    case 'a': step->state|=BUTTON_A; break;
+    case 'b': step->state|=BUTTON_B; break;
+    default: return -1;
+  }
+  return srcp;
+}
+
+/* Init.
+ */
+
+int genioc_script_init(const char *src) {
+  if (!src) return 0;
+  int srcp=0;
+  while (src[srcp]) {
+    if (script.stepc>=SCRIPT_STEP_LIMIT) {
+      fprintf(stderr,"--input-script: Too many steps, limit %d.\n",SCRIPT_STEP_LIMIT);
+      return -1;
+    }
+    struct script_step *step=script.stepv+script.stepc;
+    int err=genioc_script_parse_step(step,src+srcp);
+    if ((err<0)||(script.stepc&&(step->updatep<=step[-1].updatep))) {
+      fprintf(stderr,"--input-script: Malformed step at position %d of '%s'. Expected eg '30=a,34='.\n",srcp,src);
+      return -1;
+    }
+    srcp+=err;
+    if (src[srcp]==',') srcp++;
+    script.stepc++;
+  }
+  return 0;
+}
+
+/* Update.
+ */
+
+void genioc_script_update() {
+  while ((script.stepp<script.stepc)&&(script.stepv[script.stepp].updatep<=script.updatec)) {
+    uint8_t state=script.stepv[script.stepp++].state;
+    uint8_t btnid=0x80;
+    for (;btnid;btnid>>=1) {
+      if ((state&btnid)!=(genioc.inputstate&btnid)) genioc_set_input(btnid,state&btnid,0);
+    }
+  }
+  script.updatec++;
+}
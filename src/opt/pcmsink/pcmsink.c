@@ -0,0 +1,303 @@
+#include "pcmsink.h"
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <limits.h>
+#include <pthread.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#define PCMSINK_PERIOD_DEFAULT 256
+#define PCMSINK_MANUAL_EPOCH 1000000000ll /* ns. Manual mode's clock starts here, not zero, since zero means "unknown" to some callers. */
+
+static int64_t pcmsink_now_ns(clockid_t clockid) {
+  struct timespec tv={0};
+  clock_gettime(clockid,&tv);
+  return (int64_t)tv.tv_sec*1000000000ll+tv.tv_nsec;
+}
+
+/* Object definition.
+ */
+
+struct pcmsink {
+  struct pcmsink_delegate delegate;
+  int refc;
+
+  FILE *f;
+  int seekable; // regular file; we fix the WAV header's lengths when closing
+  int16_t *buf;
+  int bufc; // frames, one period
+  int bufc_samples;
+
+  pthread_t iothd;
+  volatile int ioabort;
+  volatile int ioerror;
+
+  // Guarded by (statsmtx):
+  pthread_mutex_t statsmtx;
+  int statsmtx_ok; // init may fail before creating it
+  int64_t starttime; // ns, on our clock: CLOCK_MONOTONIC, or PCMSINK_MANUAL_EPOCH
+  int64_t realstart; // ns, CLOCK_MONOTONIC
+  int64_t produced; // frames
+  struct pcmsink_stats stats;
+};
+
+/* WAV header. Lengths are 0xffffffff while streaming, which most readers take as "until EOF".
+ */
+
+static void pcmsink_wav_header(uint8_t *dst,const struct pcmsink *pcmsink,uint32_t datac) {
+  uint32_t riffc=(datac==0xffffffff)?datac:datac+36;
+  uint32_t byterate=pcmsink->delegate.rate*pcmsink->delegate.chanc*2;
+  #define U32(p,v) { dst[p]=(v); dst[p+1]=(v)>>8; dst[p+2]=(v)>>16; dst[p+3]=(v)>>24; }
+  #define U16(p,v) { dst[p]=(v); dst[p+1]=(v)>>8; }
+  memcpy(dst,"RIFF",4);
+  U32(4,riffc)
+  memcpy(dst+8,"WAVEfmt ",8);
+  U32(16,16)
+  U16(20,1) // PCM
+  U16(22,pcmsink->delegate.chanc)
+  U32(24,pcmsink->delegate.rate)
+  U32(28,byterate)
+  U16(32,pcmsink->delegate.chanc*2)
+  U16(34,16)
+  memcpy(dst+36,"data",4);
+  U32(40,datac)
+  #undef U32
+  #undef U16
+}
+
+/* Delete.
+ */
+
+void pcmsink_del(struct pcmsink *pcmsink) {
+  if (!pcmsink) return;
+  if (pcmsink->refc-->1) return;
+
+  if (pcmsink->iothd) {
+    pcmsink->ioabort=1;
+    pthread_join(pcmsink->iothd,0);
+  }
+  if (pcmsink->f) {
+    if (pcmsink->seekable) {
+      int64_t datac=pcmsink->produced*pcmsink->delegate.chanc*2;
+      if (datac>0xfffffff0ll) datac=0xfffffff0ll;
+      uint8_t hdr[44];
+      pcmsink_wav_header(hdr,pcmsink,datac);
+      if (!fseek(pcmsink->f,0,SEEK_SET)) fwrite(hdr,1,sizeof(hdr),pcmsink->f);
+    }
+    fclose(pcmsink->f);
+  }
+  if (pcmsink->statsmtx_ok) pthread_mutex_destroy(&pcmsink->statsmtx);
+  if (pcmsink->buf) free(pcmsink->buf);
+
+  free(pcmsink);
+}
+
+/* Retain.
+ */
+
+int pcmsink_ref(struct pcmsink *pcmsink) {
+  if (!pcmsink) return -1;
+  if (pcmsink->refc<1) return -1;
+  if (pcmsink->refc==INT_MAX) return -1;
+  pcmsink->refc++;
+  return 0;
+}
+
+/* Call back for (framec) frames, write them, and count them.
+ * (late) if this was due a whole period ago.
+ */
+
+static int pcmsink_produce(struct pcmsink *pcmsink,int framec,int late) {
+  int samplec=framec*pcmsink->delegate.chanc;
+  int64_t start=pcmsink_now_ns(CLOCK_MONOTONIC);
+  pcmsink->delegate.cb_pcm_out(pcmsink->buf,samplec,pcmsink);
+  int64_t end=pcmsink_now_ns(CLOCK_MONOTONIC);
+  if (pcmsink->f&&(fwrite(pcmsink->buf,2,samplec,pcmsink->f)!=samplec)) {
+    fprintf(stderr,"%s: Error writing audio. Stopping.\n",pcmsink->delegate.path);
+    pcmsink->ioerror=1;
+    return -1;
+  }
+  if (!pthread_mutex_lock(&pcmsink->statsmtx)) {
+    struct pcmsink_stats *stats=&pcmsink->stats;
+    double duration=(end-start)/1000000000.0;
+    if (!stats->callbackc||(duration<stats->cbmin)) stats->cbmin=duration;
+    if (duration>stats->cbmax) stats->cbmax=duration;
+    stats->cbtotal+=duration;
+    stats->callbackc++;
+    if (late) stats->latec++;
+    if (pcmsink->delegate.manual) stats->cputime=stats->cbtotal;
+    else stats->cputime=pcmsink_now_ns(CLOCK_THREAD_CPUTIME_ID)/1000000000.0;
+    pcmsink->produced+=framec;
+    pthread_mutex_unlock(&pcmsink->statsmtx);
+  }
+  return 0;
+}
+
+/* I/O thread.
+ * Period (n) is produced at (starttime+n*period/rate), one period ahead of its playback.
+ * Deadlines are absolute, so scheduling error doesn't accumulate.
+ * If we fall behind, we catch up without sleeping rather than let the clock drift.
+ */
+
+static void *pcmsink_iothd(void *arg) {
+  struct pcmsink *pcmsink=arg;
+  int64_t periodc=0;
+  while (!pcmsink->ioabort) {
+    periodc++;
+    int64_t deadline=pcmsink->starttime+(periodc*pcmsink->bufc*1000000000ll)/pcmsink->delegate.rate;
+    int late=(pcmsink_now_ns(CLOCK_MONOTONIC)-deadline>=0); // this one was due a period ago
+    if (pcmsink_produce(pcmsink,pcmsink->bufc,late)<0) return 0;
+    struct timespec ts={
+      .tv_sec=deadline/1000000000ll,
+      .tv_nsec=deadline%1000000000ll,
+    };
+    while (clock_nanosleep(CLOCK_MONOTONIC,TIMER_ABSTIME,&ts,0)) {
+      if (pcmsink->ioabort) return 0;
+    }
+  }
+  return 0;
+}
+
+/* Manual update.
+ */
+
+int pcmsink_update(struct pcmsink *pcmsink,int framec) {
+  if (!pcmsink||!pcmsink->delegate.manual) return -1;
+  if (pcmsink->ioerror) return -1;
+  while (framec>0) {
+    int c=(framec<pcmsink->bufc)?framec:pcmsink->bufc;
+    if (pcmsink_produce(pcmsink,c,0)<0) return -1;
+    framec-=c;
+  }
+  return 0;
+}
+
+/* Init.
+ */
+
+static int pcmsink_init(struct pcmsink *pcmsink) {
+  if ((pcmsink->delegate.rate<1)||(pcmsink->delegate.chanc<1)) return -1;
+  if (pcmsink->delegate.period<1) pcmsink->delegate.period=PCMSINK_PERIOD_DEFAULT;
+  pcmsink->bufc=pcmsink->delegate.period;
+  pcmsink->bufc_samples=pcmsink->bufc*pcmsink->delegate.chanc;
+  if (!(pcmsink->buf=malloc(pcmsink->bufc_samples*2))) return -1;
+
+  if (pcmsink->delegate.path) {
+    if (!(pcmsink->f=fopen(pcmsink->delegate.path,"wb"))) {
+      fprintf(stderr,"%s: Failed to open for writing: %m\n",pcmsink->delegate.path);
+      return -1;
+    }
+    struct stat st;
+    if (!fstat(fileno(pcmsink->f),&st)&&S_ISREG(st.st_mode)) pcmsink->seekable=1;
+    uint8_t hdr[44];
+    pcmsink_wav_header(hdr,pcmsink,0xffffffff);
+    if (fwrite(hdr,1,sizeof(hdr),pcmsink->f)!=sizeof(hdr)) return -1;
+  }
+
+  if (pthread_mutex_init(&pcmsink->statsmtx,0)) return -1;
+  pcmsink->statsmtx_ok=1;
+  pcmsink->realstart=pcmsink_now_ns(CLOCK_MONOTONIC);
+  if (pcmsink->delegate.manual) {
+    pcmsink->starttime=PCMSINK_MANUAL_EPOCH;
+    return 0;
+  }
+  pcmsink->starttime=pcmsink->realstart;
+  if (pthread_create(&pcmsink->iothd,0,pcmsink_iothd,pcmsink)) return -1;
+  return 0;
+}
+
+/* New.
+ */
+
+struct pcmsink *pcmsink_new(const struct pcmsink_delegate *delegate) {
+  if (!delegate||!delegate->cb_pcm_out) return 0;
+
+  struct pcmsink *pcmsink=calloc(1,sizeof(struct pcmsink));
+  if (!pcmsink) return 0;
+
+  pcmsink->refc=1;
+  memcpy(&pcmsink->delegate,delegate,sizeof(struct pcmsink_delegate));
+
+  if (pcmsink_init(pcmsink)<0) {
+    pcmsink_del(pcmsink);
+    return 0;
+  }
+
+  return pcmsink;
+}
+
+/* Trivial accessors.
+ */
+
+int pcmsink_get_rate(const struct pcmsink *pcmsink) {
+  if (!pcmsink) return 0;
+  return pcmsink->delegate.rate;
+}
+
+int pcmsink_get_chanc(const struct pcmsink *pcmsink) {
+  if (!pcmsink) return 0;
+  return pcmsink->delegate.chanc;
+}
+
+int pcmsink_get_period(const struct pcmsink *pcmsink) {
+  if (!pcmsink) return 0;
+  return pcmsink->bufc;
+}
+
+void *pcmsink_get_userdata(const struct pcmsink *pcmsink) {
+  if (!pcmsink) return 0;
+  return pcmsink->delegate.userdata;
+}
+
+int pcmsink_get_status(const struct pcmsink *pcmsink) {
+  if (!pcmsink) return -1;
+  if (pcmsink->ioerror) return -1;
+  return 0;
+}
+
+/* Buffered frames outstanding.
+ */
+
+int pcmsink_estimate_buffered_frame_count(struct pcmsink *pcmsink) {
+  if (!pcmsink) return 0;
+  if (pcmsink->delegate.manual) return 0;
+  if (pthread_mutex_lock(&pcmsink->statsmtx)) return 0;
+  int64_t audible=((pcmsink_now_ns(CLOCK_MONOTONIC)-pcmsink->starttime)*pcmsink->delegate.rate)/1000000000ll;
+  int64_t buffered=pcmsink->produced-audible;
+  pthread_mutex_unlock(&pcmsink->statsmtx);
+  if (buffered<=0) return 0;
+  if (buffered>INT_MAX) return INT_MAX;
+  return buffered;
+}
+
+int64_t pcmsink_get_audible_frame_at(struct pcmsink *pcmsink,double t) {
+  if (!pcmsink) return 0;
+  int64_t ns=(int64_t)(t*1000000000.0)-pcmsink->starttime;
+  if (ns<0) return 0;
+  return (ns*pcmsink->delegate.rate)/1000000000ll;
+}
+
+double pcmsink_get_frame_time(struct pcmsink *pcmsink,int64_t frame) {
+  if (!pcmsink) return 0.0;
+  return (pcmsink->starttime+(frame*1000000000ll)/pcmsink->delegate.rate)/1000000000.0;
+}
+
+double pcmsink_now(struct pcmsink *pcmsink) {
+  if (!pcmsink) return 0.0;
+  if (pcmsink->delegate.manual) return pcmsink_get_frame_time(pcmsink,pcmsink->produced);
+  return pcmsink_now_ns(CLOCK_MONOTONIC)/1000000000.0;
+}
+
+/* Statistics.
+ */
+
+void pcmsink_get_stats(struct pcmsink_stats *dst,struct pcmsink *pcmsink) {
+  memset(dst,0,sizeof(struct pcmsink_stats));
+  if (!pcmsink) return;
+  if (pthread_mutex_lock(&pcmsink->statsmtx)) return;
+  memcpy(dst,&pcmsink->stats,sizeof(struct pcmsink_stats));
+  dst->walltime=(pcmsink_now_ns(CLOCK_MONOTONIC)-pcmsink->realstart)/1000000000.0;
+  pthread_mutex_unlock(&pcmsink->statsmtx);
+}
@@ -0,0 +1,69 @@
+/* pcmsink.h
+ * Audio output without a sound card, for headless runs.
+ * A thread pulls PCM from your callback on a real-time schedule, exactly as a device would,
+ * and either discards it (null) or streams it as a WAV file (to disk or a FIFO).
+ * Same callback shape as alsa.
+ * Or in manual mode, there's no thread: You call pcmsink_update() with a frame count, and our clock is what's been produced.
+ * That makes a run reproducible no matter how fast it goes.
+ */
+
+#ifndef PCMSINK_H
+#define PCMSINK_H
+
+struct pcmsink;
+
+#include <stdint.h>
+
+struct pcmsink_delegate {
+  int rate;
+  int chanc;
+  const char *path; // WAV output, or null to discard
+  int period; // frames per callback; zero for default
+  int manual; // nonzero for no thread; see pcmsink_update()
+  void *userdata;
+  int (*cb_pcm_out)(int16_t *dst,int dsta,struct pcmsink *pcmsink);
+};
+
+void pcmsink_del(struct pcmsink *pcmsink);
+int pcmsink_ref(struct pcmsink *pcmsink);
+
+struct pcmsink *pcmsink_new(
+  const struct pcmsink_delegate *delegate
+);
+
+int pcmsink_get_rate(const struct pcmsink *pcmsink);
+int pcmsink_get_chanc(const struct pcmsink *pcmsink);
+int pcmsink_get_period(const struct pcmsink *pcmsink);
+void *pcmsink_get_userdata(const struct pcmsink *pcmsink);
+int pcmsink_get_status(const struct pcmsink *pcmsink); // => 0,-1
+
+/* Manual mode only: Produce (framec) frames now, calling back up to a period at a time.
+ */
+int pcmsink_update(struct pcmsink *pcmsink,int framec);
+
+/* We produce a period ahead of the wall clock, and "play" at exactly (rate).
+ * In manual mode, everything produced is already playing, so nothing is buffered.
+ */
+int pcmsink_estimate_buffered_frame_count(struct pcmsink *pcmsink);
+
+/* Frame "audible" at (t), seconds on our clock. Exact, since we define it.
+ * That's CLOCK_MONOTONIC, or in manual mode, a fixed epoch plus the frames produced.
+ */
+int64_t pcmsink_get_audible_frame_at(struct pcmsink *pcmsink,double t);
+double pcmsink_get_frame_time(struct pcmsink *pcmsink,int64_t frame); // inverse of that
+double pcmsink_now(struct pcmsink *pcmsink);
+
+/* Counters since start. Times are in seconds.
+ * (cputime) is the I/O thread's own CPU time, callbacks plus our overhead. In manual mode, just the callbacks.
+ * (walltime) is real, even in manual mode.
+ */
+struct pcmsink_stats {
+  int callbackc;
+  int latec; // callbacks that started a whole period behind schedule
+  double cbmin,cbmax,cbtotal;
+  double cputime;
+  double walltime;
+};
+void pcmsink_get_stats(struct pcmsink_stats *dst,struct pcmsink *pcmsink);
+
+#endif
@@ -0,0 +1,391 @@
+#include "pixcvt.h"
+#include <string.h>
+
+#if defined(__x86_64__)||defined(__i386__)
+  #define PIXCVT_X86 1
+  #include <immintrin.h>
+#endif
+#if defined(__aarch64__)||defined(__ARM_NEON)
+  #define PIXCVT_NEON 1
+  #include <arm_neon.h>
+#endif
+
+// Scaled rows are converted this many pixels at a time, into a buffer on the stack.
+#define PIXCVT_CHUNK 64
+
+static const struct pixcvt_kernel *pixcvt_kernel=0;
+
+/* Portable C, the reference.
+ */
+
+#define PIXCVT_R5(p) (((p)>>8)&0x1f)
+#define PIXCVT_G6(p) ((((p)<<3)&0x38)|((p)>>13))
+#define PIXCVT_B5(p) (((p)>>3)&0x1f)
+#define PIXCVT_8FROM5(n) (((n)<<3)|((n)>>2))
+#define PIXCVT_8FROM6(n) (((n)<<2)|((n)>>4))
+
+static void pixcvt_rgb565_c(uint16_t *dst,const uint16_t *src,int c) {
+  for (;c-->0;dst++,src++) {
+    uint16_t p=*src;
+    *dst=(PIXCVT_R5(p)<<11)|(PIXCVT_G6(p)<<5)|PIXCVT_B5(p);
+  }
+}
+
+static void pixcvt_xrgb8888_c(uint32_t *dst,const uint16_t *src,int c) {
+  for (;c-->0;dst++,src++) {
+    uint16_t p=*src;
+    *dst=(PIXCVT_8FROM5(PIXCVT_R5(p))<<16)|(PIXCVT_8FROM6(PIXCVT_G6(p))<<8)|PIXCVT_8FROM5(PIXCVT_B5(p));
+  }
+}
+
+static void pixcvt_xbgr8888_c(uint32_t *dst,const uint16_t *src,int c) {
+  for (;c-->0;dst++,src++) {
+    uint16_t p=*src;
+    *dst=(PIXCVT_8FROM5(PIXCVT_B5(p))<<16)|(PIXCVT_8FROM6(PIXCVT_G6(p))<<8)|PIXCVT_8FROM5(PIXCVT_R5(p));
+  }
+}
+
+static void pixcvt_rgb24_c(uint8_t *dst,const uint16_t *src,int c) {
+  for (;c-->0;dst+=3,src++) {
+    uint16_t p=*src;
+    dst[0]=PIXCVT_8FROM5(PIXCVT_R5(p));
+    dst[1]=PIXCVT_8FROM6(PIXCVT_G6(p));
+    dst[2]=PIXCVT_8FROM5(PIXCVT_B5(p));
+  }
+}
+
+/* Lookup tables, built when selected.
+ * 384 kB altogether. On a cabinet converting 6144 pixels a frame, most of it stays cold, so it's not always a win.
+ * XBGR shares the XRGB table and swaps channels.
+ */
+
+static uint16_t pixcvt_lut16[0x10000];
+static uint32_t pixcvt_lut32[0x10000];
+static int pixcvt_lut_ready=0;
+
+static void pixcvt_lut_init() {
+  if (pixcvt_lut_ready) return;
+  uint16_t src[256];
+  int hi=0;
+  for (;hi<0x100;hi++) {
+    int lo=0;
+    for (;lo<0x100;lo++) src[lo]=(hi<<8)|lo;
+    pixcvt_rgb565_c(pixcvt_lut16+(hi<<8),src,0x100);
+    pixcvt_xrgb8888_c(pixcvt_lut32+(hi<<8),src,0x100);
+  }
+  pixcvt_lut_ready=1;
+}
+
+static void pixcvt_rgb565_lut(uint16_t *dst,const uint16_t *src,int c) {
+  for (;c-->0;dst++,src++) *dst=pixcvt_lut16[*src];
+}
+
+static void pixcvt_xrgb8888_lut(uint32_t *dst,const uint16_t *src,int c) {
+  for (;c-->0;dst++,src++) *dst=pixcvt_lut32[*src];
+}
+
+static void pixcvt_xbgr8888_lut(uint32_t *dst,const uint16_t *src,int c) {
+  for (;c-->0;dst++,src++) {
+    uint32_t p=pixcvt_lut32[*src];
+    *dst=((p&0xff)<<16)|(p&0xff00)|(p>>16);
+  }
+}
+
+static void pixcvt_rgb24_lut(uint8_t *dst,const uint16_t *src,int c) {
+  for (;c-->0;dst+=3,src++) {
+    uint32_t p=pixcvt_lut32[*src];
+    dst[0]=p>>16;
+    dst[1]=p>>8;
+    dst[2]=p;
+  }
+}
+
+/* SSE2: 8 pixels at a time, channels unpacked into 16-bit lanes.
+ * There's no byte shuffle before SSSE3, so RGB24 builds XBGR pixels and writes them 4 bytes at a time, 3 apart.
+ * Each store's high byte is overwritten by the next, so the last one spills a byte: Stop while a pixel remains.
+ */
+
+#if PIXCVT_X86
+
+#define PIXCVT_SSE2_UNPACK \
+  __m128i p=_mm_loadu_si128((const __m128i*)src); \
+  __m128i r=_mm_and_si128(_mm_srli_epi16(p,8),m5); \
+  __m128i g=_mm_or_si128(_mm_and_si128(_mm_slli_epi16(p,3),m3),_mm_srli_epi16(p,13)); \
+  __m128i b=_mm_and_si128(_mm_srli_epi16(p,3),m5);
+
+#define PIXCVT_SSE2_EXPAND \
+  r=_mm_or_si128(_mm_slli_epi16(r,3),_mm_srli_epi16(r,2)); \
+  g=_mm_or_si128(_mm_slli_epi16(g,2),_mm_srli_epi16(g,4)); \
+  b=_mm_or_si128(_mm_slli_epi16(b,3),_mm_srli_epi16(b,2));
+
+__attribute__((target("sse2")))
+static void pixcvt_rgb565_sse2(uint16_t *dst,const uint16_t *src,int c) {
+  const __m128i m5=_mm_set1_epi16(0x1f);
+  const __m128i m3=_mm_set1_epi16(0x38);
+  for (;c>=8;c-=8,dst+=8,src+=8) {
+    PIXCVT_SSE2_UNPACK
+    __m128i d=_mm_or_si128(_mm_or_si128(_mm_slli_epi16(r,11),_mm_slli_epi16(g,5)),b);
+    _mm_storeu_si128((__m128i*)dst,d);
+  }
+  pixcvt_rgb565_c(dst,src,c);
+}
+
+__attribute__((target("sse2")))
+static void pixcvt_xrgb8888_sse2(uint32_t *dst,const uint16_t *src,int c) {
+  const __m128i m5=_mm_set1_epi16(0x1f);
+  const __m128i m3=_mm_set1_epi16(0x38);
+  for (;c>=8;c-=8,dst+=8,src+=8) {
+    PIXCVT_SSE2_UNPACK
+    PIXCVT_SSE2_EXPAND
+    // Interleaving 16-bit (g<<8|b) with r gives each pixel as a 32-bit 0x00rrggbb.
+    __m128i gb=_mm_or_si128(_mm_slli_epi16(g,8),b);
+    _mm_storeu_si128((__m128i*)dst,_mm_unpacklo_epi16(gb,r));
+    _mm_storeu_si128((__m128i*)(dst+4),_mm_unpackhi_epi16(gb,r));
+  }
+  pixcvt_xrgb8888_c(dst,src,c);
+}
+
+__attribute__((target("sse2")))
+static void pixcvt_xbgr8888_sse2(uint32_t *dst,const uint16_t *src,int c) {
+  const __m128i m5=_mm_set1_epi16(0x1f);
+  const __m128i m3=_mm_set1_epi16(0x38);
+  for (;c>=8;c-=8,dst+=8,src+=8) {
+    PIXCVT_SSE2_UNPACK
+    PIXCVT_SSE2_EXPAND
+    __m128i gr=_mm_or_si128(_mm_slli_epi16(g,8),r);
+    _mm_storeu_si128((__m128i*)dst,_mm_unpacklo_epi16(gr,b));
+    _mm_storeu_si128((__m128i*)(dst+4),_mm_unpackhi_epi16(gr,b));
+  }
+  pixcvt_xbgr8888_c(dst,src,c);
+}
+
+__attribute__((target("sse2")))
+static void pixcvt_rgb24_sse2(uint8_t *dst,const uint16_t *src,int c) {
+  const __m128i m5=_mm_set1_epi16(0x1f);
+  const __m128i m3=_mm_set1_epi16(0x38);
+  uint32_t tmp[8];
+  for (;c>8;c-=8,dst+=24,src+=8) {
+    PIXCVT_SSE2_UNPACK
+    PIXCVT_SSE2_EXPAND
+    __m128i gr=_mm_or_si128(_mm_slli_epi16(g,8),r);
+    _mm_storeu_si128((__m128i*)tmp,_mm_unpacklo_epi16(gr,b));
+    _mm_storeu_si128((__m128i*)(tmp+4),_mm_unpackhi_epi16(gr,b));
+    int i=0;
+    for (;i<8;i++) memcpy(dst+i*3,tmp+i,4);
+  }
+  pixcvt_rgb24_c(dst,src,c);
+}
+
+#undef PIXCVT_SSE2_UNPACK
+#undef PIXCVT_SSE2_EXPAND
+
+#endif
+
+/* NEON: Same arithmetic, then narrow to bytes and let the interleaving stores lay out the channels.
+ */
+
+#if PIXCVT_NEON
+
+#define PIXCVT_NEON_UNPACK \
+  uint16x8_t p=vld1q_u16(src); \
+  uint16x8_t r=vandq_u16(vshrq_n_u16(p,8),m5); \
+  uint16x8_t g=vorrq_u16(vandq_u16(vshlq_n_u16(p,3),m3),vshrq_n_u16(p,13)); \
+  uint16x8_t b=vandq_u16(vshrq_n_u16(p,3),m5);
+
+#define PIXCVT_NEON_EXPAND \
+  uint8x8_t r8=vmovn_u16(vorrq_u16(vshlq_n_u16(r,3),vshrq_n_u16(r,2))); \
+  uint8x8_t g8=vmovn_u16(vorrq_u16(vshlq_n_u16(g,2),vshrq_n_u16(g,4))); \
+  uint8x8_t b8=vmovn_u16(vorrq_u16(vshlq_n_u16(b,3),vshrq_n_u16(b,2)));
+
+static void pixcvt_rgb565_neon(uint16_t *dst,const uint16_t *src,int c) {
+  const uint16x8_t m5=vdupq_n_u16(0x1f);
+  const uint16x8_t m3=vdupq_n_u16(0x38);
+  for (;c>=8;c-=8,dst+=8,src+=8) {
+    PIXCVT_NEON_UNPACK
+    vst1q_u16(dst,vorrq_u16(vorrq_u16(vshlq_n_u16(r,11),vshlq_n_u16(g,5)),b));
+  }
+  pixcvt_rgb565_c(dst,src,c);
+}
+
+static void pixcvt_xrgb8888_neon(uint32_t *dst,const uint16_t *src,int c) {
+  const uint16x8_t m5=vdupq_n_u16(0x1f);
+  const uint16x8_t m3=vdupq_n_u16(0x38);
+  for (;c>=8;c-=8,dst+=8,src+=8) {
+    PIXCVT_NEON_UNPACK
+    PIXCVT_NEON_EXPAND
+    uint8x8x4_t d={{b8,g8,r8,vdup_n_u8(0)}}; // little-endian 0x00rrggbb
+    vst4_u8((uint8_t*)dst,d);
+  }
+  pixcvt_xrgb8888_c(dst,src,c);
+}
+
+static void pixcvt_xbgr8888_neon(uint32_t *dst,const uint16_t *src,int c) {
+  const uint16x8_t m5=vdupq_n_u16(0x1f);
+  const uint16x8_t m3=vdupq_n_u16(0x38);
+  for (;c>=8;c-=8,dst+=8,src+=8) {
+    PIXCVT_NEON_UNPACK
+    PIXCVT_NEON_EXPAND
+    uint8x8x4_t d={{r8,g8,b8,vdup_n_u8(0)}};
+    vst4_u8((uint8_t*)dst,d);
+  }
+  pixcvt_xbgr8888_c(dst,src,c);
+}
+
+static void pixcvt_rgb24_neon(uint8_t *dst,const uint16_t *src,int c) {
+  const uint16x8_t m5=vdupq_n_u16(0x1f);
+  const uint16x8_t m3=vdupq_n_u16(0x38);
+  for (;c>=8;c-=8,dst+=24,src+=8) {
+    PIXCVT_NEON_UNPACK
+    PIXCVT_NEON_EXPAND
+    uint8x8x3_t d={{r8,g8,b8}};
+    vst3_u8(dst,d);
+  }
+  pixcvt_rgb24_c(dst,src,c);
+}
+
+#undef PIXCVT_NEON_UNPACK
+#undef PIXCVT_NEON_EXPAND
+
+#endif
+
+/* Registry, in order of preference.
+ */
+
+static const struct pixcvt_kernel pixcvt_kernelv[]={
+#if PIXCVT_X86
+  {"sse2",pixcvt_rgb565_sse2,pixcvt_xrgb8888_sse2,pixcvt_xbgr8888_sse2,pixcvt_rgb24_sse2},
+#endif
+#if PIXCVT_NEON
+  {"neon",pixcvt_rgb565_neon,pixcvt_xrgb8888_neon,pixcvt_xbgr8888_neon,pixcvt_rgb24_neon},
+#endif
+  {"lut",pixcvt_rgb565_lut,pixcvt_xrgb8888_lut,pixcvt_xbgr8888_lut,pixcvt_rgb24_lut},
+  {"c",pixcvt_rgb565_c,pixcvt_xrgb8888_c,pixcvt_xbgr8888_c,pixcvt_rgb24_c},
+};
+
+static int pixcvt_supported(const struct pixcvt_kernel *kernel) {
+  #if PIXCVT_X86
+    if (kernel->rgb565==pixcvt_rgb565_sse2) return __builtin_cpu_supports("sse2")?1:0;
+  #endif
+  return 1;
+}
+
+const struct pixcvt_kernel *pixcvt_get(int p) {
+  const struct pixcvt_kernel *kernel=pixcvt_kernelv;
+  int i=sizeof(pixcvt_kernelv)/sizeof(struct pixcvt_kernel);
+  for (;i-->0;kernel++) {
+    if (!pixcvt_supported(kernel)) continue;
+    if (!p--) return kernel;
+  }
+  return 0;
+}
+
+int pixcvt_select(const char *name) {
+  const struct pixcvt_kernel *kernel;
+  int p=0;
+  for (;kernel=pixcvt_get(p);p++) {
+    if (!name||!strcmp(name,kernel->name)) break;
+  }
+  if (!kernel) return -1;
+  if (kernel->rgb565==pixcvt_rgb565_lut) pixcvt_lut_init();
+  pixcvt_kernel=kernel;
+  return 0;
+}
+
+/* Convert.
+ */
+
+int pixcvt_pixel_size(int fmt) {
+  switch (fmt) {
+    case PIXCVT_FMT_RGB565: return 2;
+    case PIXCVT_FMT_XRGB8888: return 4;
+    case PIXCVT_FMT_XBGR8888: return 4;
+    case PIXCVT_FMT_RGB24: return 3;
+  }
+  return 0;
+}
+
+void pixcvt_convert(void *dst,int dstfmt,const uint16_t *src,int c) {
+  if (!pixcvt_kernel) pixcvt_select(0);
+  switch (dstfmt) {
+    case PIXCVT_FMT_RGB565: pixcvt_kernel->rgb565(dst,src,c); break;
+    case PIXCVT_FMT_XRGB8888: pixcvt_kernel->xrgb8888(dst,src,c); break;
+    case PIXCVT_FMT_XBGR8888: pixcvt_kernel->xbgr8888(dst,src,c); break;
+    case PIXCVT_FMT_RGB24: pixcvt_kernel->rgb24(dst,src,c); break;
+  }
+}
+
+/* Spread (c) converted pixels across (scale) columns each. Returns the end of output.
+ * Small scales get loops the compiler can unroll. Past that, copying rows dominates anyway.
+ */
+
+static uint8_t *pixcvt_spread(uint8_t *dst,const uint8_t *src,int c,int pixelsize,int scale) {
+  switch (pixelsize) {
+    case 4: {
+        uint32_t *d=(uint32_t*)dst;
+        const uint32_t *s=(const uint32_t*)src;
+        if (scale==2) for (;c-->0;s++,d+=2) d[0]=d[1]=*s;
+        else if (scale==3) for (;c-->0;s++,d+=3) d[0]=d[1]=d[2]=*s;
+        else if (scale==4) for (;c-->0;s++,d+=4) d[0]=d[1]=d[2]=d[3]=*s;
+        else for (;c-->0;s++) {
+          int ri=scale;
+          for (;ri-->0;d++) *d=*s;
+        }
+        return (uint8_t*)d;
+      }
+    case 2: {
+        uint16_t *d=(uint16_t*)dst;
+        const uint16_t *s=(const uint16_t*)src;
+        if (scale==2) for (;c-->0;s++,d+=2) d[0]=d[1]=*s;
+        else if (scale==3) for (;c-->0;s++,d+=3) d[0]=d[1]=d[2]=*s;
+        else if (scale==4) for (;c-->0;s++,d+=4) d[0]=d[1]=d[2]=d[3]=*s;
+        else for (;c-->0;s++) {
+          int ri=scale;
+          for (;ri-->0;d++) *d=*s;
+        }
+        return (uint8_t*)d;
+      }
+    case 3: {
+        for (;c-->0;src+=3) {
+          int ri=scale;
+          for (;ri-->0;dst+=3) {
+            dst[0]=src[0];
+            dst[1]=src[1];
+            dst[2]=src[2];
+          }
+        }
+        return dst;
+      }
+  }
+  return dst;
+}
+
+void pixcvt_scale(
+  void *dst,int dststride,int dstfmt,
+  const uint16_t *src,int srcstride,
+  int w,int h,int scale
+) {
+  int pixelsize=pixcvt_pixel_size(dstfmt);
+  if (!pixelsize||(w<1)||(h<1)||(scale<1)) return;
+  int cpc=w*scale*pixelsize;
+  uint8_t *dstrow=dst;
+  for (;h-->0;src+=srcstride) {
+    if (scale==1) {
+      pixcvt_convert(dstrow,dstfmt,src,w);
+      dstrow+=dststride;
+      continue;
+    }
+    uint32_t tmp[PIXCVT_CHUNK];
+    uint8_t *dstp=dstrow;
+    int xi=0;
+    for (;xi<w;xi+=PIXCVT_CHUNK) {
+      int c=w-xi;
+      if (c>PIXCVT_CHUNK) c=PIXCVT_CHUNK;
+      pixcvt_convert(tmp,dstfmt,src+xi,c);
+      dstp=pixcvt_spread(dstp,(uint8_t*)tmp,c,pixelsize,scale);
+    }
+    const uint8_t *first=dstrow;
+    dstrow+=dststride;
+    int ri=scale-1;
+    for (;ri-->0;dstrow+=dststride) memcpy(dstrow,first,cpc);
+  }
+}
@@ -0,0 +1,58 @@
+/* pixcvt.h
+ * Framebuffer conversion for the video drivers.
+ * The game draws in the Tiny's native 16-bit format: RGB565 with the bytes swapped, read as a little-endian uint16.
+ * So bits 0..2 are green's high bits, 3..7 blue, 8..12 red, and 13..15 green's low bits.
+ * We convert that to what the output wants, optionally with an integer upscale in the same pass.
+ * Kernels in portable C, a 64k-entry lookup table, SSE2, and NEON. All produce identical output.
+ * 8-bit channels replicate their high bits into the low ones, so white is 0xff and not 0xf8.
+ */
+
+#ifndef PIXCVT_H
+#define PIXCVT_H
+
+#include <stdint.h>
+
+#define PIXCVT_FMT_RGB565    1 /* uint16_t, red in the high bits. */
+#define PIXCVT_FMT_XRGB8888  2 /* uint32_t 0x00rrggbb. */
+#define PIXCVT_FMT_XBGR8888  3 /* uint32_t 0x00bbggrr. */
+#define PIXCVT_FMT_RGB24     4 /* Bytes r,g,b. */
+
+/* Bytes per pixel, or zero if unknown.
+ */
+int pixcvt_pixel_size(int fmt);
+
+/* Convert (c) pixels.
+ */
+void pixcvt_convert(void *dst,int dstfmt,const uint16_t *src,int c);
+
+/* Convert and scale a (w,h) image by (scale) in both axes: Output is (w*scale,h*scale).
+ * Strides are (dststride) bytes and (srcstride) pixels.
+ * Each source row is converted once, spread horizontally, then the output row is copied (scale-1) more times.
+ */
+void pixcvt_scale(
+  void *dst,int dststride,int dstfmt,
+  const uint16_t *src,int srcstride,
+  int w,int h,int scale
+);
+
+/* Kernels, for the benchmark.
+ * Each converts (c) pixels with no alignment requirements.
+ */
+struct pixcvt_kernel {
+  const char *name;
+  void (*rgb565)(uint16_t *dst,const uint16_t *src,int c);
+  void (*xrgb8888)(uint32_t *dst,const uint16_t *src,int c);
+  void (*xbgr8888)(uint32_t *dst,const uint16_t *src,int c);
+  void (*rgb24)(uint8_t *dst,const uint16_t *src,int c);
+};
+
+/* Null for the best this CPU supports, or name one. Fails if not compiled in or not supported.
+ * You don't need to call this; we select the best automatically at the first conversion.
+ */
+int pixcvt_select(const char *name);
+
+/* Iterate compiled-in kernels supported by this CPU, in order of preference. Portable C is always last.
+ */
+const struct pixcvt_kernel *pixcvt_get(int p);
+
+#endif
@@ -110,12 +110,20 @@ static void tiny_audio_init() {
 }
 
 /* Update audio.
+ * The timer starts in platform_init(), before setup() has initialized the synth.
+ * Hold the DAC at midpoint until the first platform_update(), which is after setup() returns.
  */
 
+static volatile uint8_t tiny_audio_ready=0;
+
 void TC5_Handler() {
   while(DAC->STATUS.bit.SYNCBUSY == 1);
-  int16_t sample=audio_next();
-  DAC->DATA.reg=((sample>>6)+0x200)&0x3ff;
+  if (tiny_audio_ready) {
+    int16_t sample=audio_next();
+    DAC->DATA.reg=((sample>>6)+0x200)&0x3ff;
+  } else {
+    DAC->DATA.reg=0x200;
+  }
   while(DAC->STATUS.bit.SYNCBUSY == 1);
   TC5->COUNT16.INTFLAG.bit.MC0 = 1;
 }
@@ -375,6 +383,7 @@ uint8_t platform_init(int32_t *audio_rate) {
  */
  
 uint8_t platform_update() {
+  tiny_audio_ready=1;
   uint8_t state=0;
   if (analogRead(42)<0x08) state|=BUTTON_UP;
   if (analogRead(19)<0x08) state|=BUTTON_DOWN;
@@ -398,7 +407,23 @@ void platform_send_framebuffer(const void *fb) {
   endTransfer();
 }
 
+/* The display's write window is the whole screen, and we rely on it wrapping, so it's all or nothing.
+ */
+
+void platform_send_framebuffer_damaged(const void *fb,const struct image_rect *rectv,int rectc) {
+  if (rectc>0) platform_send_framebuffer(fb);
+}
+
 int audio_estimate_buffered_frame_count() {
   // We update the synthesizer one frame at a time; this can always be zero.
   return 0;
 }
+
+uint64_t audio_frame_for_time(int64_t time_us) {
+  // Notes apply immediately here anyway.
+  return 0;
+}
+
+uint64_t audio_audible_frame_for_time(int64_t time_us) {
+  return 0;
+}
@@ -0,0 +1,182 @@
+#include "upsample.h"
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <math.h>
+
+/* Each output frame is a dot product of UPSAMPLE_TAPS input frames against one phase of the filter.
+ * The output position is always between hist[UPSAMPLE_CENTER] and the frame after it.
+ */
+#define UPSAMPLE_TAPS 16
+#define UPSAMPLE_CENTER ((UPSAMPLE_TAPS>>1)-1)
+#define UPSAMPLE_PHASE_BITS 8
+#define UPSAMPLE_PHASES (1<<UPSAMPLE_PHASE_BITS)
+#define UPSAMPLE_COEF_SHIFT 14
+#define UPSAMPLE_SRC_LIMIT 256
+
+struct upsample {
+  int refc;
+  int srcrate,dstrate;
+  void (*cb)(int16_t *v,int c,void *userdata);
+  void *userdata;
+  uint32_t pos; // output position past hist[UPSAMPLE_CENTER], in 1/2**32 input frames
+  uint32_t step; // (srcrate/dstrate) in the same units. Zero if the rates match.
+  uint32_t owed; // input frames to shift in before the next output
+  int16_t hist[UPSAMPLE_TAPS]; // newest at the end
+  int16_t srcv[UPSAMPLE_SRC_LIMIT];
+  int16_t coefv[UPSAMPLE_PHASES][UPSAMPLE_TAPS];
+};
+
+/* Delete.
+ */
+
+void upsample_del(struct upsample *upsample) {
+  if (!upsample) return;
+  if (upsample->refc-->1) return;
+  free(upsample);
+}
+
+/* Retain.
+ */
+
+int upsample_ref(struct upsample *upsample) {
+  if (!upsample) return -1;
+  if (upsample->refc<1) return -1;
+  if (upsample->refc==INT_MAX) return -1;
+  upsample->refc++;
+  return 0;
+}
+
+/* Build the filter: Blackman-windowed sinc, cut off at the input's Nyquist.
+ * Each phase is normalized to unity gain after rounding, so DC passes through exactly.
+ */
+
+static void upsample_build_coefficients(struct upsample *upsample) {
+  const double halfwidth=UPSAMPLE_TAPS>>1;
+  const int32_t one=1<<UPSAMPLE_COEF_SHIFT;
+  int phase=0;
+  for (;phase<UPSAMPLE_PHASES;phase++) {
+    int16_t *coefv=upsample->coefv[phase];
+    double frac=(double)phase/UPSAMPLE_PHASES;
+    int32_t sum=0;
+    int peakp=UPSAMPLE_CENTER;
+    int i=0;
+    for (;i<UPSAMPLE_TAPS;i++) {
+      double t=(i-UPSAMPLE_CENTER)-frac;
+      double sinc=(t==0.0)?1.0:(sin(M_PI*t)/(M_PI*t));
+      double x=t/halfwidth;
+      double window=0.42+0.5*cos(M_PI*x)+0.08*cos(2.0*M_PI*x);
+      coefv[i]=(int16_t)lround(sinc*window*one);
+      sum+=coefv[i];
+      if (coefv[i]>coefv[peakp]) peakp=i;
+    }
+    coefv[peakp]+=one-sum;
+  }
+}
+
+/* New.
+ */
+
+struct upsample *upsample_new(
+  int srcrate,int dstrate,
+  void (*cb)(int16_t *v,int c,void *userdata),
+  void *userdata
+) {
+  if (!cb) return 0;
+  if ((srcrate<1)||(dstrate<srcrate)) return 0;
+  struct upsample *upsample=calloc(1,sizeof(struct upsample));
+  if (!upsample) return 0;
+
+  upsample->refc=1;
+  upsample->srcrate=srcrate;
+  upsample->dstrate=dstrate;
+  upsample->cb=cb;
+  upsample->userdata=userdata;
+  if (srcrate<dstrate) {
+    upsample->step=((uint64_t)srcrate<<32)/dstrate;
+    upsample_build_coefficients(upsample);
+  }
+
+  return upsample;
+}
+
+/* Trivial accessors.
+ */
+
+int upsample_get_srcrate(const struct upsample *upsample) {
+  if (!upsample) return 0;
+  return upsample->srcrate;
+}
+
+int upsample_get_dstrate(const struct upsample *upsample) {
+  if (!upsample) return 0;
+  return upsample->dstrate;
+}
+
+/* Compute one output sample at the current position.
+ */
+
+static int16_t upsample_sample(const struct upsample *upsample) {
+  uint32_t phase=upsample->pos>>(32-UPSAMPLE_PHASE_BITS);
+  if (!phase) return upsample->hist[UPSAMPLE_CENTER];
+  const int16_t *coefv=upsample->coefv[phase];
+  int32_t acc=1<<(UPSAMPLE_COEF_SHIFT-1);
+  int i=0;
+  for (;i<UPSAMPLE_TAPS;i++) acc+=upsample->hist[i]*coefv[i];
+  acc>>=UPSAMPLE_COEF_SHIFT;
+  if (acc>32767) return 32767;
+  if (acc<-32768) return -32768;
+  return acc;
+}
+
+/* Same rate, just pull and duplicate channels.
+ */
+
+static void upsample_passthrough(struct upsample *upsample,int16_t *dst,int framec,int chanc) {
+  while (framec>0) {
+    int c=(framec<UPSAMPLE_SRC_LIMIT)?framec:UPSAMPLE_SRC_LIMIT;
+    upsample->cb(upsample->srcv,c,upsample->userdata);
+    const int16_t *src=upsample->srcv;
+    int i=c;
+    for (;i-->0;src++) {
+      int ci=chanc;
+      for (;ci-->0;dst++) *dst=*src;
+    }
+    framec-=c;
+  }
+}
+
+/* Render.
+ */
+
+void upsample_render(struct upsample *upsample,int16_t *dst,int framec,int chanc) {
+  if (!upsample||(chanc<1)) return;
+  if (!upsample->step) {
+    upsample_passthrough(upsample,dst,framec,chanc);
+    return;
+  }
+  while (framec>0) {
+
+    // Pull exactly the input frames these outputs need, up to our buffer's size.
+    uint64_t need=upsample->owed+(((uint64_t)upsample->pos+(uint64_t)upsample->step*(framec-1))>>32);
+    int srcc=(need<UPSAMPLE_SRC_LIMIT)?need:UPSAMPLE_SRC_LIMIT;
+    if (srcc) upsample->cb(upsample->srcv,srcc,upsample->userdata);
+    int srcp=0;
+
+    while (framec>0) {
+      while (upsample->owed&&(srcp<srcc)) {
+        memmove(upsample->hist,upsample->hist+1,sizeof(int16_t)*(UPSAMPLE_TAPS-1));
+        upsample->hist[UPSAMPLE_TAPS-1]=upsample->srcv[srcp++];
+        upsample->owed--;
+      }
+      if (upsample->owed) break;
+      int16_t sample=upsample_sample(upsample);
+      int ci=chanc;
+      for (;ci-->0;dst++) *dst=sample;
+      framec--;
+      uint32_t npos=upsample->pos+upsample->step;
+      if (npos<upsample->pos) upsample->owed++;
+      upsample->pos=npos;
+    }
+  }
+}
@@ -0,0 +1,37 @@
+/* upsample.h
+ * Polyphase interpolator, for running the synthesizer at a low fixed rate and playing at whatever the device wants.
+ * Windowed-sinc, integer all the way through once the coefficients are built.
+ * Input samples land exactly on phase zero, so an exact 2x (22050 to 44100) only filters every other frame.
+ * Mono in; output is interleaved with the same signal in each channel.
+ * Latency is UPSAMPLE_LATENCY input frames, about 0.4 ms at 22050 Hz.
+ */
+
+#ifndef UPSAMPLE_H
+#define UPSAMPLE_H
+
+struct upsample;
+
+#define UPSAMPLE_LATENCY 9 /* input frames */
+
+#include <stdint.h>
+
+void upsample_del(struct upsample *upsample);
+int upsample_ref(struct upsample *upsample);
+
+/* (dstrate) must be at least (srcrate).
+ * (cb) produces (c) mono frames at (srcrate) whenever we need them. We ask for no more than we'll use.
+ */
+struct upsample *upsample_new(
+  int srcrate,int dstrate,
+  void (*cb)(int16_t *v,int c,void *userdata),
+  void *userdata
+);
+
+int upsample_get_srcrate(const struct upsample *upsample);
+int upsample_get_dstrate(const struct upsample *upsample);
+
+/* Produce (framec) frames of (chanc) interleaved channels at (dstrate).
+ */
+void upsample_render(struct upsample *upsample,int16_t *dst,int framec,int chanc);
+
+#endif
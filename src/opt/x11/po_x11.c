@@ -1,15 +1,19 @@
 #include "po_x11.h"
 #include "platform.h"
+#include "opt/pixcvt/pixcvt.h"
 #include <stdlib.h>
+#include <stdio.h>
 #include <string.h>
+#include <time.h>
+#include <sys/ipc.h>
+#include <sys/shm.h>
 #include <X11/X.h>
 #include <X11/Xlib.h>
 #include <X11/Xutil.h>
 #include <X11/Xatom.h>
 #include <X11/XKBlib.h>
 #include <X11/keysym.h>
-
-typedef uint16_t po_pixel_t;
+#include <X11/extensions/XShm.h>
 
 #define KeyRepeat (LASTEvent+2)
 #define PO_X11_KEY_REPEAT_INTERVAL 10
@@ -39,9 +43,20 @@ struct po_x11 {
   XImage *image;
   int dstx,dsty;
   int dstdirty;
-  int rshift,gshift,bshift;
+  int exposed; // window contents lost; next swap must send everything
+  int pixfmt; // PIXCVT_FMT_*
   int scale;
   
+  // MIT-SHM: (image) lives in a segment the server reads directly, so swaps send only a request.
+  // (shm) zero means we use plain XPutImage, either by request or because the server can't share memory with us (eg remote).
+  // (shmpending) while the server may still be reading the previous frame; we must not touch the pixels until it completes.
+  int shm;
+  int shmevent;
+  int shmpending;
+  XShmSegmentInfo shminfo;
+  
+  struct po_x11_stats stats;
+  
   Atom atom_WM_PROTOCOLS;
   Atom atom_WM_DELETE_WINDOW;
   Atom atom__NET_WM_STATE;
@@ -57,12 +72,26 @@ struct po_x11 {
 
 /* Cleanup.
  */
+ 
+static void po_x11_destroy_image(struct po_x11 *x11) {
+  if (!x11->image) return;
+  if (x11->shminfo.shmaddr) {
+    XShmDetach(x11->dpy,&x11->shminfo);
+    XSync(x11->dpy,0);
+    shmdt(x11->shminfo.shmaddr);
+    x11->shminfo.shmaddr=0;
+    x11->image->data=0;
+    x11->shmpending=0;
+  }
+  XDestroyImage(x11->image);
+  x11->image=0;
+}
   
 void po_x11_del(struct po_x11 *x11) {
   if (!x11) return;
   
   if (x11->dpy) {
-    if (x11->image) XDestroyImage(x11->image);
+    po_x11_destroy_image(x11);
     if (x11->gc) XFreeGC(x11->dpy,x11->gc);
     XCloseDisplay(x11->dpy);
   }
@@ -94,6 +123,7 @@ static int po_x11_init(struct po_x11 *x11) {
       StructureNotifyMask|
       KeyPressMask|KeyReleaseMask|
       FocusChangeMask|
+      ExposureMask|
     0,
   };
   
@@ -136,6 +166,15 @@ static int po_x11_init(struct po_x11 *x11) {
   
   if (!(x11->gc=XCreateGC(x11->dpy,x11->win,0,0))) return -1;
   
+  if (x11->shm) {
+    int major,minor,pixmaps;
+    if (!XShmQueryExtension(x11->dpy)||!XShmQueryVersion(x11->dpy,&major,&minor,&pixmaps)) {
+      x11->shm=0;
+    } else {
+      x11->shmevent=XShmGetEventBase(x11->dpy)+ShmCompletion;
+    }
+  }
+  
   return 0;
 }
 
@@ -146,6 +185,7 @@ struct po_x11 *po_x11_new(
   const char *title,
   int fbw,int fbh,
   int fullscreen,
+  int shm,
   int (*cb_button)(struct po_x11 *x11,uint8_t btnid,int value),
   int (*cb_close)(struct po_x11 *x11),
   void *userdata
@@ -157,6 +197,7 @@ struct po_x11 *po_x11_new(
   x11->fbw=fbw;
   x11->fbh=fbh;
   x11->fullscreen=fullscreen;
+  x11->shm=shm;
   x11->cb_button=cb_button;
   x11->cb_close=cb_close;
   x11->userdata=userdata;
@@ -184,6 +225,68 @@ void *po_x11_get_userdata(const struct po_x11 *x11) {
   return x11->userdata;
 }
 
+int po_x11_get_shm(const struct po_x11 *x11) {
+  return x11->shm;
+}
+
+void po_x11_get_stats(struct po_x11_stats *dst,const struct po_x11 *x11) {
+  *dst=x11->stats;
+  dst->shm=x11->shm;
+}
+
+/* Create the shared-memory image.
+ * XShmAttach fails asynchronously if the server can't see our segment (remote display),
+ * so we sync with a temporary error handler to find out now rather than on the first swap.
+ */
+ 
+static int po_x11_shm_error=0;
+
+static int po_x11_shm_error_handler(Display *dpy,XErrorEvent *evt) {
+  po_x11_shm_error=1;
+  return 0;
+}
+
+static int po_x11_create_shm_image(struct po_x11 *x11,int dstw,int dsth) {
+  if (!(x11->image=XShmCreateImage(
+    x11->dpy,DefaultVisual(x11->dpy,x11->screen),24,ZPixmap,0,&x11->shminfo,dstw,dsth
+  ))) return -1;
+  if ((x11->shminfo.shmid=shmget(IPC_PRIVATE,x11->image->bytes_per_line*dsth,IPC_CREAT|0600))<0) {
+    XDestroyImage(x11->image);
+    x11->image=0;
+    return -1;
+  }
+  x11->shminfo.shmaddr=shmat(x11->shminfo.shmid,0,0);
+  if (x11->shminfo.shmaddr==(void*)-1) {
+    x11->shminfo.shmaddr=0;
+    shmctl(x11->shminfo.shmid,IPC_RMID,0);
+    XDestroyImage(x11->image);
+    x11->image=0;
+    return -1;
+  }
+  x11->image->data=x11->shminfo.shmaddr;
+  x11->shminfo.readOnly=False;
+  
+  XSync(x11->dpy,0);
+  po_x11_shm_error=0;
+  int (*pvhandler)(Display*,XErrorEvent*)=XSetErrorHandler(po_x11_shm_error_handler);
+  int ok=XShmAttach(x11->dpy,&x11->shminfo);
+  XSync(x11->dpy,0);
+  XSetErrorHandler(pvhandler);
+  
+  // Mark for removal now, so it goes away with us even if we crash. Attached segments stay valid until detached.
+  shmctl(x11->shminfo.shmid,IPC_RMID,0);
+  
+  if (!ok||po_x11_shm_error) {
+    shmdt(x11->shminfo.shmaddr);
+    x11->shminfo.shmaddr=0;
+    x11->image->data=0;
+    XDestroyImage(x11->image);
+    x11->image=0;
+    return -1;
+  }
+  return 0;
+}
+
 /* Select framebuffer's output bounds.
  */
  
@@ -210,25 +313,30 @@ static int po_x11_recalculate_output_bounds(struct po_x11 *x11) {
   /* If the image is not yet created, or doesn't match the calculated size, rebuild it.
    */
   if (!x11->image||(x11->image->width!=dstw)||(x11->image->height!=dsth)) {
-    if (x11->image) {
-      XDestroyImage(x11->image);
-      x11->image=0;
+    po_x11_destroy_image(x11);
+    if (x11->shm&&(po_x11_create_shm_image(x11,dstw,dsth)<0)) {
+      fprintf(stderr,"X11: MIT-SHM unavailable, falling back to XPutImage.\n");
+      x11->shm=0;
     }
-    void *pixels=malloc(dstw*4*dsth);
-    if (!pixels) return -1;
-    if (!(x11->image=XCreateImage(
-      x11->dpy,DefaultVisual(x11->dpy,x11->screen),24,ZPixmap,0,pixels,dstw,dsth,32,dstw*4
-    ))) {
-      free(pixels);
-      return -1;
+    if (!x11->image) {
+      void *pixels=malloc(dstw*4*dsth);
+      if (!pixels) return -1;
+      if (!(x11->image=XCreateImage(
+        x11->dpy,DefaultVisual(x11->dpy,x11->screen),24,ZPixmap,0,pixels,dstw,dsth,32,dstw*4
+      ))) {
+        free(pixels);
+        return -1;
+      }
     }
     
-    // And recalculate channel shifts...
-    if (!x11->image->red_mask||!x11->image->green_mask||!x11->image->blue_mask) return -1;
-    uint32_t m;
-    x11->rshift=0; m=x11->image->red_mask;   for (;!(m&1);m>>=1,x11->rshift++) ; if (m!=0xff) return -1;
-    x11->gshift=0; m=x11->image->green_mask; for (;!(m&1);m>>=1,x11->gshift++) ; if (m!=0xff) return -1;
-    x11->bshift=0; m=x11->image->blue_mask;  for (;!(m&1);m>>=1,x11->bshift++) ; if (m!=0xff) return -1;
+    // And confirm it's a channel layout we can produce...
+    if ((x11->image->red_mask==0xff0000)&&(x11->image->green_mask==0x00ff00)&&(x11->image->blue_mask==0x0000ff)) {
+      x11->pixfmt=PIXCVT_FMT_XRGB8888;
+    } else if ((x11->image->red_mask==0x0000ff)&&(x11->image->green_mask==0x00ff00)&&(x11->image->blue_mask==0xff0000)) {
+      x11->pixfmt=PIXCVT_FMT_XBGR8888;
+    } else {
+      return -1;
+    }
   }
   
   return 0;
@@ -237,38 +345,86 @@ static int po_x11_recalculate_output_bounds(struct po_x11 *x11) {
 /* Swap framebuffer.
  */
  
-static inline void po_rgb_from_pixel(uint8_t *rgb,uint16_t src) {
-  rgb[0]=(src>>5)&0xf8; rgb[0]|=rgb[0]>>5;
-  rgb[1]=((src<<5)&0xe0)|((src>>11)&0x1c); rgb[1]|=rgb[1]>>6;
-  rgb[2]=(src&0xf8); rgb[2]|=rgb[2]>>5;
+static Bool po_x11_is_shm_completion(Display *dpy,XEvent *evt,XPointer arg) {
+  const struct po_x11 *x11=(void*)arg;
+  return (evt->type==x11->shmevent);
+}
+
+static double po_x11_now() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC,&ts);
+  return ts.tv_sec+ts.tv_nsec/1000000000.0;
 }
 
 int po_x11_swap(struct po_x11 *x11,const void *fb) {
+  struct image_rect all={0,0,x11->fbw,x11->fbh};
+  return po_x11_swap_damaged(x11,fb,&all,1);
+}
+
+int po_x11_swap_damaged(struct po_x11 *x11,const void *fb,const struct image_rect *rectv,int rectc) {
+  double starttime=po_x11_now();
+  
+  // A new image, or a newly uncovered window, needs everything.
+  struct image_rect all={0,0,x11->fbw,x11->fbh};
+  if (x11->dstdirty||x11->exposed||!x11->image) {
+    rectv=&all;
+    rectc=1;
+    x11->exposed=0;
+  }
+  if (rectc<1) {
+    x11->stats.swapc++;
+    x11->stats.idlec++;
+    return 0;
+  }
+  
+  // Previous frame must be out of the shared segment before we redraw it, or resize it.
+  if (x11->shmpending) {
+    XEvent evt;
+    XIfEvent(x11->dpy,&evt,po_x11_is_shm_completion,(XPointer)x11);
+    x11->shmpending=0;
+  }
+  double readytime=po_x11_now();
+
   if (x11->dstdirty) {
     if (po_x11_recalculate_output_bounds(x11)<0) return -1;
     x11->dstdirty=0;
     XClearWindow(x11->dpy,x11->win);
   }
   
-  const po_pixel_t *src=fb;
-  uint32_t *dst=(void*)x11->image->data;
-  int cpc=x11->image->width*4;
-  int yi=x11->fbh;
-  for (;yi-->0;) {
-    uint32_t *dststart=dst;
-    int xi=x11->fbw;
-    for (;xi-->0;src++) {
-      uint8_t rgb[3];
-      po_rgb_from_pixel(rgb,*src);
-      uint32_t pixel=(rgb[0]<<x11->rshift)|(rgb[1]<<x11->gshift)|(rgb[2]<<x11->bshift);
-      int ri=x11->scale;
-      for (;ri-->0;dst++) *dst=pixel;
+  const struct image_rect *rect=rectv;
+  int i=rectc;
+  for (;i-->0;rect++) {
+    pixcvt_scale(
+      x11->image->data+rect->y*x11->scale*x11->image->bytes_per_line+rect->x*x11->scale*4,
+      x11->image->bytes_per_line,x11->pixfmt,
+      (const uint16_t*)fb+rect->y*x11->fbw+rect->x,x11->fbw,
+      rect->w,rect->h,x11->scale
+    );
+    x11->stats.pixelc+=rect->w*rect->h;
+  }
+  
+  double convtime=po_x11_now();
+  
+  for (rect=rectv,i=rectc;i-->0;rect++) {
+    int x=rect->x*x11->scale,y=rect->y*x11->scale,w=rect->w*x11->scale,h=rect->h*x11->scale;
+    if (x11->shm) {
+      // Only the last one asks for completion. The server does them in order.
+      XShmPutImage(x11->dpy,x11->win,x11->gc,x11->image,x,y,x11->dstx+x,x11->dsty+y,w,h,i?False:True);
+    } else {
+      XPutImage(x11->dpy,x11->win,x11->gc,x11->image,x,y,x11->dstx+x,x11->dsty+y,w,h);
+      x11->stats.bytes+=w*4*h;
     }
-    int ri=x11->scale-1;
-    for (;ri-->0;dst+=x11->image->width) memcpy(dst,dststart,cpc);
   }
+  if (x11->shm) x11->shmpending=1;
+  // Flush here so the socket write counts against this swap, not the next update.
+  XFlush(x11->dpy);
+  double endtime=po_x11_now();
   
-  XPutImage(x11->dpy,x11->win,x11->gc,x11->image,0,0,x11->dstx,x11->dsty,x11->image->width,x11->image->height);
+  x11->stats.swapc++;
+  x11->stats.waittime+=readytime-starttime;
+  x11->stats.convtime+=convtime-readytime;
+  x11->stats.puttime+=endtime-convtime;
+  if (endtime-starttime>x11->stats.maxtime) x11->stats.maxtime=endtime-starttime;
   
   x11->screensaver_inhibited=0;
   return 0;
@@ -382,6 +538,12 @@ static int po_x11_receive_event(struct po_x11 *x11,XEvent *evt) {
         }
       } break;
     
+    case Expose: x11->exposed=1; break;
+    
+    default: {
+        if (x11->shm&&(evt->type==x11->shmevent)) x11->shmpending=0;
+      } break;
+    
   }
   return 0;
 }
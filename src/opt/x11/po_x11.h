@@ -4,6 +4,7 @@
 #include <stdint.h>
 
 struct po_x11;
+struct image_rect;
 
 void po_x11_del(struct po_x11 *x11);
 
@@ -11,13 +12,40 @@ struct po_x11 *po_x11_new(
   const char *title,
   int fbw,int fbh,
   int fullscreen,
+  int shm, // nonzero to present via MIT-SHM if the server supports it
   int (*cb_button)(struct po_x11 *x11,uint8_t btnid,int value),
   int (*cb_close)(struct po_x11 *x11),
   void *userdata
 );
 
 void *po_x11_get_userdata(const struct po_x11 *x11);
+
+/* Nonzero if we're presenting via MIT-SHM.
+ * May drop to zero at the first swap, if attaching the segment fails.
+ */
+int po_x11_get_shm(const struct po_x11 *x11);
+
+/* Counters since start, for comparing the two presentation paths. Times are in seconds.
+ * (idlec) swaps had nothing damaged, and did nothing. (pixelc) framebuffer pixels converted.
+ * (bytes) is pixel data written to the X socket; zero when sharing memory.
+ * (waittime) is spent blocking for the server to release the shared image.
+ */
+struct po_x11_stats {
+  int shm;
+  int swapc;
+  int idlec;
+  int64_t pixelc;
+  int64_t bytes;
+  double waittime,convtime,puttime,maxtime;
+};
+void po_x11_get_stats(struct po_x11_stats *dst,const struct po_x11 *x11);
+
 int po_x11_swap(struct po_x11 *x11,const void *fb);
+
+/* Convert and send only (rectv), in framebuffer pixels. They must be in bounds and not overlap.
+ * We send everything anyway if the window was resized or exposed.
+ */
+int po_x11_swap_damaged(struct po_x11 *x11,const void *fb,const struct image_rect *rectv,int rectc);
 int po_x11_set_fullscreen(struct po_x11 *x11,int state);
 void po_x11_inhibit_screensaver(struct po_x11 *x11);
 int po_x11_update(struct po_x11 *x11);
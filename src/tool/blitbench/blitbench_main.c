@@ -0,0 +1,254 @@
+/* blitbench_main.c
+ * Benchmarks for the colorkey blitters, run by `make blitbench`.
+ *   sprite: Every blitter at each sprite size game_render() and dancer.c actually draw, ns per blit.
+ *   frame: All of those once, roughly what one game frame costs in colorkey blits.
+ * After timing, each blitter draws a fixed pattern including clipped edges, and its output must match the portable C one.
+ * Each timing is the median of several runs. Plain text by default, or JSON with --json.
+ */
+
+#include "main/platform.h"
+#include "main/image_internal.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define BLITBENCH_FBW 96
+#define BLITBENCH_FBH 64
+#define BLITBENCH_SRCW 128
+#define BLITBENCH_SRCH 96
+#define BLITBENCH_SECONDS 0.1 /* per run */
+#define BLITBENCH_REPEAT_LIMIT 15
+
+/* Sprite sizes, from the calls in game.c and dancer.c.
+ * Where one size is drawn from several places, it's listed once.
+ */
+static const struct blitbench_sprite {
+  const char *name;
+  int w,h;
+  int flop;
+} blitbench_spritev[]={
+  {"digit",4,7,0},
+  {"note",10,9,0},
+  {"button",12,7,0},
+  {"toast",11,11,0},
+  {"combo",14,18,0},
+  {"lane",66,1,0},
+  {"border-v",4,64,0},
+  {"border-h",96,4,0},
+  {"divider",8,64,0},
+  {"rarm",8,15,0},
+  {"rarm-sm",6,15,0},
+  {"body",16,14,0},
+  {"head",14,12,0},
+  {"larm",4,9,0},
+  {"larm-1",6,8,0},
+  {"larm-2",7,7,0},
+  {"body-2",12,20,0},
+  {"head-2",10,8,0},
+  {"guitar",10,14,0},
+  {"strum",10,4,0},
+  {"mandible",8,9,0},
+  {"head-3",12,11,0},
+  {"head-3",12,11,1},
+  {"arm-3",14,13,0},
+  {"foot",4,7,0},
+  {"body-3",14,15,0},
+  {"dancer",24,24,0},
+};
+
+static struct blitbench {
+  int json;
+  const char *label;
+  int repeat;
+  int status;
+  int resultc;
+  uint16_t fbv[BLITBENCH_FBW*BLITBENCH_FBH];
+  uint16_t srcv[BLITBENCH_SRCW*BLITBENCH_SRCH];
+  struct image fb,src;
+} blitbench={0};
+
+static double blitbench_now() {
+  struct timespec tv={0};
+  clock_gettime(CLOCK_MONOTONIC,&tv);
+  return (double)tv.tv_sec+(double)tv.tv_nsec/1000000000.0;
+}
+
+static uint32_t blitbench_hash(const uint16_t *v,int c) {
+  uint32_t hash=0;
+  for (;c-->0;v++) hash=(hash<<5)+hash+*v;
+  return hash;
+}
+
+/* Report one result.
+ */
+
+static void blitbench_report(
+  const char *bench,const char *blitter,const char *sprite,int w,int h,int flop,
+  const char *unit,double ns,double refns,uint32_t hash,int mismatch
+) {
+  if (mismatch) blitbench.status=1;
+  double speedup=(refns>0.0)?refns/ns:1.0;
+  if (blitbench.json) {
+    fprintf(stdout,"%s\n    {\"bench\":\"%s\",\"blitter\":\"%s\",\"sprite\":\"%s\",\"w\":%d,\"h\":%d,\"flop\":%s,"
+      "\"unit\":\"%s\",\"ns\":%.4f,\"speedup\":%.4f,\"hash\":\"%08x\",\"match\":%s}",
+      blitbench.resultc?",":"",bench,blitter,sprite,w,h,flop?"true":"false",unit,ns,speedup,hash,mismatch?"false":"true"
+    );
+  } else {
+    fprintf(stdout,"%-6s %-4s %-9s %2dx%-2d %-4s %10.3f ns/%-5s %5.2fx%s\n",
+      bench,blitter,sprite,w,h,flop?"flop":"",ns,unit,speedup,mismatch?"  *** OUTPUT MISMATCH ***":""
+    );
+  }
+  blitbench.resultc++;
+}
+
+static int blitbench_cmp_double(const void *a,const void *b) {
+  double x=*(const double*)a,y=*(const double*)b;
+  return (x<y)?-1:(x>y)?1:0;
+}
+
+static double blitbench_median(double *v,int c) {
+  qsort(v,c,sizeof(double),blitbench_cmp_double);
+  return v[c>>1];
+}
+
+/* Draw one sprite at the (i)th position of a fixed walk across the framebuffer.
+ * Source position walks too, so we don't read the same pixels every time.
+ * Positions run a little off each edge, to exercise clipping.
+ */
+
+static void blitbench_draw(const struct blitbench_sprite *sprite,int i) {
+  int dstx=((i*37)%(BLITBENCH_FBW+8))-4;
+  int dsty=((i*23)%(BLITBENCH_FBH+8))-4;
+  int srcx=(i*13)%(BLITBENCH_SRCW-sprite->w+1);
+  int srcy=(i*7)%(BLITBENCH_SRCH-sprite->h+1);
+  if (sprite->flop) image_blit_colorkey_flop(&blitbench.fb,dstx,dsty,&blitbench.src,srcx,srcy,sprite->w,sprite->h);
+  else image_blit_colorkey(&blitbench.fb,dstx,dsty,&blitbench.src,srcx,srcy,sprite->w,sprite->h);
+}
+
+/* Draw (spritec) sprites over and over for BLITBENCH_SECONDS, several times, and return the median ns per pass.
+ * Then clear and draw the verification pattern, and hash it.
+ */
+
+static double blitbench_run(uint32_t *hash,const struct blitbench_sprite *spritev,int spritec) {
+  double nsv[BLITBENCH_REPEAT_LIMIT];
+  int r=0;
+  for (;r<blitbench.repeat;r++) {
+    int passc=0;
+    double starttime=blitbench_now(),elapsed;
+    do {
+      int j=64;
+      for (;j-->0;passc++) {
+        int i=spritec;
+        while (i-->0) blitbench_draw(spritev+i,passc+i);
+      }
+    } while ((elapsed=blitbench_now()-starttime)<BLITBENCH_SECONDS);
+    nsv[r]=(elapsed*1000000000.0)/passc;
+  }
+  memset(blitbench.fbv,0,sizeof(blitbench.fbv));
+  int i=0;
+  for (;i<256;i++) blitbench_draw(spritev+(i%spritec),i);
+  *hash=blitbench_hash(blitbench.fbv,BLITBENCH_FBW*BLITBENCH_FBH);
+  return blitbench_median(nsv,blitbench.repeat);
+}
+
+/* Benches.
+ */
+
+static int blitbench_blitterc() {
+  int c=0;
+  while (image_blitter_get(c)) c++;
+  return c;
+}
+
+static void blitbench_run_sprites() {
+  const struct blitbench_sprite *sprite=blitbench_spritev;
+  int i=sizeof(blitbench_spritev)/sizeof(struct blitbench_sprite);
+  for (;i-->0;sprite++) {
+    uint32_t refhash=0,hash;
+    double refns=0.0;
+    // Run blitters in reverse, so the portable one (always last) is the reference.
+    int p=blitbench_blitterc();
+    while (p-->0) {
+      const struct image_blitter *blitter=image_blitter_get(p);
+      image_blitter_select(blitter->name);
+      double ns=blitbench_run(&hash,sprite,1);
+      blitbench_report("sprite",blitter->name,sprite->name,sprite->w,sprite->h,sprite->flop,"blit",ns,refns,hash,refns&&(hash!=refhash));
+      if (!refns) {
+        refns=ns;
+        refhash=hash;
+      }
+    }
+  }
+}
+
+static void blitbench_run_frame() {
+  int spritec=sizeof(blitbench_spritev)/sizeof(struct blitbench_sprite);
+  uint32_t refhash=0,hash;
+  double refns=0.0;
+  int p=blitbench_blitterc();
+  while (p-->0) {
+    const struct image_blitter *blitter=image_blitter_get(p);
+    image_blitter_select(blitter->name);
+    double ns=blitbench_run(&hash,blitbench_spritev,spritec);
+    blitbench_report("frame",blitter->name,"all",BLITBENCH_FBW,BLITBENCH_FBH,0,"frame",ns,refns,hash,refns&&(hash!=refhash));
+    if (!refns) {
+      refns=ns;
+      refhash=hash;
+    }
+  }
+}
+
+/* Main.
+ */
+
+int main(int argc,char **argv) {
+  blitbench.repeat=3;
+  int argp=1;
+  for (;argp<argc;argp++) {
+    const char *arg=argv[argp];
+    if (!strcmp(arg,"--json")) blitbench.json=1;
+    else if (!memcmp(arg,"--label=",8)) blitbench.label=arg+8;
+    else if (!memcmp(arg,"--repeat=",9)) {
+      blitbench.repeat=atoi(arg+9);
+      if ((blitbench.repeat<1)||(blitbench.repeat>BLITBENCH_REPEAT_LIMIT)) {
+        fprintf(stderr,"%s: --repeat must be 1..%d\n",argv[0],BLITBENCH_REPEAT_LIMIT);
+        return 1;
+      }
+    } else {
+      fprintf(stderr,"Usage: %s [--json] [--label=STRING] [--repeat=COUNT]\n",argv[0]);
+      return 1;
+    }
+  }
+
+  // Source is a sprite sheet's worth of noise, with transparent runs of 1 to 8 pixels about a third of the time,
+  // so neither the branches nor the masks get an easy ride.
+  uint32_t seed=0x12345678;
+  int i=0;
+  while (i<BLITBENCH_SRCW*BLITBENCH_SRCH) {
+    seed=seed*1103515245+12345;
+    int runc=1+((seed>>8)&7);
+    uint16_t pixel=(((seed>>16)%3)==0)?0:(seed>>16)|1;
+    for (;runc-->0&&(i<BLITBENCH_SRCW*BLITBENCH_SRCH);i++) blitbench.srcv[i]=pixel;
+  }
+  blitbench.fb=(struct image){blitbench.fbv,BLITBENCH_FBW,BLITBENCH_FBH,BLITBENCH_FBW};
+  blitbench.src=(struct image){blitbench.srcv,BLITBENCH_SRCW,BLITBENCH_SRCH,BLITBENCH_SRCW};
+
+  if (blitbench.json) {
+    fprintf(stdout,"{\n  \"label\":\"");
+    const char *src=blitbench.label?blitbench.label:"";
+    for (;*src;src++) {
+      if ((*src=='"')||(*src=='\\')) fputc('\\',stdout);
+      if ((unsigned char)*src>=0x20) fputc(*src,stdout);
+    }
+    fprintf(stdout,"\",\n  \"repeat\":%d,\n  \"results\":[",blitbench.repeat);
+  } else if (blitbench.label) {
+    fprintf(stdout,"%s\n",blitbench.label);
+  }
+
+  blitbench_run_sprites();
+  blitbench_run_frame();
+
+  if (blitbench.json) fprintf(stdout,"\n  ],\n  \"ok\":%s\n}\n",blitbench.status?"false":"true");
+  return blitbench.status;
+}
@@ -10,6 +10,9 @@ void fiddle_drivers_quit() {
   #if PO_USE_inotify
     inotify_del(fiddle.inotify);
   #endif
+  #if PO_USE_upsample
+    upsample_del(fiddle.upsample);
+  #endif
 }
 
 /* Init.
@@ -19,7 +22,7 @@ int fiddle_drivers_init() {
 
   #if PO_USE_alsa
     struct alsa_delegate alsa_delegate={
-      .rate=22050,
+      .rate=FIDDLE_SYNTH_RATE,
       .chanc=1,
       .cb_pcm_out=(void*)fiddle_cb_pcm,
       .cb_midi_in=(void*)fiddle_cb_midi,
@@ -29,6 +32,11 @@ int fiddle_drivers_init() {
       return -1;
     }
     fiddle.rate=alsa_get_rate(fiddle.alsa);
+    #if PO_USE_upsample
+      if (fiddle.rate>FIDDLE_SYNTH_RATE) {
+        if (!(fiddle.upsample=upsample_new(FIDDLE_SYNTH_RATE,fiddle.rate,fiddle_cb_upsample,0))) return -1;
+      }
+    #endif
     fiddle.chanc=alsa_get_chanc(fiddle.alsa);
     fprintf(stderr,"Initialized ALSA: rate=%d chanc=%d\n",fiddle.rate,fiddle.chanc);
   #endif
@@ -42,7 +50,12 @@ int fiddle_drivers_init() {
     }
   #endif
   
-  synth_init(&fiddle.synth,fiddle.rate);
+  int synth_rate=fiddle.rate;
+  #if PO_USE_upsample
+    if (fiddle.upsample) synth_rate=upsample_get_srcrate(fiddle.upsample);
+  #endif
+  synth_init(&fiddle.synth,synth_rate);
+  __atomic_store_n(&fiddle.audio_ready,1,__ATOMIC_RELEASE);
 
   return 0;
 }
@@ -29,6 +29,14 @@
   #warning "inotify not enabled. Won't be able to detect changes to wave files."
 #endif
 
+#if PO_USE_upsample
+  #include "opt/upsample/upsample.h"
+#endif
+
+/* We ask the driver for this rate, and if it gives us more, upsample rather than running the synth faster.
+ */
+#define FIDDLE_SYNTH_RATE 22050
+
 #if PO_USE_inotify && PO_USE_ossmidi
   #include "opt/ossmidi/ossmidi.h"
 #else
@@ -42,7 +50,11 @@ extern struct fiddle {
   #if PO_USE_inotify
     struct inotify *inotify;
   #endif
+  #if PO_USE_upsample
+    struct upsample *upsample;
+  #endif
   int rate,chanc; // populated during fiddle_drivers_init()
+  int audio_ready; // set once (synth) is initialized; the driver may start calling before
   int pcmlock;
   struct midi_stream midi_stream;
   struct synth synth;
@@ -56,6 +68,9 @@ int fiddle_drivers_update();
 int fiddle_pcm_lock(); // driver unlocks it for you
 
 int fiddle_cb_pcm(int16_t *v,int c,void *donttouch);
+#if PO_USE_upsample
+  void fiddle_cb_upsample(int16_t *v,int c,void *userdata); // synth at FIDDLE_SYNTH_RATE, for the upsampler
+#endif
 int fiddle_cb_midi(const void *src,int srcc,void *donttouch);
 int fiddle_cb_inotify(const char *path,const char *base,int wd,void *userdata);
 
@@ -20,14 +20,28 @@ static void rcvsig(int sigid) {
 /* PCM callback.
  */
  
+#if PO_USE_upsample
+
+void fiddle_cb_upsample(int16_t *v,int c,void *userdata) {
+  synth_render(&fiddle.synth,v,c,1);
+}
+
+#endif
+ 
 int fiddle_cb_pcm(int16_t *v,int c,void *donttouch) {
+  if (!__atomic_load_n(&fiddle.audio_ready,__ATOMIC_ACQUIRE)) {
+    memset(v,0,c<<1);
+    return 0;
+  }
+  #if PO_USE_upsample
+    if (fiddle.upsample&&(fiddle.chanc>0)) {
+      upsample_render(fiddle.upsample,v,c/fiddle.chanc,fiddle.chanc);
+      return 0;
+    }
+  #endif
   switch (fiddle.chanc) {
-    case 1: {
-        for (;c-->0;v++) *v=synth_update(&fiddle.synth);
-      } break;
-    case 2: {
-        c>>=1;
-        for (;c-->0;v+=2) v[0]=v[1]=synth_update(&fiddle.synth);
+    case 1: case 2: {
+        synth_render(&fiddle.synth,v,c/fiddle.chanc,fiddle.chanc);
       } break;
     default: {
         memset(v,0,c<<1);
@@ -107,6 +121,7 @@ int main(int argc,char **argv) {
   }
   
   fiddle_drivers_quit();
+  fprintf(stderr,"%s: Peak polyphony %d/%d, %d voices stolen.\n",argv[0],fiddle.synth.voicepeak,SYNTH_VOICE_LIMIT,fiddle.synth.stealc);
   fprintf(stderr,"%s: Normal exit.\n",argv[0]);
   return 0;
 }
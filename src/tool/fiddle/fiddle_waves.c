@@ -14,19 +14,23 @@ static void generate_sine(int16_t *v,int c) {
 }
 
 /* Allocate all 8 waves and initialize to sines.
+ * A sine is its own band-limited version, so every level is the same.
  */
  
+#define FIDDLE_WAVE_SIZE (sizeof(int16_t)*512*SYNTH_WAVE_LEVELS)
+ 
 int fiddle_make_default_waves() {
   
   int16_t **v=fiddle.wavev;
   int i=8;
   for (;i-->0;v++) {
     if (*v) free(*v);
-    if (!(*v=malloc(512*sizeof(int16_t)))) return -1;
+    if (!(*v=malloc(FIDDLE_WAVE_SIZE))) return -1;
   }
   
   generate_sine(fiddle.wavev[0],512);
-  for (i=1;i<8;i++) memcpy(fiddle.wavev[i],fiddle.wavev[0],sizeof(int16_t)*512);
+  for (i=1;i<SYNTH_WAVE_LEVELS;i++) memcpy(fiddle.wavev[0]+i*512,fiddle.wavev[0],sizeof(int16_t)*512);
+  for (i=1;i<8;i++) memcpy(fiddle.wavev[i],fiddle.wavev[0],FIDDLE_WAVE_SIZE);
   
   memcpy(fiddle.synth.wavev,fiddle.wavev,sizeof(fiddle.wavev));
   return 0;
@@ -76,10 +80,10 @@ int fiddle_wave_possible_change(const char *path,const char *base) {
     return 0;
   }
   
-  int16_t tmp[512];
-  int err=fread(tmp,1,1024,child);
-  if (err!=1024) {
-    fprintf(stderr,"%s: Got unexpected length %d from mkwave. Expected 1024.\n",path,err);
+  int16_t tmp[512*SYNTH_WAVE_LEVELS];
+  int err=fread(tmp,1,sizeof(tmp),child);
+  if (err!=sizeof(tmp)) {
+    fprintf(stderr,"%s: Got unexpected length %d from mkwave. Expected %d.\n",path,err,(int)sizeof(tmp));
   } else {
     memcpy(fiddle.wavev[n],tmp,sizeof(tmp));
     double peak=0.0,rms=0.0;
@@ -7,6 +7,7 @@
 #include <string.h>
 #include <limits.h>
 #include <stdio.h>
+#include <unistd.h>
 
 /* midi_file_reader requires the output rate in hz.
  * We pick a number that will be easy to work with: The output tick rate times 256.
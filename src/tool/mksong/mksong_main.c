@@ -305,13 +305,26 @@ static int mksong_process(struct mksong *mksong) {
   return 0;
 }
 
+/* Extra arguments.
+ */
+ 
+static int BINARY_STDOUT=0;
+
+static int cb_arg(struct tool *tool,const char *arg) {
+  if (!strcmp(arg,"STDOUT")) {
+    BINARY_STDOUT=1;
+    return 1;
+  }
+  return -1;
+}
+
 /* Main.
  */
 
 int main(int argc,char **argv) {
   struct mksong _mksong={0};
   struct mksong *mksong=&_mksong;
-  if (tool_startup(TOOL,argc,argv,0)<0) return 1;
+  if (tool_startup(TOOL,argc,argv,cb_arg)<0) return 1;
   if (TOOL->terminate) return 0;
   if (tool_read_input(TOOL)<0) return 1;
   
@@ -320,8 +333,15 @@ int main(int argc,char **argv) {
     return 1;
   }
   
-  if (tool_generate_c_preamble(TOOL)<0) return 1;
-  if (tool_generate_c_array(TOOL,0,0,0,0,mksong->bin.v,mksong->bin.c)<0) return 1;
-  if (tool_write_output(TOOL)<0) return 1;
+  if (BINARY_STDOUT) {
+    if (write(STDOUT_FILENO,mksong->bin.v,mksong->bin.c)!=mksong->bin.c) {
+      fprintf(stderr,"%s: Failed to write binary output to stdout.\n",TOOL->exename);
+      return 1;
+    }
+  } else {
+    if (tool_generate_c_preamble(TOOL)<0) return 1;
+    if (tool_generate_c_array(TOOL,0,0,0,0,mksong->bin.v,mksong->bin.c)<0) return 1;
+    if (tool_write_output(TOOL)<0) return 1;
+  }
   return 0;
 }
@@ -1,5 +1,6 @@
 #include "tool/common/tool_utils.h"
 #include "tool/common/serial.h"
+#include "main/synth.h"
 #include <limits.h>
 #include <math.h>
 #include <string.h>
@@ -250,10 +251,60 @@ static void quantize(int16_t *dst,const double *src,int c) {
   }
 }
 
+/* Band-limited copies, each with half the harmonics of the one before.
+ * Level 0 is the wave verbatim. Each other level is resynthesized from the Fourier series of the original, truncated.
+ * Amplitude is not renormalized: A level should sound like the original with its top end cut, no louder.
+ */
+ 
+static int mklevels(int16_t *dst,const double *src,int c,int levelc) {
+  quantize(dst,src,c);
+  if (levelc<2) return 0;
+  int harmc=c>>1;
+  double *rev=malloc(sizeof(double)*(harmc+1));
+  double *imv=malloc(sizeof(double)*(harmc+1));
+  double *fv=malloc(sizeof(double)*c);
+  if (!rev||!imv||!fv) {
+    if (rev) free(rev);
+    if (imv) free(imv);
+    if (fv) free(fv);
+    return -1;
+  }
+  int h=0;
+  for (;h<=harmc;h++) {
+    double re=0.0,im=0.0;
+    int i=0;
+    for (;i<c;i++) {
+      double t=(M_PI*2.0*h*i)/c;
+      re+=src[i]*cos(t);
+      im+=src[i]*sin(t);
+    }
+    rev[h]=re/c;
+    imv[h]=im/c;
+  }
+  int level=1;
+  for (;level<levelc;level++) {
+    int limit=harmc>>level;
+    int i=0;
+    for (;i<c;i++) {
+      double sample=rev[0];
+      for (h=1;h<=limit;h++) {
+        double t=(M_PI*2.0*h*i)/c;
+        sample+=2.0*(rev[h]*cos(t)+imv[h]*sin(t));
+      }
+      fv[i]=sample;
+    }
+    quantize(dst+level*c,fv,c);
+  }
+  free(rev);
+  free(imv);
+  free(fv);
+  return 0;
+}
+
 /* Read text, generate wave.
  */
  
-static int mkwave(int16_t *dst,int dstc,struct tool *tool) {
+static int mkwave(int16_t *dst,int dstc,int levelc,struct tool *tool) {
   if (dstc<1) return -1;
   double *fv=malloc(sizeof(double)*dstc);
   double *scratch=malloc(sizeof(double)*dstc);
@@ -270,10 +321,10 @@ static int mkwave(int16_t *dst,int dstc,struct tool *tool) {
       return -1;
     }
   }
-  quantize(dst,fv,dstc);
+  int err=mklevels(dst,fv,dstc,levelc);
   free(fv);
   free(scratch);
-  return 0;
+  return err;
 }
 
 /* Extra arguments.
@@ -298,20 +349,23 @@ int main(int argc,char **argv) {
   if (tool.terminate) return 0;
   if (tool_read_input(&tool)<0) return 1;
   
-  int16_t wave[512];
-  if (mkwave(wave,512,&tool)<0) {
+  // Tiny gets just the wave as designed. SYNTH_WAVE_LEVELS is the target's, not ours, so we can't use it directly.
+  int levelc=tool.tiny?1:SYNTH_WAVE_LEVELS_NATIVE;
+  int16_t wave[512*SYNTH_WAVE_LEVELS_NATIVE];
+  int wavesize=sizeof(int16_t)*512*levelc;
+  if (mkwave(wave,512,levelc,&tool)<0) {
     fprintf(stderr,"%s: Failed to decode text wave\n",tool.srcpath);
     return 1;
   }
   
   if (BINARY_STDOUT) {
-    if (write(STDOUT_FILENO,wave,sizeof(wave))!=sizeof(wave)) {
+    if (write(STDOUT_FILENO,wave,wavesize)!=wavesize) {
       fprintf(stderr,"%s: Failed to write binary output to stdout.\n",tool.exename);
       return 1;
     }
   } else {
     if (tool_generate_c_preamble(&tool)<0) return 1;
-    if (tool_generate_c_array(&tool,"int16_t",7,0,0,wave,sizeof(wave))<0) return 1;
+    if (tool_generate_c_array(&tool,"int16_t",7,0,0,wave,wavesize)<0) return 1;
     if (tool_write_output(&tool)<0) return 1;
   }
   return 0;
@@ -0,0 +1,292 @@
+/* pixbench_main.c
+ * Benchmarks for framebuffer conversion, run by `make pixbench`.
+ *   convert: Every pixcvt kernel and output format, one 96x64 frame at a time.
+ *   scale: Fused convert+upscale at the scales our drivers use, against the loops the drivers had before pixcvt.
+ * Every kernel's output is hashed and must match the portable C one. Scaled output must match the old loops too,
+ * except RGB24, where the old loop left the low bits of each channel zero.
+ * Each timing is the median of several runs. Plain text by default, or JSON with --json.
+ */
+
+#include "opt/pixcvt/pixcvt.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define PIXBENCH_FBW 96
+#define PIXBENCH_FBH 64
+#define PIXBENCH_SECONDS 0.25 /* per run */
+#define PIXBENCH_SCALE_LIMIT 16
+#define PIXBENCH_REPEAT_LIMIT 15
+
+static const int pixbench_scalev[]={1,2,3,4,6,8,11,16};
+
+static struct pixbench {
+  int json;
+  const char *label;
+  int repeat;
+  int status;
+  int resultc;
+  uint16_t src[PIXBENCH_FBW*PIXBENCH_FBH];
+  uint8_t *dst; // big enough for the largest scaled output
+  int dstsize;
+} pixbench={0};
+
+static double pixbench_now() {
+  struct timespec tv={0};
+  clock_gettime(CLOCK_MONOTONIC,&tv);
+  return (double)tv.tv_sec+(double)tv.tv_nsec/1000000000.0;
+}
+
+static uint32_t pixbench_hash(const uint8_t *v,int c) {
+  uint32_t hash=0;
+  for (;c-->0;v++) hash=(hash<<5)+hash+*v;
+  return hash;
+}
+
+/* Report one result.
+ * (refns) is the baseline it should be compared against, or zero if it is one.
+ */
+
+static void pixbench_report(
+  const char *bench,const char *kernel,const char *format,
+  int scale,const char *unit,double ns,double refns,uint32_t hash,int mismatch
+) {
+  if (mismatch) pixbench.status=1;
+  double speedup=(refns>0.0)?refns/ns:1.0;
+  if (pixbench.json) {
+    fprintf(stdout,"%s\n    {\"bench\":\"%s\",\"kernel\":\"%s\",\"format\":\"%s\",\"scale\":%d,"
+      "\"unit\":\"%s\",\"ns\":%.4f,\"speedup\":%.4f,\"hash\":\"%08x\",\"match\":%s}",
+      pixbench.resultc?",":"",bench,kernel,format,scale,unit,ns,speedup,hash,mismatch?"false":"true"
+    );
+  } else {
+    fprintf(stdout,"%-8s %-6s %-9s scale=%-2d %12.3f ns/%-5s %5.2fx%s\n",
+      bench,kernel,format,scale,ns,unit,speedup,mismatch?"  *** OUTPUT MISMATCH ***":""
+    );
+  }
+  pixbench.resultc++;
+}
+
+static int pixbench_cmp_double(const void *a,const void *b) {
+  double x=*(const double*)a,y=*(const double*)b;
+  return (x<y)?-1:(x>y)?1:0;
+}
+
+static double pixbench_median(double *v,int c) {
+  qsort(v,c,sizeof(double),pixbench_cmp_double);
+  return v[c>>1];
+}
+
+/* The drivers' loops before pixcvt, kept only as the "before".
+ */
+
+static void pixbench_legacy_x11(uint8_t *dstv,int scale) {
+  const uint16_t *src=pixbench.src;
+  uint32_t *dst=(uint32_t*)dstv;
+  int dstw=PIXBENCH_FBW*scale;
+  int cpc=dstw*4;
+  int yi=PIXBENCH_FBH;
+  for (;yi-->0;) {
+    uint32_t *dststart=dst;
+    int xi=PIXBENCH_FBW;
+    for (;xi-->0;src++) {
+      uint8_t rgb[3];
+      rgb[0]=((*src)>>5)&0xf8; rgb[0]|=rgb[0]>>5;
+      rgb[1]=(((*src)<<5)&0xe0)|(((*src)>>11)&0x1c); rgb[1]|=rgb[1]>>6;
+      rgb[2]=((*src)&0xf8); rgb[2]|=rgb[2]>>5;
+      uint32_t pixel=(rgb[0]<<16)|(rgb[1]<<8)|rgb[2];
+      int ri=scale;
+      for (;ri-->0;dst++) *dst=pixel;
+    }
+    int ri=scale-1;
+    for (;ri-->0;dst+=dstw) memcpy(dst,dststart,cpc);
+  }
+}
+
+static void pixbench_legacy_drmfb(uint8_t *dstv,int scale) {
+  uint16_t *dstrow=(uint16_t*)dstv;
+  int stridewords=PIXBENCH_FBW*scale;
+  int cpc=stridewords*sizeof(uint16_t);
+  const uint16_t *srcrow=pixbench.src;
+  int yi=PIXBENCH_FBH;
+  for (;yi-->0;srcrow+=PIXBENCH_FBW) {
+    uint16_t *dstp=dstrow;
+    const uint16_t *srcp=srcrow;
+    int xi=PIXBENCH_FBW;
+    for (;xi-->0;srcp++) {
+      uint16_t pixel=*srcp;
+      uint8_t r=(pixel>>8)&0x1f;
+      uint8_t b=(pixel>>3)&0x1f;
+      uint8_t g=((pixel<<3)&0x38)|(pixel>>13);
+      pixel=(r<<11)|(g<<5)|b;
+      int ri=scale;
+      for (;ri-->0;dstp++) *dstp=pixel;
+    }
+    dstp=dstrow;
+    dstrow+=stridewords;
+    int ri=scale-1;
+    for (;ri-->0;dstrow+=stridewords) memcpy(dstrow,dstp,cpc);
+  }
+}
+
+static void pixbench_legacy_drmgx(uint8_t *dst,int scale) {
+  const uint8_t *src=(const uint8_t*)pixbench.src;
+  int pxc=PIXBENCH_FBW*PIXBENCH_FBH;
+  for (;pxc-->0;dst+=3,src+=2) {
+    dst[2]=((src[0]&0xf8));
+    dst[1]=((src[0]&0x07)<<5)|((src[1]&0xe0)>>3);
+    dst[0]=((src[1]&0x1f)<<3);
+  }
+}
+
+/* Run one thing over and over for PIXBENCH_SECONDS, several times, and return the median ns per frame.
+ * (legacy) null to use the selected pixcvt kernel.
+ */
+
+static double pixbench_run(uint32_t *hash,int fmt,int scale,void (*legacy)(uint8_t *dst,int scale)) {
+  int pixelsize=pixcvt_pixel_size(fmt);
+  int stride=PIXBENCH_FBW*scale*pixelsize;
+  int size=stride*PIXBENCH_FBH*scale;
+  double nsv[PIXBENCH_REPEAT_LIMIT];
+  int i=0;
+  for (;i<pixbench.repeat;i++) {
+    int framec=0;
+    double starttime=pixbench_now(),elapsed;
+    do {
+      int j=16;
+      for (;j-->0;framec++) {
+        if (legacy) legacy(pixbench.dst,scale);
+        else if (scale==1) pixcvt_convert(pixbench.dst,fmt,pixbench.src,PIXBENCH_FBW*PIXBENCH_FBH);
+        else pixcvt_scale(pixbench.dst,stride,fmt,pixbench.src,PIXBENCH_FBW,PIXBENCH_FBW,PIXBENCH_FBH,scale);
+      }
+    } while ((elapsed=pixbench_now()-starttime)<PIXBENCH_SECONDS);
+    nsv[i]=(elapsed*1000000000.0)/framec;
+  }
+  *hash=pixbench_hash(pixbench.dst,size);
+  return pixbench_median(nsv,pixbench.repeat);
+}
+
+/* Benches.
+ */
+
+static const struct pixbench_format {
+  int fmt;
+  const char *name;
+  void (*legacy)(uint8_t *dst,int scale);
+  int legacy_match; // nonzero if the legacy loop's output should match ours
+  int legacy_scales; // nonzero if the legacy loop can scale
+} pixbench_formatv[]={
+  {PIXCVT_FMT_RGB565,"rgb565",pixbench_legacy_drmfb,1,1},
+  {PIXCVT_FMT_XRGB8888,"xrgb8888",pixbench_legacy_x11,1,1},
+  {PIXCVT_FMT_XBGR8888,"xbgr8888",0,0,0},
+  {PIXCVT_FMT_RGB24,"rgb24",pixbench_legacy_drmgx,0,0},
+};
+
+static int pixbench_kernelc() {
+  int c=0;
+  while (pixcvt_get(c)) c++;
+  return c;
+}
+
+static void pixbench_run_convert() {
+  const struct pixbench_format *format=pixbench_formatv;
+  int i=sizeof(pixbench_formatv)/sizeof(struct pixbench_format);
+  for (;i-->0;format++) {
+    uint32_t refhash=0,hash;
+    double refns=0.0;
+    // Run kernels in reverse, so the portable one (always last) is the reference.
+    int p=pixbench_kernelc();
+    while (p-->0) {
+      const struct pixcvt_kernel *kernel=pixcvt_get(p);
+      pixcvt_select(kernel->name);
+      double ns=pixbench_run(&hash,format->fmt,1,0)/(PIXBENCH_FBW*PIXBENCH_FBH);
+      pixbench_report("convert",kernel->name,format->name,1,"pixel",ns,refns,hash,refns&&(hash!=refhash));
+      if (!refns) {
+        refns=ns;
+        refhash=hash;
+      }
+    }
+  }
+}
+
+static void pixbench_run_scale() {
+  const struct pixbench_format *format=pixbench_formatv;
+  int i=sizeof(pixbench_formatv)/sizeof(struct pixbench_format);
+  for (;i-->0;format++) {
+    int scalep=0;
+    for (;scalep<sizeof(pixbench_scalev)/sizeof(int);scalep++) {
+      int scale=pixbench_scalev[scalep];
+      if ((scale>1)&&(format->fmt==PIXCVT_FMT_RGB24)) continue; // nobody scales RGB24
+      uint32_t refhash=0,hash;
+      double refns=0.0;
+      if (format->legacy&&((scale==1)||format->legacy_scales)) {
+        refns=pixbench_run(&refhash,format->fmt,scale,format->legacy);
+        pixbench_report("scale","legacy",format->name,scale,"frame",refns,0.0,refhash,0);
+        if (!format->legacy_match) refhash=0;
+      }
+      int p=pixbench_kernelc();
+      while (p-->0) {
+        const struct pixcvt_kernel *kernel=pixcvt_get(p);
+        pixcvt_select(kernel->name);
+        double ns=pixbench_run(&hash,format->fmt,scale,0);
+        pixbench_report("scale",kernel->name,format->name,scale,"frame",ns,refns,hash,refhash&&(hash!=refhash));
+        if (!refns) refns=ns;
+        if (!refhash) refhash=hash;
+      }
+    }
+  }
+}
+
+/* Main.
+ */
+
+int main(int argc,char **argv) {
+  pixbench.repeat=3;
+  int argp=1;
+  for (;argp<argc;argp++) {
+    const char *arg=argv[argp];
+    if (!strcmp(arg,"--json")) pixbench.json=1;
+    else if (!memcmp(arg,"--label=",8)) pixbench.label=arg+8;
+    else if (!memcmp(arg,"--repeat=",9)) {
+      pixbench.repeat=atoi(arg+9);
+      if ((pixbench.repeat<1)||(pixbench.repeat>PIXBENCH_REPEAT_LIMIT)) {
+        fprintf(stderr,"%s: --repeat must be 1..%d\n",argv[0],PIXBENCH_REPEAT_LIMIT);
+        return 1;
+      }
+    } else {
+      fprintf(stderr,"Usage: %s [--json] [--label=STRING] [--repeat=COUNT]\n",argv[0]);
+      return 1;
+    }
+  }
+
+  // Every possible pixel appears, in a scrambled order so the lookup table gets no free locality.
+  uint32_t seed=0x12345678;
+  int i=0;
+  for (;i<PIXBENCH_FBW*PIXBENCH_FBH;i++) {
+    seed=seed*1103515245+12345;
+    pixbench.src[i]=seed>>16;
+  }
+  pixbench.dstsize=PIXBENCH_FBW*PIXBENCH_SCALE_LIMIT*4*PIXBENCH_FBH*PIXBENCH_SCALE_LIMIT;
+  if (!(pixbench.dst=malloc(pixbench.dstsize))) return 1;
+
+  if (pixbench.json) {
+    fprintf(stdout,"{\n  \"label\":\"");
+    const char *src=pixbench.label?pixbench.label:"";
+    for (;*src;src++) {
+      if ((*src=='"')||(*src=='\\')) fputc('\\',stdout);
+      if ((unsigned char)*src>=0x20) fputc(*src,stdout);
+    }
+    fprintf(stdout,"\",\n  \"fbw\":%d,\n  \"fbh\":%d,\n  \"repeat\":%d,\n  \"results\":[",
+      PIXBENCH_FBW,PIXBENCH_FBH,pixbench.repeat
+    );
+  } else if (pixbench.label) {
+    fprintf(stdout,"%s\n",pixbench.label);
+  }
+
+  pixbench_run_convert();
+  pixbench_run_scale();
+
+  if (pixbench.json) fprintf(stdout,"\n  ],\n  \"ok\":%s\n}\n",pixbench.status?"false":"true");
+  free(pixbench.dst);
+  return pixbench.status;
+}
@@ -0,0 +1,60 @@
+/* render_internal.h
+ * Render songs to PCM offline, as fast as the synthesizer can go.
+ * With no inputs, we render every embedded song. Otherwise each input is a MIDI file or the binary output of `mksong --STDOUT=BINARY`.
+ * Songs are independent jobs, spread across a pool of threads.
+ */
+
+#ifndef RENDER_INTERNAL_H
+#define RENDER_INTERNAL_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <stdint.h>
+#include <pthread.h>
+#include "main/synth.h"
+#include "main/synth_internal.h"
+#include "main/data.h"
+
+#define RENDER_FORMAT_WAV 1
+#define RENDER_FORMAT_RAW 2
+
+#define RENDER_BLOCK 1024 /* frames per synth_render() call */
+#define RENDER_CHANC_LIMIT 8
+
+extern struct render {
+  const char *exename;
+  int rate;
+  int chanc;
+  int format;
+  int threadc;
+  int limit; // seconds of output per song, in case one never ends
+  const char *outpath; // file for a single job, directory for many, null to discard
+
+  struct render_job {
+    char *name; // for reports and output file names
+    const uint8_t *src; // combined song file: header, song, fakesheet
+    int srcc;
+    void *srcown; // if we allocated (src)
+    char *dstpath;
+    // Results:
+    int status;
+    int64_t framec;
+    double elapsed; // seconds spent in the synthesizer
+    uint64_t hash; // FNV-1a over the little-endian PCM
+  } *jobv;
+  int jobc,joba;
+
+  int jobp;
+  pthread_mutex_t jobmtx;
+} render;
+
+double render_now();
+
+struct render_job *render_job_add(const char *name);
+int render_job_load_file(struct render_job *job,const char *path);
+int render_job_run(struct render_job *job);
+void render_job_cleanup(struct render_job *job);
+
+#endif
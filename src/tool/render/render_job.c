@@ -0,0 +1,226 @@
+#include "render_internal.h"
+#include "tool/common/fs.h"
+
+/* Add job.
+ */
+
+struct render_job *render_job_add(const char *name) {
+  if (render.jobc>=render.joba) {
+    int na=render.joba+8;
+    if (na>INT_MAX/sizeof(struct render_job)) return 0;
+    void *nv=realloc(render.jobv,sizeof(struct render_job)*na);
+    if (!nv) return 0;
+    render.jobv=nv;
+    render.joba=na;
+  }
+  struct render_job *job=render.jobv+render.jobc++;
+  memset(job,0,sizeof(struct render_job));
+  if (!(job->name=strdup(name))) {
+    render.jobc--;
+    return 0;
+  }
+  return job;
+}
+
+/* Cleanup.
+ */
+
+void render_job_cleanup(struct render_job *job) {
+  if (job->name) free(job->name);
+  if (job->srcown) free(job->srcown);
+  if (job->dstpath) free(job->dstpath);
+}
+
+/* Append (src) to a shell command in single quotes, so spaces and metacharacters are literal.
+ * Returns the new length, which may exceed (dsta).
+ */
+
+static int render_shell_quote(char *dst,int dstc,int dsta,const char *src,int srcc) {
+  #define PUT(ch) { if (dstc<dsta) dst[dstc]=(ch); dstc++; }
+  PUT('\'')
+  for (;srcc-->0;src++) {
+    if (*src=='\'') { // close, escaped quote, reopen
+      PUT('\'') PUT('\\') PUT('\'') PUT('\'')
+    } else PUT(*src)
+  }
+  PUT('\'')
+  #undef PUT
+  if (dstc<dsta) dst[dstc]=0;
+  return dstc;
+}
+
+/* Convert MIDI file by running mksong, which should be next to us.
+ */
+
+static int render_job_convert_midi(struct render_job *job,const char *path) {
+  int dirc=0,i=0;
+  for (;render.exename[i];i++) if (render.exename[i]=='/') dirc=i+1;
+  char cmd[1024];
+  int cmdc=0;
+  if (dirc) cmdc=render_shell_quote(cmd,cmdc,sizeof(cmd),render.exename,dirc);
+  if (cmdc<sizeof(cmd)) cmdc+=snprintf(cmd+cmdc,sizeof(cmd)-cmdc,"mksong --STDOUT=BINARY ");
+  cmdc=render_shell_quote(cmd,cmdc,sizeof(cmd),path,strlen(path));
+  if ((cmdc<1)||(cmdc>=sizeof(cmd))) return -1;
+  FILE *child=popen(cmd,"r");
+  if (!child) {
+    fprintf(stderr,"%s: Failed to open child process `%s`\n",path,cmd);
+    return -1;
+  }
+  uint8_t *v=0;
+  int c=0,a=0;
+  while (1) {
+    if (c>=a) {
+      if (a>INT_MAX-65536) break;
+      void *nv=realloc(v,a+=65536);
+      if (!nv) break;
+      v=nv;
+    }
+    int err=fread(v+c,1,a-c,child);
+    if (err<=0) break;
+    c+=err;
+  }
+  if (pclose(child)||!c) {
+    fprintf(stderr,"%s: `%s` failed\n",path,cmd);
+    if (v) free(v);
+    return -1;
+  }
+  job->src=job->srcown=v;
+  job->srcc=c;
+  return 0;
+}
+
+/* Load file.
+ */
+
+int render_job_load_file(struct render_job *job,const char *path) {
+  int pathc=0;
+  while (path[pathc]) pathc++;
+  if ((pathc>=4)&&!strcmp(path+pathc-4,".mid")) return render_job_convert_midi(job,path);
+  void *src=0;
+  int srcc=file_read(&src,path);
+  if (srcc<0) {
+    fprintf(stderr,"%s: Failed to read file\n",path);
+    return -1;
+  }
+  job->src=job->srcown=src;
+  job->srcc=srcc;
+  return 0;
+}
+
+/* Output.
+ */
+
+static void render_wav_header(uint8_t *dst,int64_t framec) {
+  uint32_t datac=framec*render.chanc*2;
+  uint32_t byterate=render.rate*render.chanc*2;
+  #define U32(p,v) { dst[p]=(v); dst[p+1]=(v)>>8; dst[p+2]=(v)>>16; dst[p+3]=(v)>>24; }
+  #define U16(p,v) { dst[p]=(v); dst[p+1]=(v)>>8; }
+  memcpy(dst,"RIFF",4);
+  U32(4,36+datac)
+  memcpy(dst+8,"WAVEfmt ",8);
+  U32(16,16)
+  U16(20,1) // PCM
+  U16(22,render.chanc)
+  U32(24,render.rate)
+  U32(28,byterate)
+  U16(32,render.chanc*2)
+  U16(34,16)
+  memcpy(dst+36,"data",4);
+  U32(40,datac)
+  #undef U32
+  #undef U16
+}
+
+/* Run job.
+ */
+
+int render_job_run(struct render_job *job) {
+  job->status=-1;
+
+  // Header is the same thing game_begin() reads; we also validate lengths since we don't trust the file.
+  if (job->srcc<8) {
+    fprintf(stderr,"%s: Short file\n",job->name);
+    return -1;
+  }
+  const uint8_t *hdr=job->src;
+  int addlhdrlen=hdr[2]|(hdr[3]<<8);
+  int songlen=hdr[4]|(hdr[5]<<8);
+  if (8+addlhdrlen+songlen>job->srcc) {
+    fprintf(stderr,"%s: Song length %d exceeds file (%d)\n",job->name,songlen,job->srcc);
+    return -1;
+  }
+
+  struct synth *synth=calloc(1,sizeof(struct synth));
+  if (!synth) return -1;
+  if (synth_init(synth,render.rate)<0) {
+    fprintf(stderr,"%s: Failed to initialize synthesizer at %d Hz\n",job->name,render.rate);
+    free(synth);
+    return -1;
+  }
+  synth->wavev[0]=wave0;
+  synth->wavev[1]=wave1;
+  synth->wavev[2]=wave2;
+  synth->wavev[3]=wave3;
+  synth->wavev[4]=wave4;
+  synth->wavev[5]=wave5;
+  synth->wavev[6]=wave6;
+  synth->wavev[7]=wave7;
+  if (synth_play_song(synth,hdr+8+addlhdrlen,songlen)<0) {
+    fprintf(stderr,"%s: Rejecting malformed song.\n",job->name);
+    free(synth);
+    return -1;
+  }
+
+  FILE *f=0;
+  uint8_t wavhdr[44];
+  if (job->dstpath) {
+    if (!(f=fopen(job->dstpath,"wb"))) {
+      fprintf(stderr,"%s: Failed to open for writing\n",job->dstpath);
+      free(synth);
+      return -1;
+    }
+    if (render.format==RENDER_FORMAT_WAV) {
+      render_wav_header(wavhdr,0);
+      fwrite(wavhdr,1,sizeof(wavhdr),f);
+    }
+  }
+
+  // Render until the song ends and its voices release, then a block more of silence at most.
+  int16_t buf[RENDER_BLOCK*RENDER_CHANC_LIMIT];
+  int samplec=RENDER_BLOCK*render.chanc;
+  int64_t limit=(int64_t)render.limit*render.rate;
+  uint64_t hash=0xcbf29ce484222325ull;
+  job->framec=0;
+  job->elapsed=0.0;
+  while ((synth->song||synth->voicec)&&(job->framec<limit)) {
+    double starttime=render_now();
+    synth_render(synth,buf,RENDER_BLOCK,render.chanc);
+    job->elapsed+=render_now()-starttime;
+    job->framec+=RENDER_BLOCK;
+    const int16_t *v=buf;
+    int i=samplec;
+    for (;i-->0;v++) {
+      hash=(hash^(uint8_t)*v)*0x100000001b3ull;
+      hash=(hash^(uint8_t)(*v>>8))*0x100000001b3ull;
+    }
+    if (f&&(fwrite(buf,2,samplec,f)!=samplec)) {
+      fprintf(stderr,"%s: Error writing output\n",job->dstpath);
+      fclose(f);
+      free(synth);
+      return -1;
+    }
+  }
+  job->hash=hash;
+
+  if (f) {
+    if (render.format==RENDER_FORMAT_WAV) {
+      render_wav_header(wavhdr,job->framec);
+      fseek(f,0,SEEK_SET);
+      fwrite(wavhdr,1,sizeof(wavhdr),f);
+    }
+    fclose(f);
+  }
+  free(synth);
+  job->status=0;
+  return 0;
+}
@@ -0,0 +1,229 @@
+#include "render_internal.h"
+#include <time.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+struct render render={0};
+
+double render_now() {
+  struct timespec tv={0};
+  clock_gettime(CLOCK_MONOTONIC,&tv);
+  return (double)tv.tv_sec+(double)tv.tv_nsec/1000000000.0;
+}
+
+/* argv
+ */
+
+static void render_print_help() {
+  fprintf(stderr,"Usage: %s [OPTIONS] [INPUT...]\n",render.exename);
+  fprintf(stderr,
+    "With no INPUT, render every embedded song.\n"
+    "INPUT is a MIDI file (converted by mksong, which must be next to us), or output of `mksong --STDOUT=BINARY`.\n"
+    "OPTIONS:\n"
+    "  --rate=HZ              Default 22050.\n"
+    "  --chanc=INT            Default 1.\n"
+    "  --format=wav|raw       Default wav. Raw is 16-bit native-endian, interleaved.\n"
+    "  --out=PATH             Output file, or directory if more than one song. Omit to measure only.\n"
+    "  --threads=INT          Default one per CPU.\n"
+    "  --mixer=NAME           Default is the best one supported. Try 'c' for the portable one.\n"
+    "  --limit=SECONDS        Stop each song after so long. Default 600.\n"
+  );
+}
+
+static const char *render_arg(const char *arg,const char *k) {
+  int kc=0;
+  while (k[kc]) kc++;
+  if (memcmp(arg,k,kc)) return 0;
+  if (arg[kc]!='=') return 0;
+  return arg+kc+1;
+}
+
+static int render_arg_int(int *dst,const char *v,int lo,int hi) {
+  int n=0;
+  if (!*v) return -1;
+  for (;*v;v++) {
+    if ((*v<'0')||(*v>'9')) return -1;
+    n=n*10+(*v)-'0';
+    if (n>hi) return -1;
+  }
+  if (n<lo) return -1;
+  *dst=n;
+  return 0;
+}
+
+/* Name for a song we got from a path: basename without extension.
+ * Embedded songs get their display name, lowercased with underscores.
+ */
+
+static void render_name_from_path(char *dst,int dsta,const char *path) {
+  const char *base=path;
+  int i=0;
+  for (;path[i];i++) if (path[i]=='/') base=path+i+1;
+  int c=0;
+  while (base[c]&&(base[c]!='.')&&(c<dsta-1)) { dst[c]=base[c]; c++; }
+  dst[c]=0;
+}
+
+static void render_name_from_display(char *dst,int dsta,const char *name) {
+  int c=0;
+  for (;*name&&(c<dsta-1);name++) {
+    if ((*name>='A')&&(*name<='Z')) dst[c++]=(*name)+0x20;
+    else if (((*name>='a')&&(*name<='z'))||((*name>='0')&&(*name<='9'))) dst[c++]=*name;
+    else if (c&&(dst[c-1]!='_')) dst[c++]='_';
+  }
+  dst[c]=0;
+}
+
+/* Populate jobs' output paths, once we know how many there are.
+ */
+
+static int render_set_output_paths() {
+  if (!render.outpath) return 0;
+  if (render.jobc==1) {
+    if (!(render.jobv[0].dstpath=strdup(render.outpath))) return -1;
+    return 0;
+  }
+  mkdir(render.outpath,0775);
+  const char *sfx=(render.format==RENDER_FORMAT_WAV)?"wav":"raw";
+  struct render_job *job=render.jobv;
+  int i=render.jobc;
+  for (;i-->0;job++) {
+    char path[1024];
+    int pathc=snprintf(path,sizeof(path),"%s/%s.%s",render.outpath,job->name,sfx);
+    if ((pathc<1)||(pathc>=sizeof(path))) return -1;
+    if (!(job->dstpath=strdup(path))) return -1;
+  }
+  return 0;
+}
+
+/* Thread pool: Each worker takes the next job until there aren't any.
+ */
+
+static void *render_worker(void *dummy) {
+  while (1) {
+    if (pthread_mutex_lock(&render.jobmtx)) return 0;
+    int p=render.jobp++;
+    pthread_mutex_unlock(&render.jobmtx);
+    if (p>=render.jobc) return 0;
+    render_job_run(render.jobv+p);
+  }
+}
+
+static int render_run_jobs() {
+  int threadc=render.threadc;
+  if (threadc>render.jobc) threadc=render.jobc;
+  if (threadc<1) threadc=1;
+  pthread_t *threadv=calloc(threadc,sizeof(pthread_t));
+  if (!threadv) return -1;
+  if (pthread_mutex_init(&render.jobmtx,0)) {
+    free(threadv);
+    return -1;
+  }
+  int i=0;
+  for (;i<threadc;i++) {
+    if (pthread_create(threadv+i,0,render_worker,0)) break;
+  }
+  if (!i) render_worker(0);
+  while (i-->0) pthread_join(threadv[i],0);
+  pthread_mutex_destroy(&render.jobmtx);
+  free(threadv);
+  return 0;
+}
+
+/* Main.
+ */
+
+int main(int argc,char **argv) {
+  render.exename=((argc>=1)&&argv[0])?argv[0]:"render";
+  render.rate=22050;
+  render.chanc=1;
+  render.format=RENDER_FORMAT_WAV;
+  render.threadc=sysconf(_SC_NPROCESSORS_ONLN);
+  render.limit=600;
+  const char *mixer=0;
+
+  int argp=1,inputc=0;
+  for (;argp<argc;argp++) {
+    const char *arg=argv[argp],*v;
+    if (!strcmp(arg,"--help")) {
+      render_print_help();
+      return 0;
+    } else if (v=render_arg(arg,"--rate")) {
+      if (render_arg_int(&render.rate,v,100,1000000)<0) { fprintf(stderr,"%s: Invalid rate '%s'\n",render.exename,v); return 1; }
+    } else if (v=render_arg(arg,"--chanc")) {
+      if (render_arg_int(&render.chanc,v,1,RENDER_CHANC_LIMIT)<0) { fprintf(stderr,"%s: Invalid chanc '%s'\n",render.exename,v); return 1; }
+    } else if (v=render_arg(arg,"--threads")) {
+      if (render_arg_int(&render.threadc,v,1,256)<0) { fprintf(stderr,"%s: Invalid threads '%s'\n",render.exename,v); return 1; }
+    } else if (v=render_arg(arg,"--limit")) {
+      if (render_arg_int(&render.limit,v,1,INT_MAX/1000000)<0) { fprintf(stderr,"%s: Invalid limit '%s'\n",render.exename,v); return 1; }
+    } else if (v=render_arg(arg,"--format")) {
+      if (!strcmp(v,"wav")) render.format=RENDER_FORMAT_WAV;
+      else if (!strcmp(v,"raw")) render.format=RENDER_FORMAT_RAW;
+      else { fprintf(stderr,"%s: Unknown format '%s'\n",render.exename,v); return 1; }
+    } else if (v=render_arg(arg,"--out")) {
+      render.outpath=v;
+    } else if (v=render_arg(arg,"--mixer")) {
+      mixer=v;
+    } else if (arg[0]=='-') {
+      fprintf(stderr,"%s: Unexpected argument '%s'\n",render.exename,arg);
+      return 1;
+    } else {
+      char name[256];
+      render_name_from_path(name,sizeof(name),arg);
+      struct render_job *job=render_job_add(name);
+      if (!job) return 1;
+      if (render_job_load_file(job,arg)<0) return 1;
+      inputc++;
+    }
+  }
+
+  // Select the mixer before any thread can race synth_init() to do it.
+  if (synth_mixer_select(mixer)<0) {
+    fprintf(stderr,"%s: Mixer '%s' not available\n",render.exename,mixer);
+    return 1;
+  }
+
+  if (!inputc) {
+    const struct songinfo *songinfo=songinfov;
+    int i=songinfoc;
+    for (;i-->0;songinfo++) {
+      char name[256];
+      render_name_from_display(name,sizeof(name),songinfo->name);
+      struct render_job *job=render_job_add(name);
+      if (!job) return 1;
+      const uint8_t *hdr=songinfo->song;
+      job->src=hdr;
+      job->srcc=8+(hdr[2]|(hdr[3]<<8))+(hdr[4]|(hdr[5]<<8))+(hdr[6]|(hdr[7]<<8));
+    }
+  }
+  if (render_set_output_paths()<0) return 1;
+
+  double starttime=render_now();
+  if (render_run_jobs()<0) return 1;
+  double walltime=render_now()-starttime;
+
+  int status=0;
+  double audiotime=0.0;
+  const struct render_job *job=render.jobv;
+  int i=render.jobc;
+  for (;i-->0;job++) {
+    if (job->status<0) {
+      fprintf(stdout,"%-24s FAILED\n",job->name);
+      status=1;
+      continue;
+    }
+    double seconds=(double)job->framec/render.rate;
+    audiotime+=seconds;
+    fprintf(stdout,"%-24s %8.2f s audio %8.3f s synth %8.1fx realtime  %016llx\n",
+      job->name,seconds,job->elapsed,(job->elapsed>0.0)?seconds/job->elapsed:0.0,(unsigned long long)job->hash
+    );
+  }
+  fprintf(stdout,"%d songs, %.2f s audio in %.3f s wall, %.1fx realtime, mixer %s, %d Hz, %d threads\n",
+    render.jobc,audiotime,walltime,(walltime>0.0)?audiotime/walltime:0.0,synth_mixer->name,render.rate,
+    (render.threadc<render.jobc)?render.threadc:render.jobc
+  );
+
+  for (job=render.jobv,i=render.jobc;i-->0;job++) render_job_cleanup((struct render_job*)job);
+  if (render.jobv) free(render.jobv);
+  return status;
+}
@@ -0,0 +1,440 @@
+/* synthbench_main.c
+ * Benchmarks for the synthesizer, run by `make bench`.
+ *   voices: Every mixer at several rates and voice counts: held, releasing, and cycling through ADSR.
+ *   song: Each embedded song start to finish, every mixer and rate.
+ *   update: Per-sample synth_update() against block synth_render(), on each song.
+ *   envelope: Envelope kernels against the old per-sample division, per voice-sample.
+ * Every mixer's output is hashed and must match the portable C one, and per-sample must match block.
+ * Each timing is the median of several runs. Plain text by default, or JSON with --json.
+ */
+
+#include "main/synth.h"
+#include "main/synth_internal.h"
+#include "main/data.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#if defined(__x86_64__)||defined(__i386__)
+  #include <x86intrin.h>
+  #define SYNTHBENCH_TSC 1
+#endif
+
+#define SYNTHBENCH_SECONDS 5
+#define SYNTHBENCH_SONG_LIMIT 600 /* seconds */
+#define SYNTHBENCH_BLOCK 1024
+#define SYNTHBENCH_REPEAT_LIMIT 15
+
+static const int synthbench_ratev[]={22050,44100,48000};
+
+static struct synthbench {
+  int json;
+  const char *label;
+  int repeat;
+  int status;
+  int resultc;
+  int16_t *pcm; // output of the run in progress, hashed after timing
+  int pcma; // frames
+} synthbench={0};
+
+static int16_t wave[512*SYNTH_WAVE_LEVELS]; // a sine at every level
+
+static double synthbench_now() {
+  struct timespec tv={0};
+  clock_gettime(CLOCK_MONOTONIC,&tv);
+  return (double)tv.tv_sec+(double)tv.tv_nsec/1000000000.0;
+}
+
+static int synthbench_require_pcm(int framec) {
+  if (framec<=synthbench.pcma) return 0;
+  void *nv=realloc(synthbench.pcm,sizeof(int16_t)*framec);
+  if (!nv) return -1;
+  synthbench.pcm=nv;
+  synthbench.pcma=framec;
+  return 0;
+}
+
+static uint32_t synthbench_hash(const int16_t *v,int c) {
+  uint32_t hash=0;
+  for (;c-->0;v++) hash=(hash<<5)+hash+(uint16_t)*v;
+  return hash;
+}
+
+/* Report one result.
+ * (refns) is the baseline it should be compared against, or zero if it is one.
+ * (mismatch) nonzero if the output differs from the baseline's.
+ */
+
+static void synthbench_report(
+  const char *bench,const char *mixer,const char *scenario,
+  int rate,int voicec,const char *unit,double ns,double refns,uint32_t hash,int mismatch
+) {
+  if (mismatch) synthbench.status=1;
+  double speedup=(refns>0.0)?refns/ns:1.0;
+  if (synthbench.json) {
+    fprintf(stdout,"%s\n    {\"bench\":\"%s\",\"mixer\":\"%s\",\"scenario\":\"%s\",\"rate\":%d,\"voices\":%d,"
+      "\"unit\":\"%s\",\"ns\":%.4f,\"speedup\":%.4f,\"hash\":\"%08x\",\"match\":%s}",
+      synthbench.resultc?",":"",bench,mixer,scenario,rate,voicec,unit,ns,speedup,hash,mismatch?"false":"true"
+    );
+  } else {
+    fprintf(stdout,"%-8s %-6s %-22s %6d Hz voices=%-3d %9.3f ns/%-12s %5.2fx%s\n",
+      bench,mixer,scenario,rate,voicec,ns,unit,speedup,mismatch?"  *** OUTPUT MISMATCH ***":""
+    );
+  }
+  synthbench.resultc++;
+}
+
+static int synthbench_cmp_double(const void *a,const void *b) {
+  double x=*(const double*)a,y=*(const double*)b;
+  return (x<y)?-1:(x>y)?1:0;
+}
+
+static double synthbench_median(double *v,int c) {
+  qsort(v,c,sizeof(double),synthbench_cmp_double);
+  return v[c>>1];
+}
+
+/* Voice scenarios, rendered once with the current mixer.
+ * SUSTAIN: Every voice held at full level.
+ * RELEASE: Every voice in its release phase, retriggered as they end.
+ * ADSR: Voices cycle on and off through a full envelope, staggered.
+ * Returns ns per output frame. Output is left in (synthbench.pcm).
+ */
+
+#define SYNTHBENCH_SUSTAIN 0
+#define SYNTHBENCH_RELEASE 1
+#define SYNTHBENCH_ADSR    2
+
+static const char *synthbench_mode_names[]={"sustain","release","adsr"};
+
+static double synthbench_voices_once(int *framecp,int rate,int voicec,int mode) {
+  struct synth *synth=calloc(1,sizeof(struct synth));
+  if (!synth) return 0.0;
+  synth_init(synth,rate);
+  synth->wavev[0]=wave;
+  synth->envelopev[0]=(struct synth_envelope){300,500,SYNTH_SUSTAIN_FULL>>1,1000};
+  // Voice ids come off the free stack, not in order, so track which one each RELEASE note got.
+  int8_t idv[SYNTH_VOICE_LIMIT];
+  uint8_t endedv[SYNTH_VOICE_LIMIT];
+  int i;
+  for (i=0;i<voicec;i++) {
+    if (mode==SYNTHBENCH_RELEASE) idv[i]=synth_fireforget_note(synth,wave,0x30+i*5,synth->release_time);
+    else if (mode==SYNTHBENCH_SUSTAIN) synth_begin_note(synth,wave,0x30+i*5);
+  }
+  int framec=SYNTHBENCH_SECONDS*rate;
+  *framecp=framec;
+  int16_t *dst=synthbench.pcm;
+  int blockp=0;
+  double starttime=synthbench_now();
+  while (framec>0) {
+    if (mode==SYNTHBENCH_RELEASE) {
+      // Find them all before restarting any, since a restart may reuse another ended note's id.
+      for (i=0;i<voicec;i++) endedv[i]=(idv[i]<0)||!synth->voices.ttl[idv[i]];
+      for (i=0;i<voicec;i++) {
+        if (endedv[i]) idv[i]=synth_fireforget_note(synth,wave,0x30+i*5,synth->release_time);
+      }
+    } else if (mode==SYNTHBENCH_ADSR) {
+      for (i=0;i<voicec;i++) {
+        switch ((blockp+i)%8) {
+          case 0: synth_note_on(synth,0,0x30+i*3); break;
+          case 5: synth_note_off(synth,0,0x30+i*3); break;
+        }
+      }
+      blockp++;
+    }
+    int c=(framec<SYNTHBENCH_BLOCK)?framec:SYNTHBENCH_BLOCK;
+    synth_render(synth,dst,c,1);
+    dst+=c;
+    framec-=c;
+  }
+  double elapsed=synthbench_now()-starttime;
+  free(synth);
+  return (elapsed*1000000000.0)/(*framecp);
+}
+
+/* Songs, start to finish, per-sample or block.
+ * Returns ns per output frame. Output is left in (synthbench.pcm).
+ */
+
+static double synthbench_song_once(int *framecp,const struct songinfo *songinfo,int rate,int per_sample) {
+  struct synth *synth=calloc(1,sizeof(struct synth));
+  if (!synth) return 0.0;
+  synth_init(synth,rate);
+  synth->wavev[0]=wave0;
+  synth->wavev[1]=wave1;
+  synth->wavev[2]=wave2;
+  synth->wavev[3]=wave3;
+  synth->wavev[4]=wave4;
+  synth->wavev[5]=wave5;
+  synth->wavev[6]=wave6;
+  synth->wavev[7]=wave7;
+  const uint8_t *hdr=songinfo->song;
+  int addlhdrlen=hdr[2]|(hdr[3]<<8);
+  int songlen=hdr[4]|(hdr[5]<<8);
+  if (synth_play_song(synth,hdr+8+addlhdrlen,songlen)<0) {
+    fprintf(stderr,"%s: Rejecting malformed song.\n",songinfo->name);
+    synthbench.status=1;
+    free(synth);
+    *framecp=0;
+    return 0.0;
+  }
+  int framec=0,limit=synthbench.pcma;
+  int16_t *dst=synthbench.pcm;
+  double starttime=synthbench_now();
+  if (per_sample) {
+    while ((synth->song||synth->voicec)&&(framec<limit)) {
+      int c=SYNTHBENCH_BLOCK;
+      if (c>limit-framec) c=limit-framec;
+      framec+=c;
+      while (c-->0) *(dst++)=synth_update(synth);
+    }
+  } else {
+    while ((synth->song||synth->voicec)&&(framec<limit)) {
+      int c=SYNTHBENCH_BLOCK;
+      if (c>limit-framec) c=limit-framec;
+      synth_render(synth,dst,c,1);
+      dst+=c;
+      framec+=c;
+    }
+  }
+  double elapsed=synthbench_now()-starttime;
+  free(synth);
+  *framecp=framec;
+  if (!framec) return 0.0;
+  return (elapsed*1000000000.0)/framec;
+}
+
+/* Repeat a run and take the median time. Hash must not vary between runs.
+ */
+
+static double synthbench_voices(uint32_t *hash,int rate,int voicec,int mode) {
+  double nsv[SYNTHBENCH_REPEAT_LIMIT];
+  int framec=0,i=0;
+  for (;i<synthbench.repeat;i++) nsv[i]=synthbench_voices_once(&framec,rate,voicec,mode);
+  *hash=synthbench_hash(synthbench.pcm,framec);
+  return synthbench_median(nsv,synthbench.repeat);
+}
+
+static double synthbench_song(uint32_t *hash,const struct songinfo *songinfo,int rate,int per_sample) {
+  double nsv[SYNTHBENCH_REPEAT_LIMIT];
+  int framec=0,i=0;
+  for (;i<synthbench.repeat;i++) nsv[i]=synthbench_song_once(&framec,songinfo,rate,per_sample);
+  *hash=synthbench_hash(synthbench.pcm,framec);
+  return synthbench_median(nsv,synthbench.repeat);
+}
+
+/* Song display name as a scenario name: lowercase and underscores.
+ */
+
+static void synthbench_song_name(char *dst,int dsta,const char *name) {
+  int c=0;
+  for (;*name&&(c<dsta-1);name++) {
+    if ((*name>='A')&&(*name<='Z')) dst[c++]=(*name)+0x20;
+    else if (((*name>='a')&&(*name<='z'))||((*name>='0')&&(*name<='9'))) dst[c++]=*name;
+    else if (c&&(dst[c-1]!='_')) dst[c++]='_';
+  }
+  dst[c]=0;
+}
+
+/* The release gain as it used to be computed, with an integer division per sample.
+ * Kept only as the "before" for comparing envelope kernels.
+ */
+
+static void synthbench_release_divide(int32_t *dst,int c,const int16_t *v,uint32_t p,uint32_t pd,uint32_t ttl,uint32_t release_time) {
+  for (;c-->0;dst++,p+=pd) {
+    ttl--;
+    int32_t sample=v[p>>SYNTH_P_SHIFT];
+    sample*=((ttl*0x400)/release_time);
+    *dst+=sample;
+  }
+}
+
+/* Run one voice through release ramps over and over, in mix-sized chunks, with a given kernel or the old division.
+ * Returns ns per voice-sample, and TSC ticks per voice-sample where we have one.
+ */
+
+static double synthbench_envelope(double *ticks,const struct synth_mixer *mixer) {
+  int32_t mix[SYNTH_MIX_CHUNK]={0};
+  const uint32_t release_time=SYNTH_RELEASE_TIME_22050;
+  const uint32_t pd=0x01000000;
+  const int total=SYNTHBENCH_SECONDS*22050*16;
+  uint32_t p=0;
+  int framec=total;
+  double starttime=synthbench_now();
+  #if SYNTHBENCH_TSC
+    uint64_t starttsc=__rdtsc();
+  #endif
+  while (framec>0) {
+    uint32_t ttl=release_time;
+    uint32_t level=SYNTH_LEVEL_FULL;
+    int32_t step=-(int32_t)(level/ttl);
+    while (ttl) {
+      int c=(ttl<SYNTH_MIX_CHUNK)?ttl:SYNTH_MIX_CHUNK;
+      if (mixer) mixer->envelope(mix,c,wave,p,pd,level,step);
+      else synthbench_release_divide(mix,c,wave,p,pd,ttl,release_time);
+      level+=(uint32_t)step*c;
+      p+=pd*c;
+      ttl-=c;
+      framec-=c;
+    }
+  }
+  #if SYNTHBENCH_TSC
+    *ticks=(double)(__rdtsc()-starttsc)/(total-framec);
+  #else
+    *ticks=0.0;
+  #endif
+  // Make sure the compiler can't throw it all away.
+  if (mix[0]==0x7fffffff) fprintf(stderr,"!");
+  return ((synthbench_now()-starttime)*1000000000.0)/(total-framec);
+}
+
+/* Benches.
+ */
+
+static int synthbench_mixerc() {
+  int c=0;
+  while (synth_mixer_get(c)) c++;
+  return c;
+}
+
+static void synthbench_run_voices() {
+  int ratep=0;
+  for (;ratep<sizeof(synthbench_ratev)/sizeof(int);ratep++) {
+    int rate=synthbench_ratev[ratep];
+    if (synthbench_require_pcm(SYNTHBENCH_SECONDS*rate)<0) return;
+    int mode=0;
+    for (;mode<3;mode++) {
+      int voicec=1;
+      for (;voicec<=SYNTH_VOICE_LIMIT;voicec<<=1) {
+        uint32_t refhash=0;
+        double refns=0.0;
+        // Run mixers in reverse, so the portable one (always last) is the reference.
+        int p=synthbench_mixerc();
+        while (p-->0) {
+          const struct synth_mixer *mixer=synth_mixer_get(p);
+          synth_mixer_select(mixer->name);
+          uint32_t hash;
+          double ns=synthbench_voices(&hash,rate,voicec,mode);
+          synthbench_report("voices",mixer->name,synthbench_mode_names[mode],rate,voicec,"frame",ns,refns,hash,refns&&(hash!=refhash));
+          if (!refns) {
+            refns=ns;
+            refhash=hash;
+          }
+        }
+      }
+    }
+  }
+}
+
+static void synthbench_run_songs() {
+  if (synthbench_require_pcm(SYNTHBENCH_SONG_LIMIT*synthbench_ratev[sizeof(synthbench_ratev)/sizeof(int)-1])<0) return;
+  const struct songinfo *songinfo=songinfov;
+  int i=songinfoc;
+  for (;i-->0;songinfo++) {
+    char name[64];
+    synthbench_song_name(name,sizeof(name),songinfo->name);
+    int ratep=0;
+    for (;ratep<sizeof(synthbench_ratev)/sizeof(int);ratep++) {
+      int rate=synthbench_ratev[ratep];
+      uint32_t refhash=0;
+      double refns=0.0;
+      int p=synthbench_mixerc();
+      while (p-->0) {
+        const struct synth_mixer *mixer=synth_mixer_get(p);
+        synth_mixer_select(mixer->name);
+        uint32_t hash;
+        double ns=synthbench_song(&hash,songinfo,rate,0);
+        synthbench_report("song",mixer->name,name,rate,0,"frame",ns,refns,hash,refns&&(hash!=refhash));
+        if (!refns) {
+          refns=ns;
+          refhash=hash;
+        }
+      }
+    }
+  }
+}
+
+static void synthbench_run_update() {
+  if (synthbench_require_pcm(SYNTHBENCH_SONG_LIMIT*22050)<0) return;
+  const struct songinfo *songinfo=songinfov;
+  int i=songinfoc;
+  for (;i-->0;songinfo++) {
+    char name[64];
+    synthbench_song_name(name,sizeof(name),songinfo->name);
+    int p=synthbench_mixerc();
+    while (p-->0) {
+      const struct synth_mixer *mixer=synth_mixer_get(p);
+      synth_mixer_select(mixer->name);
+      uint32_t refhash,hash;
+      double refns=synthbench_song(&refhash,songinfo,22050,1);
+      synthbench_report("update",mixer->name,name,22050,0,"frame",refns,0.0,refhash,0);
+      double ns=synthbench_song(&hash,songinfo,22050,0);
+      synthbench_report("render",mixer->name,name,22050,0,"frame",ns,refns,hash,hash!=refhash);
+    }
+  }
+}
+
+static void synthbench_run_envelope() {
+  double ticks;
+  double refns=synthbench_envelope(&ticks,0);
+  synthbench_report("envelope","-","divide",22050,1,"voice-sample",refns,0.0,0,0);
+  if (!synthbench.json&&(ticks>0.0)) fprintf(stdout,"%40s %.2f tsc/voice-sample\n","",ticks);
+  const struct synth_mixer *mixer;
+  uint8_t p=0;
+  for (;mixer=synth_mixer_get(p);p++) {
+    double ns=synthbench_envelope(&ticks,mixer);
+    synthbench_report("envelope",mixer->name,"incremental",22050,1,"voice-sample",ns,refns,0,0);
+    if (!synthbench.json&&(ticks>0.0)) fprintf(stdout,"%40s %.2f tsc/voice-sample\n","",ticks);
+  }
+}
+
+/* Main.
+ */
+
+int main(int argc,char **argv) {
+  synthbench.repeat=3;
+  int argp=1;
+  for (;argp<argc;argp++) {
+    const char *arg=argv[argp];
+    if (!strcmp(arg,"--json")) synthbench.json=1;
+    else if (!memcmp(arg,"--label=",8)) synthbench.label=arg+8;
+    else if (!memcmp(arg,"--repeat=",9)) {
+      synthbench.repeat=atoi(arg+9);
+      if ((synthbench.repeat<1)||(synthbench.repeat>SYNTHBENCH_REPEAT_LIMIT)) {
+        fprintf(stderr,"%s: --repeat must be 1..%d\n",argv[0],SYNTHBENCH_REPEAT_LIMIT);
+        return 1;
+      }
+    } else {
+      fprintf(stderr,"Usage: %s [--json] [--label=STRING] [--repeat=COUNT]\n",argv[0]);
+      return 1;
+    }
+  }
+
+  int i;
+  for (i=0;i<512;i++) wave[i]=(int16_t)(sin((i*M_PI*2.0)/512.0)*8000.0);
+  for (i=1;i<SYNTH_WAVE_LEVELS;i++) memcpy(wave+i*512,wave,sizeof(int16_t)*512);
+
+  if (synthbench.json) {
+    fprintf(stdout,"{\n  \"label\":\"");
+    const char *src=synthbench.label?synthbench.label:"";
+    for (;*src;src++) {
+      if ((*src=='"')||(*src=='\\')) fputc('\\',stdout);
+      if ((unsigned char)*src>=0x20) fputc(*src,stdout);
+    }
+    fprintf(stdout,"\",\n  \"voice_limit\":%d,\n  \"mix_chunk\":%d,\n  \"wave_levels\":%d,\n  \"repeat\":%d,\n  \"results\":[",
+      SYNTH_VOICE_LIMIT,SYNTH_MIX_CHUNK,SYNTH_WAVE_LEVELS,synthbench.repeat
+    );
+  } else if (synthbench.label) {
+    fprintf(stdout,"%s\n",synthbench.label);
+  }
+
+  synthbench_run_voices();
+  synthbench_run_songs();
+  synthbench_run_update();
+  synthbench_run_envelope();
+
+  if (synthbench.json) fprintf(stdout,"\n  ],\n  \"ok\":%s\n}\n",synthbench.status?"false":"true");
+  if (synthbench.pcm) free(synthbench.pcm);
+  return synthbench.status;
+}